@@ -8,41 +8,436 @@ extern "C" {
 #define LUA_LIB
 #include <lua.h>
 
-int l_Vec_new(lua_State *L);
+#include <stddef.h>
 
-int l_Vec_with_capacity(lua_State *L);
+/*
+ *  Everything declared with LARR_API is exported from the shared
+ *  library; all other symbols are hidden. The larr_* functions below are
+ *  the stable C API for native modules that want to share Vec buffers
+ *  without going through the Lua stack. Their signatures and the
+ *  LARR_TYPE_* values only change when LARR_API_VERSION is bumped.
+ */
 
-int l_Vec_meta_gc(lua_State *L);
+#define LARR_API_VERSION 1
 
-int l_Vec_capacity(lua_State *L);
+#if defined(_WIN32)
+#define LARR_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define LARR_API __attribute__((visibility("default")))
+#else
+#define LARR_API
+#endif
+
+typedef enum LarrType {
+    LARR_TYPE_NUMBER,
+    LARR_TYPE_INTEGER,
+    LARR_TYPE_BOOLEAN,
+    LARR_TYPE_STRING,
+    LARR_TYPE_TABLE,
+    LARR_TYPE_FUNCTION,
+    LARR_TYPE_USERDATA,
+    LARR_TYPE_THREAD,
+    LARR_TYPE_LIGHT_USERDATA
+} LarrType;
+
+/**
+ *  @returns The LARR_API_VERSION that the loaded library was built
+ *           with. Callers should compare it against the version in the
+ *           header they were compiled with before using anything else.
+ */
+LARR_API int larr_api_version(void);
+
+/**
+ *  Checks that the value at idx is a larr.Vec and describes its buffer.
+ *  Raises a Lua error if it is not. The pointer is only valid until the
+ *  Vec is next modified or collected.
+ *
+ *  @param ptr If not NULL, receives a pointer to the first element.
+ *  @param len If not NULL, receives the number of elements.
+ *  @param elem_type If not NULL, receives one of LarrType.
+ */
+LARR_API void larr_check_vec(lua_State *L, int idx, const void **ptr, size_t *len,
+                             int *elem_type);
+
+/**
+ *  Like larr_check_vec, but returns zero instead of raising an error if
+ *  the value at idx is not a larr.Vec. Never raises an error itself.
+ *  The buffer may be shared with copy-on-write clones, so it must not be
+ *  written through; larr_vec_reserve(L, idx, 0) returns a writable one.
+ */
+LARR_API int larr_test_vec(lua_State *L, int idx, const void **ptr, size_t *len,
+                           int *elem_type);
+
+/**
+ *  Pushes a new, empty larr.Vec onto the stack. Raises a Lua error if
+ *  elem_type is not supported or if allocation fails.
+ *
+ *  @param elem_type One of LarrType.
+ *  @param capacity The number of elements to preallocate.
+ *  @returns A pointer to the Vec's buffer, which has room for capacity
+ *           elements.
+ */
+LARR_API void* larr_push_new_vec(lua_State *L, int elem_type, size_t capacity);
+
+/**
+ *  Makes room for at least additional more elements in the Vec at idx
+ *  without changing its length. Raises a Lua error on failure.
+ *
+ *  @returns A mutable pointer to the Vec's (possibly moved) buffer.
+ */
+LARR_API void* larr_vec_reserve(lua_State *L, int idx, size_t additional);
+
+/**
+ *  Sets the length of the Vec at idx to len. New elements are zeroed.
+ *  Raises a Lua error on failure.
+ *
+ *  @returns A mutable pointer to the Vec's (possibly moved) buffer.
+ */
+LARR_API void* larr_vec_resize(lua_State *L, int idx, size_t len);
+
+/**
+ *  A larr.AppendBuffer, which native threads can append numbers to
+ *  concurrently without a lua_State or a lock. Only the lua_State that
+ *  owns it can take the numbers out, with drain_into or seal.
+ */
+typedef struct LarrAppendBuffer LarrAppendBuffer;
+
+/**
+ *  Checks that the value at idx is a larr.AppendBuffer and returns it.
+ *  Raises a Lua error if it is not. The buffer lives as long as the
+ *  larr.AppendBuffer unless a reference is taken with
+ *  larr_append_buffer_retain.
+ */
+LARR_API LarrAppendBuffer* larr_check_append_buffer(lua_State *L, int idx);
+
+/** Takes a reference to buf. Safe to call from any thread. */
+LARR_API void larr_append_buffer_retain(LarrAppendBuffer *buf);
+
+/**
+ *  Drops a reference taken with larr_append_buffer_retain, freeing buf
+ *  if it was the last one. Safe to call from any thread.
+ */
+LARR_API void larr_append_buffer_release(LarrAppendBuffer *buf);
+
+/**
+ *  Appends value to buf. Safe to call from any thread, concurrently
+ *  with other producers and with the consumer.
+ *
+ *  @returns Nonzero on success, zero if buf is sealed or memory for it
+ *           couldn't be allocated.
+ */
+LARR_API int larr_append_buffer_push(LarrAppendBuffer *buf, lua_Number value);
+
+/**
+ *  Appends n values to buf in order, with a single atomic reservation.
+ *  Safe to call from any thread, like larr_append_buffer_push.
+ *
+ *  @returns Nonzero on success, zero if buf is sealed or memory for
+ *           some of the values couldn't be allocated; those values are
+ *           counted by the larr.AppendBuffer's dropped method.
+ */
+LARR_API int larr_append_buffer_push_n(LarrAppendBuffer *buf, const lua_Number *values,
+                                       size_t n);
+
+LARR_API int l_Vec_new(lua_State *L);
+
+LARR_API int l_Vec_with_capacity(lua_State *L);
+
+LARR_API int l_Vec_zeros(lua_State *L);
+
+LARR_API int l_Vec_filled(lua_State *L);
+
+LARR_API int l_Vec_range(lua_State *L);
+
+LARR_API int l_Vec_linspace(lua_State *L);
+
+LARR_API int l_Vec_from_string(lua_State *L);
+
+LARR_API int l_Vec_resize(lua_State *L);
+
+LARR_API int l_Vec_meta_gc(lua_State *L);
+
+LARR_API int l_Vec_capacity(lua_State *L);
+
+LARR_API int l_Vec_meta_len(lua_State *L);
+
+LARR_API int l_Vec_is_empty(lua_State *L);
+
+LARR_API int l_Vec_first(lua_State *L);
+
+LARR_API int l_Vec_last(lua_State *L);
+
+LARR_API int l_Vec_meta_index(lua_State *L);
+
+LARR_API int l_Vec_meta_newindex(lua_State *L);
+
+LARR_API int l_Vec_push(lua_State *L);
+
+LARR_API int l_Vec_pop(lua_State *L);
+
+LARR_API int l_Vec_insert(lua_State *L);
+
+LARR_API int l_Vec_remove(lua_State *L);
+
+LARR_API int l_Vec_clear(lua_State *L);
+
+LARR_API int l_Vec_clone(lua_State *L);
+
+LARR_API int l_Vec_meta_tostring(lua_State *L);
+
+LARR_API int l_Vec_append(lua_State *L);
+
+LARR_API int l_Vec_extend_from_coroutine(lua_State *L);
+
+LARR_API int l_Vec_map(lua_State *L);
+
+LARR_API int l_Vec_filter(lua_State *L);
+
+LARR_API int l_Vec_reduce(lua_State *L);
+
+LARR_API int l_Vec_foreach(lua_State *L);
+
+LARR_API int l_Expr_new(lua_State *L);
+
+LARR_API int l_Expr_meta_add(lua_State *L);
+
+LARR_API int l_Expr_meta_sub(lua_State *L);
+
+LARR_API int l_Expr_meta_mul(lua_State *L);
+
+LARR_API int l_Expr_meta_div(lua_State *L);
+
+LARR_API int l_Expr_meta_unm(lua_State *L);
+
+LARR_API int l_Expr_eval(lua_State *L);
+
+LARR_API int l_Columns_new(lua_State *L);
+
+LARR_API int l_Columns_meta_len(lua_State *L);
+
+LARR_API int l_Columns_meta_index(lua_State *L);
+
+LARR_API int l_Columns_fields(lua_State *L);
+
+LARR_API int l_Columns_column(lua_State *L);
+
+LARR_API int l_Columns_push(lua_State *L);
+
+LARR_API int l_Columns_row(lua_State *L);
+
+LARR_API int l_Columns_get(lua_State *L);
+
+LARR_API int l_Columns_set(lua_State *L);
+
+LARR_API int l_NDArray_new(lua_State *L);
+
+LARR_API int l_NDArray_ndim(lua_State *L);
+
+LARR_API int l_NDArray_meta_len(lua_State *L);
+
+LARR_API int l_NDArray_shape(lua_State *L);
+
+LARR_API int l_NDArray_strides(lua_State *L);
+
+LARR_API int l_NDArray_vec(lua_State *L);
+
+LARR_API int l_NDArray_get(lua_State *L);
+
+LARR_API int l_NDArray_set(lua_State *L);
+
+LARR_API int l_NDArray_reshape(lua_State *L);
+
+LARR_API int l_NDArray_transpose(lua_State *L);
+
+LARR_API int l_NDArray_slice(lua_State *L);
+
+LARR_API int l_NDArray_broadcast_to(lua_State *L);
+
+LARR_API int l_NDArray_to_vec(lua_State *L);
+
+LARR_API int l_Vec_cumsum(lua_State *L);
+
+LARR_API int l_Vec_cumprod(lua_State *L);
+
+LARR_API int l_Vec_cummin(lua_State *L);
+
+LARR_API int l_Vec_cummax(lua_State *L);
+
+LARR_API int l_Vec_exclusive_cumsum(lua_State *L);
+
+LARR_API int l_Vec_diff(lua_State *L);
+
+LARR_API int l_Vec_bincount(lua_State *L);
+
+LARR_API int l_Vec_histogram(lua_State *L);
+
+LARR_API int l_Vec_unique(lua_State *L);
+
+LARR_API int l_Vec_value_counts(lua_State *L);
+
+LARR_API int l_Vec_take(lua_State *L);
+
+LARR_API int l_Vec_put(lua_State *L);
+
+LARR_API int l_Vec_select(lua_State *L);
+
+LARR_API int l_Vec_where(lua_State *L);
+
+LARR_API int l_Vec_compress(lua_State *L);
+
+LARR_API int l_Vec_fill_random(lua_State *L);
+
+LARR_API int l_Vec_shuffle(lua_State *L);
+
+LARR_API int l_Vec_sample(lua_State *L);
+
+LARR_API int l_Vec_cast(lua_State *L);
+
+LARR_API int l_Vec_cast_inplace(lua_State *L);
+
+LARR_API int l_PackedVec_meta_gc(lua_State *L);
+
+LARR_API int l_PackedVec_meta_len(lua_State *L);
+
+LARR_API int l_PackedVec_meta_index(lua_State *L);
+
+LARR_API int l_PackedVec_meta_tostring(lua_State *L);
+
+LARR_API int l_PackedVec_get(lua_State *L);
+
+LARR_API int l_PackedVec_decompress(lua_State *L);
+
+LARR_API int l_PackedVec_sum(lua_State *L);
+
+LARR_API int l_PackedVec_min(lua_State *L);
+
+LARR_API int l_PackedVec_max(lua_State *L);
+
+LARR_API int l_PackedVec_codec(lua_State *L);
+
+LARR_API int l_PackedVec_nbytes(lua_State *L);
+
+LARR_API int l_SparseVec_new(lua_State *L);
+
+LARR_API int l_SparseVec_meta_len(lua_State *L);
+
+LARR_API int l_SparseVec_meta_tostring(lua_State *L);
+
+LARR_API int l_SparseVec_nnz(lua_State *L);
+
+LARR_API int l_SparseVec_get(lua_State *L);
+
+LARR_API int l_SparseVec_set(lua_State *L);
+
+LARR_API int l_SparseVec_indices(lua_State *L);
+
+LARR_API int l_SparseVec_values(lua_State *L);
+
+LARR_API int l_SparseVec_to_dense(lua_State *L);
+
+LARR_API int l_SparseVec_from_dense(lua_State *L);
+
+LARR_API int l_SparseVec_dot(lua_State *L);
+
+LARR_API int l_SparseVec_axpy(lua_State *L);
+
+LARR_API int l_Heap_new(lua_State *L);
+
+LARR_API int l_Heap_meta_len(lua_State *L);
+
+LARR_API int l_Heap_is_empty(lua_State *L);
+
+LARR_API int l_Heap_push(lua_State *L);
+
+LARR_API int l_Heap_top(lua_State *L);
+
+LARR_API int l_Heap_pop(lua_State *L);
+
+LARR_API int l_Heap_replace(lua_State *L);
+
+LARR_API int l_Heap_heapify(lua_State *L);
+
+LARR_API int l_Heap_clear(lua_State *L);
+
+LARR_API int l_Heap_keys(lua_State *L);
+
+LARR_API int l_Heap_payloads(lua_State *L);
+
+LARR_API int l_load_async(lua_State *L);
+
+LARR_API int l_Vec_save_async(lua_State *L);
+
+LARR_API int l_IOHandle_meta_gc(lua_State *L);
+
+LARR_API int l_IOHandle_ready(lua_State *L);
+
+LARR_API int l_IOHandle_wait(lua_State *L);
+
+LARR_API int l_IOHandle_poll(lua_State *L);
+
+LARR_API int l_Vec_shared(lua_State *L);
+
+LARR_API int l_Vec_attach(lua_State *L);
+
+LARR_API int l_Vec_unlink(lua_State *L);
+
+LARR_API int l_Vec_publish(lua_State *L);
+
+LARR_API int l_Vec_generation(lua_State *L);
+
+LARR_API int l_Vec_share(lua_State *L);
+
+LARR_API int l_Vec_from_shared(lua_State *L);
+
+LARR_API int l_Vec_discard_shared(lua_State *L);
+
+LARR_API int l_AppendBuffer_new(lua_State *L);
+
+LARR_API int l_AppendBuffer_meta_gc(lua_State *L);
+
+LARR_API int l_AppendBuffer_push(lua_State *L);
+
+LARR_API int l_AppendBuffer_drain_into(lua_State *L);
+
+LARR_API int l_AppendBuffer_seal(lua_State *L);
+
+LARR_API int l_AppendBuffer_is_sealed(lua_State *L);
+
+LARR_API int l_AppendBuffer_dropped(lua_State *L);
+
+LARR_API int l_Vec_open_log(lua_State *L);
+
+LARR_API int l_VecLog_meta_gc(lua_State *L);
+
+LARR_API int l_VecLog_meta_len(lua_State *L);
 
-int l_Vec_meta_len(lua_State *L);
+LARR_API int l_VecLog_push(lua_State *L);
 
-int l_Vec_is_empty(lua_State *L);
+LARR_API int l_VecLog_append(lua_State *L);
 
-int l_Vec_first(lua_State *L);
+LARR_API int l_VecLog_vec(lua_State *L);
 
-int l_Vec_last(lua_State *L);
+LARR_API int l_VecLog_flush(lua_State *L);
 
-int l_Vec_meta_index(lua_State *L);
+LARR_API int l_VecLog_sync(lua_State *L);
 
-int l_Vec_meta_newindex(lua_State *L);
+LARR_API int l_VecLog_close(lua_State *L);
 
-int l_Vec_push(lua_State *L);
+LARR_API int l_gemm(lua_State *L);
 
-int l_Vec_pop(lua_State *L);
+LARR_API int l_gemv(lua_State *L);
 
-int l_Vec_insert(lua_State *L);
+LARR_API int l_axpy(lua_State *L);
 
-int l_Vec_remove(lua_State *L);
+LARR_API int l_Vec_sum(lua_State *L);
 
-int l_Vec_clear(lua_State *L);
+LARR_API int l_Vec_dot(lua_State *L);
 
-int l_Vec_meta_tostring(lua_State *L);
+LARR_API int l_simd(lua_State *L);
 
-int l_Vec_append(lua_State *L);
+LARR_API int l_quantum(lua_State *L);
 
-int luaopen_liblarr(lua_State *L);
+LARR_API int luaopen_liblarr(lua_State *L);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,123 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/* the public type codes are the internal ones under stable names */
+typedef char larr_type_codes_match[((int) LARR_TYPE_NUMBER == (int) TP_NUM
+                                    && (int) LARR_TYPE_INTEGER == (int) TP_INT
+                                    && (int) LARR_TYPE_BOOLEAN == (int) TP_BOOL
+                                    && (int) LARR_TYPE_STRING == (int) TP_STR
+                                    && (int) LARR_TYPE_TABLE == (int) TP_TBL
+                                    && (int) LARR_TYPE_FUNCTION == (int) TP_FN
+                                    && (int) LARR_TYPE_USERDATA == (int) TP_USERDATA
+                                    && (int) LARR_TYPE_THREAD == (int) TP_THREAD
+                                    && (int) LARR_TYPE_LIGHT_USERDATA == (int) TP_LIGHT_USERDATA) ? 1 : -1];
+
+static void describe(const TypeVec *tv, const void **ptr, size_t *len, int *elem_type);
+
+int larr_api_version(void) {
+    return LARR_API_VERSION;
+}
+
+void larr_check_vec(lua_State *L, int idx, const void **ptr, size_t *len, int *elem_type) {
+    assert(L);
+
+    describe(check_tv(L, idx), ptr, len, elem_type);
+}
+
+int larr_test_vec(lua_State *L, int idx, const void **ptr, size_t *len, int *elem_type) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    /* not test_tv_mut, which would copy a shared buffer and can raise */
+    tv = (const TypeVec*) luaL_testudata(L, idx, "larr.Vec");
+
+    if (!tv) {
+        return 0;
+    }
+
+    describe(tv, ptr, len, elem_type);
+
+    return 1;
+}
+
+void* larr_push_new_vec(lua_State *L, int elem_type, size_t capacity) {
+    assert(L);
+
+    if (elem_type < 0 || elem_type >= TP_LENGTH) {
+        luaL_error(L, "invalid element type %d", elem_type);
+    }
+
+    return Vec_as_mut_ptr(&new_tv(L, typeinfo_of(elem_type), capacity)->vec);
+}
+
+void* larr_vec_reserve(lua_State *L, int idx, size_t additional) {
+    TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv_mut(L, idx);
+
+    if (Vec_reserve(&tv->vec, additional) != LARR_OK) {
+        luaL_error(L, "out of memory");
+    }
+
+    return Vec_as_mut_ptr(&tv->vec);
+}
+
+void* larr_vec_resize(lua_State *L, int idx, size_t len) {
+    TypeVec *tv;
+    size_t old_len;
+
+    assert(L);
+
+    tv = check_tv_mut(L, idx);
+    old_len = Vec_len(&tv->vec);
+
+    if (len <= old_len) {
+        tv->vtbl->truncate(tv, len, L);
+
+        return Vec_as_mut_ptr(&tv->vec);
+    }
+
+    if (Vec_reserve(&tv->vec, len - old_len) != LARR_OK) {
+        luaL_error(L, "out of memory");
+    }
+
+    memset((char*) Vec_as_mut_ptr(&tv->vec) + old_len * tv->vec.element_size, 0,
+           (len - old_len) * tv->vec.element_size);
+    tv->vec.len = len;
+
+    return Vec_as_mut_ptr(&tv->vec);
+}
+
+static void describe(const TypeVec *tv, const void **ptr, size_t *len, int *elem_type) {
+    assert(tv);
+
+    if (ptr) {
+        *ptr = Vec_as_ptr(&tv->vec);
+    }
+
+    if (len) {
+        *len = Vec_len(&tv->vec);
+    }
+
+    if (elem_type) {
+        *elem_type = tv->typeinfo.type;
+    }
+}
@@ -0,0 +1,428 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  larr.AppendBuffer collects numbers pushed by any number of native
+ *  threads, which need no lua_State, for the lua_State that created it
+ *  to consume as a Vec<number>.
+ *
+ *  Producers reserve slots with one atomic fetch-and-add on the next
+ *  free index, write their values and then set each slot's ready flag
+ *  with a release store, which the consumer reads with an acquire load.
+ *  Slots live in segments that are allocated on first use and never
+ *  move: segment k holds segment_len << k slots, so 48 of them cover
+ *  any realistic stream. Producers race to install a missing segment
+ *  with a compare-and-swap; the loser frees its allocation. If the
+ *  allocation fails, the segment is marked failed, every push that
+ *  lands in it fails, and the consumer counts its slots as dropped.
+ *
+ *  The consumer takes the longest prefix of ready slots, so what it
+ *  sees is always contiguous even while producers are mid-write, and
+ *  frees each segment once it has taken all of it. Sealing sets the top
+ *  bit of the next free index, which fails every later reservation, and
+ *  then waits for the reservations made before it to be written.
+ */
+
+#define SEGMENT_COUNT 48
+
+#define DEFAULT_SEGMENT_LEN 1024
+
+#define SEALED_BIT ((size_t) 1 << (sizeof(size_t) * CHAR_BIT - 1))
+
+/* marks a segment whose allocation failed */
+#define FAILED_SEGMENT ((void*) &failed_segment)
+
+static char failed_segment;
+
+struct LarrAppendBuffer {
+    size_t refcount;
+    /* only accessed through atomic builtins */
+    size_t reserved; /* the next free slot, ORed with SEALED_BIT once sealed */
+    void *segments[SEGMENT_COUNT];
+
+    unsigned segment_shift; /* segment 0 holds 1 << segment_shift slots */
+
+    /* only touched by the consumer */
+    size_t head;
+    size_t sealed_len;
+    size_t dropped;
+};
+
+static LarrAppendBuffer** check_buffer(lua_State *L, int arg);
+
+static unsigned segment_of(const LarrAppendBuffer *buf, size_t index, size_t *start, size_t *len);
+
+static void* get_segment(LarrAppendBuffer *buf, unsigned k, size_t len);
+
+static int drain(LarrAppendBuffer *buf, TypeVec *dst, lua_State *L);
+
+static size_t limit_of(const LarrAppendBuffer *buf);
+
+int l_AppendBuffer_new(lua_State *L) {
+    LarrAppendBuffer **handle;
+    LarrAppendBuffer *buf;
+    size_t segment_len;
+    unsigned shift;
+
+    assert(L);
+
+    segment_len = lua_isnoneornil(L, 1) ? DEFAULT_SEGMENT_LEN : check_size_t(L, 1);
+    luaL_argcheck(L, segment_len > 0 && segment_len <= ((size_t) 1 << 24), 1,
+                  "segment length must be between 1 and 2^24");
+
+    for (shift = 0; ((size_t) 1 << shift) < segment_len; ++shift) { }
+
+    handle = (LarrAppendBuffer**) lua_newuserdata(L, sizeof(LarrAppendBuffer*));
+    *handle = NULL;
+    luaL_setmetatable(L, "larr.AppendBuffer");
+
+    buf = (LarrAppendBuffer*) calloc(1, sizeof(LarrAppendBuffer));
+
+    if (!buf) {
+        return luaL_error(L, "out of memory");
+    }
+
+    buf->refcount = 1;
+    buf->segment_shift = shift;
+    *handle = buf;
+
+    return 1;
+}
+
+int l_AppendBuffer_meta_gc(lua_State *L) {
+    LarrAppendBuffer **handle;
+
+    assert(L);
+
+    handle = (LarrAppendBuffer**) luaL_checkudata(L, 1, "larr.AppendBuffer");
+
+    if (*handle) {
+        larr_append_buffer_release(*handle);
+        *handle = NULL;
+    }
+
+    return 0;
+}
+
+int l_AppendBuffer_push(lua_State *L) {
+    LarrAppendBuffer *buf;
+    lua_Number value;
+
+    assert(L);
+
+    buf = *check_buffer(L, 1);
+    value = luaL_checknumber(L, 2);
+
+    if (!larr_append_buffer_push(buf, value)) {
+        return luaL_error(L, (__atomic_load_n(&buf->reserved, __ATOMIC_RELAXED) & SEALED_BIT)
+                             ? "larr.AppendBuffer is sealed" : "out of memory");
+    }
+
+    return 0;
+}
+
+int l_AppendBuffer_drain_into(lua_State *L) {
+    LarrAppendBuffer *buf;
+    TypeVec *dst;
+    size_t old_len;
+
+    assert(L);
+
+    buf = *check_buffer(L, 1);
+    dst = check_tv_mut(L, 2);
+    luaL_argcheck(L, dst->typeinfo.type == TP_NUM, 2, "expected larr.Vec<number>");
+
+    old_len = Vec_len(&dst->vec);
+    drain(buf, dst, L);
+    push_size_t(L, Vec_len(&dst->vec) - old_len);
+
+    return 1;
+}
+
+int l_AppendBuffer_seal(lua_State *L) {
+    LarrAppendBuffer *buf;
+    TypeVec *dst;
+    size_t old;
+
+    assert(L);
+
+    buf = *check_buffer(L, 1);
+    lua_settop(L, 1);
+
+    old = __sync_fetch_and_or(&buf->reserved, SEALED_BIT);
+
+    if (!(old & SEALED_BIT)) {
+        buf->sealed_len = old;
+    }
+
+    dst = new_tv(L, typeinfo_of(TP_NUM), buf->sealed_len - buf->head);
+
+    /* producers that reserved before the seal are a few stores from done */
+    while (!drain(buf, dst, L)) {
+        sched_yield();
+    }
+
+    return 1;
+}
+
+int l_AppendBuffer_is_sealed(lua_State *L) {
+    assert(L);
+
+    lua_pushboolean(L, (__atomic_load_n(&(*check_buffer(L, 1))->reserved, __ATOMIC_RELAXED)
+                        & SEALED_BIT) != 0);
+
+    return 1;
+}
+
+int l_AppendBuffer_dropped(lua_State *L) {
+    assert(L);
+
+    push_size_t(L, (*check_buffer(L, 1))->dropped);
+
+    return 1;
+}
+
+LarrAppendBuffer* larr_check_append_buffer(lua_State *L, int idx) {
+    assert(L);
+
+    return *check_buffer(L, idx);
+}
+
+void larr_append_buffer_retain(LarrAppendBuffer *buf) {
+    assert(buf);
+
+    __sync_add_and_fetch(&buf->refcount, 1);
+}
+
+void larr_append_buffer_release(LarrAppendBuffer *buf) {
+    unsigned k;
+
+    assert(buf);
+
+    if (__sync_sub_and_fetch(&buf->refcount, 1) > 0) {
+        return;
+    }
+
+    for (k = 0; k < SEGMENT_COUNT; ++k) {
+        if (buf->segments[k] != FAILED_SEGMENT) {
+            free(buf->segments[k]);
+        }
+    }
+
+    free(buf);
+}
+
+int larr_append_buffer_push(LarrAppendBuffer *buf, lua_Number value) {
+    assert(buf);
+
+    return larr_append_buffer_push_n(buf, &value, 1);
+}
+
+int larr_append_buffer_push_n(LarrAppendBuffer *buf, const lua_Number *values, size_t n) {
+    size_t index;
+    size_t stop;
+    int ok = 1;
+
+    assert(buf);
+    assert(values || n == 0);
+
+    index = __sync_fetch_and_add(&buf->reserved, n);
+
+    if (index & SEALED_BIT) {
+        return 0;
+    }
+
+    stop = index + n;
+
+    /* every reserved slot in a live segment must become ready, even after a failure */
+    while (index < stop) {
+        size_t start;
+        size_t len;
+        size_t count;
+        size_t i;
+        const unsigned k = segment_of(buf, index, &start, &len);
+        void *const segment = (k < SEGMENT_COUNT) ? get_segment(buf, k, len) : NULL;
+
+        count = (stop < start + len) ? stop - index : start + len - index;
+
+        if (!segment) {
+            ok = 0;
+        } else {
+            lua_Number *const slots = (lua_Number*) segment;
+            unsigned char *const ready = (unsigned char*) (slots + len);
+
+            memcpy(slots + (index - start), values, count * sizeof(lua_Number));
+
+            /* the release stores publish the values to the consumer's acquire loads */
+            for (i = index - start; i < index - start + count; ++i) {
+                __atomic_store_n(&ready[i], 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        index += count;
+        values += count;
+    }
+
+    return ok;
+}
+
+static LarrAppendBuffer** check_buffer(lua_State *L, int arg) {
+    LarrAppendBuffer **handle;
+
+    assert(L);
+
+    handle = (LarrAppendBuffer**) luaL_checkudata(L, arg, "larr.AppendBuffer");
+
+    if (!*handle) {
+        luaL_error(L, "larr.AppendBuffer was not initialized");
+    }
+
+    return handle;
+}
+
+/*
+ *  @returns The segment that holds slot index, which may be past the
+ *           last one, with its first slot and length in *start and *len
+ */
+static unsigned segment_of(const LarrAppendBuffer *buf, size_t index, size_t *start, size_t *len) {
+    size_t q;
+    unsigned k = 0;
+
+    assert(buf);
+    assert(start);
+    assert(len);
+
+    /* segment k starts at slot ((1 << k) - 1) << shift */
+    for (q = (index >> buf->segment_shift) + 1; q > 1; q >>= 1) {
+        ++k;
+    }
+
+    *start = (((size_t) 1 << k) - 1) << buf->segment_shift;
+    *len = (size_t) 1 << (k + buf->segment_shift);
+
+    return k;
+}
+
+/* @returns NULL if segment k couldn't be allocated */
+static void* get_segment(LarrAppendBuffer *buf, unsigned k, size_t len) {
+    void *segment;
+    void *installed;
+
+    assert(buf);
+    assert(k < SEGMENT_COUNT);
+
+    segment = __atomic_load_n(&buf->segments[k], __ATOMIC_ACQUIRE);
+
+    if (!segment) {
+        /* len values followed by len ready flags */
+        segment = calloc(len, sizeof(lua_Number) + 1);
+        installed = __sync_val_compare_and_swap(&buf->segments[k], NULL,
+                                                segment ? segment : FAILED_SEGMENT);
+
+        if (installed) {
+            free(segment);
+            segment = installed;
+        }
+    }
+
+    return (segment == FAILED_SEGMENT) ? NULL : segment;
+}
+
+/*
+ *  Appends the ready prefix of the slots that the consumer hasn't taken
+ *  to dst, freeing the segments that it empties.
+ *
+ *  @returns Nonzero if every slot reserved so far was taken
+ */
+static int drain(LarrAppendBuffer *buf, TypeVec *dst, lua_State *L) {
+    const size_t limit = limit_of(buf);
+
+    assert(buf);
+    assert(dst);
+    assert(L);
+
+    while (buf->head < limit) {
+        size_t start;
+        size_t len;
+        size_t stop;
+        size_t i;
+        const unsigned k = segment_of(buf, buf->head, &start, &len);
+        void *const segment = (k < SEGMENT_COUNT)
+            ? __atomic_load_n(&buf->segments[k], __ATOMIC_ACQUIRE) : FAILED_SEGMENT;
+
+        stop = (limit < start + len) ? limit : start + len;
+
+        if (!segment) {
+            return 0;
+        } else if (segment == FAILED_SEGMENT) {
+            /* the producers that reserved these slots have already failed */
+            buf->dropped += stop - buf->head;
+            buf->head = stop;
+
+            continue;
+        }
+
+        {
+            const lua_Number *const slots = (const lua_Number*) segment;
+            const unsigned char *const ready = (const unsigned char*) (slots + len);
+
+            for (i = buf->head;
+                 i < stop && __atomic_load_n(&ready[i - start], __ATOMIC_ACQUIRE);
+                 ++i) { }
+
+            if (i > buf->head) {
+                if (Vec_reserve(&dst->vec, i - buf->head) != LARR_OK) {
+                    luaL_error(L, "out of memory");
+                }
+
+                memcpy((lua_Number*) Vec_as_mut_ptr(&dst->vec) + Vec_len(&dst->vec),
+                       slots + (buf->head - start), (i - buf->head) * sizeof(lua_Number));
+                dst->vec.len += i - buf->head;
+            }
+        }
+
+        buf->head = i;
+
+        if (i == start + len) {
+            /* every producer with a slot here is finished with it */
+            __atomic_store_n(&buf->segments[k], NULL, __ATOMIC_RELAXED);
+            free(segment);
+        } else if (i < stop) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* @returns The number of slots reserved before the seal, or so far */
+static size_t limit_of(const LarrAppendBuffer *buf) {
+    size_t reserved;
+
+    assert(buf);
+
+    reserved = __atomic_load_n(&buf->reserved, __ATOMIC_ACQUIRE);
+
+    return (reserved & SEALED_BIT) ? buf->sealed_len : reserved;
+}
@@ -0,0 +1,483 @@
+#include <larr/larr.h>
+
+#include "kernels.h"
+#include "slice.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Dense row-major kernels over Vec<number> buffers. gemm follows the
+ *  usual Goto layout: a KC x NC panel of B and an MC x KC block of A are
+ *  packed into contiguous micro-panels so that the MR x NR micro-kernel
+ *  streams both operands with unit stride while its accumulators stay
+ *  in registers. Partial tiles are zero padded when packed, so the
+ *  micro-kernel never branches on the edges. The level 1 routines and
+ *  gemv's rows go through the runtime-selected kernels; sum and dot run
+ *  them one quantum at a time when sliced.
+ */
+
+#define GEMM_MR 4
+#define GEMM_NR 4
+#define GEMM_MC 64
+#define GEMM_KC 256
+#define GEMM_NC 512
+
+static const TypeVec* check_num_tv(lua_State *L, int arg, size_t len);
+
+static int sum_k(lua_State *L, int status, lua_KContext ctx);
+
+static int dot_k(lua_State *L, int status, lua_KContext ctx);
+
+static TypeVec* check_num_tv_out(lua_State *L, int arg, size_t len, lua_Number beta);
+
+static void gemm(size_t m, size_t n, size_t k, lua_Number alpha, const lua_Number *a,
+                 const lua_Number *b, lua_Number beta, lua_Number *c,
+                 lua_Number *pack_a, lua_Number *pack_b);
+
+int l_gemm(lua_State *L) {
+    const TypeVec *a;
+    const TypeVec *b;
+    TypeVec *c;
+    size_t m;
+    size_t n;
+    size_t k;
+    lua_Number alpha;
+    lua_Number beta;
+    lua_Number *pack_a;
+    lua_Number *pack_b;
+
+    assert(L);
+
+    m = check_size_t(L, 4);
+    n = check_size_t(L, 5);
+    k = check_size_t(L, 6);
+    alpha = luaL_optnumber(L, 7, 1);
+    beta = luaL_optnumber(L, 8, 0);
+
+    /* sizes whose product wraps around would pass the length checks */
+    luaL_argcheck(L, k == 0 || m <= (size_t) -1 / k, 6, "m * k is too large");
+    luaL_argcheck(L, n == 0 || k <= (size_t) -1 / n, 6, "k * n is too large");
+    luaL_argcheck(L, n == 0 || m <= (size_t) -1 / n, 5, "m * n is too large");
+
+    a = check_num_tv(L, 1, m * k);
+    b = check_num_tv(L, 2, k * n);
+
+    /* before check_num_tv_out, which may grow C */
+    if (check_tv(L, 3) == a || check_tv(L, 3) == b) {
+        return luaL_error(L, "C must not alias A or B");
+    }
+
+    c = check_num_tv_out(L, 3, m * n, beta);
+
+    if (m == 0 || n == 0) {
+        return 0;
+    }
+
+    pack_a = (lua_Number*) malloc(GEMM_MC * GEMM_KC * sizeof(lua_Number));
+    pack_b = (lua_Number*) malloc(GEMM_KC * GEMM_NC * sizeof(lua_Number));
+
+    if (!pack_a || !pack_b) {
+        free(pack_a);
+        free(pack_b);
+
+        return luaL_error(L, "out of memory");
+    }
+
+    gemm(m, n, k, alpha, (const lua_Number*) Vec_as_ptr(&a->vec),
+         (const lua_Number*) Vec_as_ptr(&b->vec), beta, (lua_Number*) Vec_as_mut_ptr(&c->vec),
+         pack_a, pack_b);
+
+    free(pack_a);
+    free(pack_b);
+
+    return 0;
+}
+
+int l_gemv(lua_State *L) {
+    const TypeVec *a;
+    const TypeVec *x;
+    TypeVec *y;
+    const lua_Number *a_data;
+    const lua_Number *x_data;
+    lua_Number *y_data;
+    size_t m;
+    size_t n;
+    size_t i;
+    lua_Number alpha;
+    lua_Number beta;
+
+    assert(L);
+
+    m = check_size_t(L, 4);
+    n = check_size_t(L, 5);
+    alpha = luaL_optnumber(L, 6, 1);
+    beta = luaL_optnumber(L, 7, 0);
+
+    luaL_argcheck(L, n == 0 || m <= (size_t) -1 / n, 5, "m * n is too large");
+
+    a = check_num_tv(L, 1, m * n);
+    x = check_num_tv(L, 2, n);
+
+    if (check_tv(L, 3) == a || check_tv(L, 3) == x) {
+        return luaL_error(L, "y must not alias A or x");
+    }
+
+    y = check_num_tv_out(L, 3, m, beta);
+
+    a_data = (const lua_Number*) Vec_as_ptr(&a->vec);
+    x_data = (const lua_Number*) Vec_as_ptr(&x->vec);
+    y_data = (lua_Number*) Vec_as_mut_ptr(&y->vec);
+
+    for (i = 0; i < m; ++i) {
+        const lua_Number acc = alpha * get_kernels()->num_dot(a_data + i * n, x_data, n);
+
+        y_data[i] = (beta == 0) ? acc : acc + beta * y_data[i];
+    }
+
+    return 0;
+}
+
+int l_axpy(lua_State *L) {
+    const TypeVec *x;
+    TypeVec *y;
+    lua_Number alpha;
+
+    assert(L);
+
+    alpha = luaL_checknumber(L, 1);
+    x = check_num_tv(L, 2, 0);
+    y = check_tv_mut(L, 3);
+    luaL_argcheck(L, y->typeinfo.type == TP_NUM, 3, "expected larr.Vec<number>");
+    luaL_argcheck(L, Vec_len(&y->vec) == Vec_len(&x->vec), 3, "x and y must have the same length");
+
+    get_kernels()->num_axpy(alpha, (const lua_Number*) Vec_as_ptr(&x->vec),
+                            (lua_Number*) Vec_as_mut_ptr(&y->vec), Vec_len(&y->vec));
+
+    return 0;
+}
+
+int l_Vec_sum(lua_State *L) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, 1,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+
+    lua_settop(L, 1);
+    lua_pushinteger(L, 0);
+
+    if (tv->typeinfo.type == TP_NUM) {
+        lua_pushnumber(L, 0);
+    } else {
+        lua_pushinteger(L, 0);
+    }
+    /* Vec, position, accumulator */
+
+    return sum_k(L, LUA_OK, 0);
+}
+
+int l_Vec_dot(lua_State *L) {
+    assert(L);
+
+    check_num_tv(L, 1, 0);
+    check_num_tv(L, 2, 0);
+
+    lua_settop(L, 2);
+    lua_pushinteger(L, 0);
+    lua_pushnumber(L, 0);
+    /* x, y, position, accumulator */
+
+    return dot_k(L, LUA_OK, 0);
+}
+
+int l_simd(lua_State *L) {
+    assert(L);
+
+    lua_pushstring(L, get_kernels()->isa);
+
+    return 1;
+}
+
+static const TypeVec* check_num_tv(lua_State *L, int arg, size_t len) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM, arg, "expected larr.Vec<number>");
+    luaL_argcheck(L, Vec_len(&tv->vec) >= len, arg, "Vec is too short for the given dimensions");
+
+    return tv;
+}
+
+/* an output that is fully overwritten (beta == 0) is grown to fit */
+static TypeVec* check_num_tv_out(lua_State *L, int arg, size_t len, lua_Number beta) {
+    TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv_mut(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM, arg, "expected larr.Vec<number>");
+
+    if (Vec_len(&tv->vec) < len) {
+        luaL_argcheck(L, beta == 0, arg, "Vec is too short for the given dimensions");
+
+        if (Vec_reserve(&tv->vec, len - Vec_len(&tv->vec)) != LARR_OK) {
+            luaL_error(L, "out of memory");
+        }
+
+        tv->vec.len = len;
+    }
+
+    return tv;
+}
+
+static int sum_k(lua_State *L, int status, lua_KContext ctx) {
+    const TypeVec *tv;
+    size_t quantum;
+    size_t pos;
+    size_t len;
+
+    assert(L);
+    (void) ctx;
+
+    if (status == LUA_YIELD && slice_cancelled(L, 3)) {
+        return luaL_error(L, "operation cancelled");
+    }
+
+    tv = check_tv(L, 1);
+    quantum = slice_quantum(L);
+    pos = (size_t) lua_tointeger(L, 2);
+    len = Vec_len(&tv->vec);
+
+    while (pos < len) {
+        const size_t n = (quantum > 0 && len - pos > quantum) ? quantum : len - pos;
+
+        if (tv->typeinfo.type == TP_NUM) {
+            const lua_Number *const data = (const lua_Number*) Vec_as_ptr(&tv->vec) + pos;
+
+            lua_pushnumber(L, lua_tonumber(L, 3) + get_kernels()->num_sum(data, n));
+        } else {
+            const lua_Integer *const data = (const lua_Integer*) Vec_as_ptr(&tv->vec) + pos;
+            lua_Unsigned acc = (lua_Unsigned) lua_tointeger(L, 3);
+            size_t i;
+
+            for (i = 0; i < n; ++i) {
+                acc += (lua_Unsigned) data[i];
+            }
+
+            lua_pushinteger(L, (lua_Integer) acc);
+        }
+
+        lua_replace(L, 3);
+        pos += n;
+
+        if (pos < len) {
+            lua_pushinteger(L, (lua_Integer) pos);
+            lua_replace(L, 2);
+
+            return lua_yieldk(L, 0, 0, sum_k);
+        }
+    }
+
+    return 1;
+}
+
+static int dot_k(lua_State *L, int status, lua_KContext ctx) {
+    const TypeVec *x;
+    const TypeVec *y;
+    size_t quantum;
+    size_t pos;
+    size_t len;
+
+    assert(L);
+    (void) ctx;
+
+    if (status == LUA_YIELD && slice_cancelled(L, 4)) {
+        return luaL_error(L, "operation cancelled");
+    }
+
+    x = check_num_tv(L, 1, 0);
+    y = check_num_tv(L, 2, 0);
+    luaL_argcheck(L, Vec_len(&y->vec) == Vec_len(&x->vec), 2, "Vecs must have the same length");
+
+    quantum = slice_quantum(L);
+    pos = (size_t) lua_tointeger(L, 3);
+    len = Vec_len(&x->vec);
+
+    while (pos < len) {
+        const size_t n = (quantum > 0 && len - pos > quantum) ? quantum : len - pos;
+
+        lua_pushnumber(L, lua_tonumber(L, 4)
+                          + get_kernels()->num_dot((const lua_Number*) Vec_as_ptr(&x->vec) + pos,
+                                                   (const lua_Number*) Vec_as_ptr(&y->vec) + pos,
+                                                   n));
+        lua_replace(L, 4);
+        pos += n;
+
+        if (pos < len) {
+            lua_pushinteger(L, (lua_Integer) pos);
+            lua_replace(L, 3);
+
+            return lua_yieldk(L, 0, 0, dot_k);
+        }
+    }
+
+    return 1;
+}
+
+static void pack_a_block(size_t mc, size_t kc, lua_Number alpha, const lua_Number *a,
+                         size_t lda, lua_Number *pack);
+
+static void pack_b_panel(size_t kc, size_t nc, const lua_Number *b, size_t ldb,
+                         lua_Number *pack);
+
+static void micro_kernel(size_t kc, const lua_Number *pa, const lua_Number *pb,
+                         lua_Number *c, size_t ldc, size_t mr, size_t nr);
+
+static void gemm(size_t m, size_t n, size_t k, lua_Number alpha, const lua_Number *a,
+                 const lua_Number *b, lua_Number beta, lua_Number *c,
+                 lua_Number *pack_a, lua_Number *pack_b) {
+    size_t jc;
+    size_t pc;
+    size_t ic;
+    size_t i;
+
+    assert(a);
+    assert(b);
+    assert(c);
+    assert(pack_a);
+    assert(pack_b);
+
+    /* apply beta once up front so every block below only accumulates */
+    if (beta == 0) {
+        for (i = 0; i < m * n; ++i) {
+            c[i] = 0;
+        }
+    } else if (beta != 1) {
+        for (i = 0; i < m * n; ++i) {
+            c[i] *= beta;
+        }
+    }
+
+    if (alpha == 0 || k == 0) {
+        return;
+    }
+
+    for (jc = 0; jc < n; jc += GEMM_NC) {
+        const size_t nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+        for (pc = 0; pc < k; pc += GEMM_KC) {
+            const size_t kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+
+            pack_b_panel(kc, nc, b + pc * n + jc, n, pack_b);
+
+            for (ic = 0; ic < m; ic += GEMM_MC) {
+                const size_t mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                size_t jr;
+
+                pack_a_block(mc, kc, alpha, a + ic * k + pc, k, pack_a);
+
+                for (jr = 0; jr < nc; jr += GEMM_NR) {
+                    const size_t nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+                    size_t ir;
+
+                    for (ir = 0; ir < mc; ir += GEMM_MR) {
+                        const size_t mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+
+                        micro_kernel(kc, pack_a + ir * kc, pack_b + jr * kc,
+                                     c + (ic + ir) * n + jc + jr, n, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* packs alpha * A[0:mc, 0:kc] into MR-row micro-panels, column-major within each */
+static void pack_a_block(size_t mc, size_t kc, lua_Number alpha, const lua_Number *a,
+                         size_t lda, lua_Number *pack) {
+    size_t ir;
+
+    for (ir = 0; ir < mc; ir += GEMM_MR) {
+        size_t p;
+
+        for (p = 0; p < kc; ++p) {
+            size_t r;
+
+            for (r = 0; r < GEMM_MR; ++r) {
+                *pack++ = (ir + r < mc) ? alpha * a[(ir + r) * lda + p] : 0;
+            }
+        }
+    }
+}
+
+/* packs B[0:kc, 0:nc] into NR-column micro-panels, row-major within each */
+static void pack_b_panel(size_t kc, size_t nc, const lua_Number *b, size_t ldb,
+                         lua_Number *pack) {
+    size_t jr;
+
+    for (jr = 0; jr < nc; jr += GEMM_NR) {
+        size_t p;
+
+        for (p = 0; p < kc; ++p) {
+            size_t col;
+
+            for (col = 0; col < GEMM_NR; ++col) {
+                *pack++ = (jr + col < nc) ? b[p * ldb + jr + col] : 0;
+            }
+        }
+    }
+}
+
+/* C[0:mr, 0:nr] += PA * PB for one MR x NR tile */
+static void micro_kernel(size_t kc, const lua_Number *pa, const lua_Number *pb,
+                         lua_Number *c, size_t ldc, size_t mr, size_t nr) {
+    lua_Number c00 = 0, c01 = 0, c02 = 0, c03 = 0;
+    lua_Number c10 = 0, c11 = 0, c12 = 0, c13 = 0;
+    lua_Number c20 = 0, c21 = 0, c22 = 0, c23 = 0;
+    lua_Number c30 = 0, c31 = 0, c32 = 0, c33 = 0;
+    lua_Number tile[GEMM_MR][GEMM_NR];
+    size_t p;
+    size_t i;
+    size_t j;
+
+    for (p = 0; p < kc; ++p) {
+        const lua_Number a0 = pa[0], a1 = pa[1], a2 = pa[2], a3 = pa[3];
+        const lua_Number b0 = pb[0], b1 = pb[1], b2 = pb[2], b3 = pb[3];
+
+        c00 += a0 * b0; c01 += a0 * b1; c02 += a0 * b2; c03 += a0 * b3;
+        c10 += a1 * b0; c11 += a1 * b1; c12 += a1 * b2; c13 += a1 * b3;
+        c20 += a2 * b0; c21 += a2 * b1; c22 += a2 * b2; c23 += a2 * b3;
+        c30 += a3 * b0; c31 += a3 * b1; c32 += a3 * b2; c33 += a3 * b3;
+
+        pa += GEMM_MR;
+        pb += GEMM_NR;
+    }
+
+    tile[0][0] = c00; tile[0][1] = c01; tile[0][2] = c02; tile[0][3] = c03;
+    tile[1][0] = c10; tile[1][1] = c11; tile[1][2] = c12; tile[1][3] = c13;
+    tile[2][0] = c20; tile[2][1] = c21; tile[2][2] = c22; tile[2][3] = c23;
+    tile[3][0] = c30; tile[3][1] = c31; tile[3][2] = c32; tile[3][3] = c33;
+
+    for (i = 0; i < mr; ++i) {
+        for (j = 0; j < nr; ++j) {
+            c[i * ldc + j] += tile[i][j];
+        }
+    }
+}
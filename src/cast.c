@@ -0,0 +1,342 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Converting Vecs between number, integer and boolean elements.
+ *  v:cast(type[, mode]) returns a new Vec; v:cast_inplace(type[, mode])
+ *  rewrites v's buffer when both types have the same width. Numbers
+ *  become integers according to mode:
+ *
+ *      "exact"     each number must be an integer that fits (the default)
+ *      "trunc"     rounds toward zero; out of range numbers and NaN fail
+ *      "round"     rounds half to even; out of range numbers and NaN fail
+ *      "saturate"  rounds toward zero, clamps out of range numbers to
+ *                  math.mininteger or math.maxinteger and maps NaN to 0
+ *
+ *  Integers become the nearest number. Booleans become 0 or 1, and
+ *  numbers and integers become true unless they are zero.
+ *
+ *  Elements are converted CAST_BLOCK at a time into a block on the
+ *  stack, then copied out. Each conversion is a branch-free loop that
+ *  records whether any element failed instead of stopping at it, so the
+ *  compiler can vectorize it; only a block with a failure is scanned
+ *  again for the index to report. Converting through the block also
+ *  makes converting a buffer onto itself well defined.
+ */
+
+#define CAST_BLOCK 256
+
+typedef enum CastMode {
+    CAST_EXACT,
+    CAST_TRUNC,
+    CAST_ROUND,
+    CAST_SATURATE
+} CastMode;
+
+typedef union CastBlock {
+    lua_Number num[CAST_BLOCK];
+    lua_Integer integer[CAST_BLOCK];
+    uint8_t boolean[CAST_BLOCK];
+} CastBlock;
+
+static const char *const MODES[] = { "exact", "trunc", "round", "saturate", NULL };
+
+static int can_cast(int from, int to);
+
+static int can_fail(int from, int to, int mode);
+
+static size_t cast_buffer(void *dst, int to, const void *src, int from, size_t len, int mode,
+                          int check_only);
+
+static size_t convert_block(CastBlock *block, int to, const void *src, int from, size_t count,
+                            int mode);
+
+static size_t num_to_int_block(lua_Integer *dst, const lua_Number *src, size_t count, int mode);
+
+static lua_Number round_half_even(lua_Number x);
+
+static int cast_error(lua_State *L, const TypeVec *tv, Typeinfo to, size_t index, int mode);
+
+int l_Vec_cast(lua_State *L) {
+    const TypeVec *tv;
+    Typeinfo typeinfo;
+    TypeVec *dst;
+    size_t len;
+    size_t failed;
+    int mode;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    typeinfo = check_typeinfo(L, 2);
+    mode = luaL_checkoption(L, 3, "exact", MODES);
+    lua_settop(L, 1);
+
+    if (typeinfo.type == tv->typeinfo.type) {
+        lua_pushcfunction(L, l_Vec_clone);
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 1);
+
+        return 1;
+    } else if (!can_cast(tv->typeinfo.type, typeinfo.type)) {
+        return luaL_error(L, "can't cast larr.Vec<%s> to larr.Vec<%s>",
+                          tv->typeinfo.name.str, typeinfo.name.str);
+    }
+
+    len = Vec_len(&tv->vec);
+    dst = new_tv(L, typeinfo_of(typeinfo.type), len);
+    failed = cast_buffer(Vec_as_mut_ptr(&dst->vec), typeinfo.type, Vec_as_ptr(&tv->vec),
+                         tv->typeinfo.type, len, mode, 0);
+
+    if (failed < len) {
+        return cast_error(L, tv, typeinfo, failed, mode);
+    }
+
+    dst->vec.len = len;
+
+    return 1;
+}
+
+int l_Vec_cast_inplace(lua_State *L) {
+    TypeVec *tv;
+    Typeinfo typeinfo;
+    size_t len;
+    size_t failed;
+    int mode;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+    typeinfo = check_typeinfo(L, 2);
+    mode = luaL_checkoption(L, 3, "exact", MODES);
+    lua_settop(L, 1);
+
+    if (typeinfo.type == tv->typeinfo.type) {
+        return 1;
+    } else if (!can_cast(tv->typeinfo.type, typeinfo.type)) {
+        return luaL_error(L, "can't cast larr.Vec<%s> to larr.Vec<%s>",
+                          tv->typeinfo.name.str, typeinfo.name.str);
+    }
+
+    luaL_argcheck(L, sizeof_type_repr(typeinfo.type) == tv->vec.element_size, 2,
+                  "element types differ in width; use cast");
+    luaL_argcheck(L, !tv->storage || !tv->storage->writable, 1,
+                  "can't change the element type of a Vec from larr.Vec.shared");
+
+    len = Vec_len(&tv->vec);
+
+    /* nothing is overwritten unless every element converts */
+    if (can_fail(tv->typeinfo.type, typeinfo.type, mode)) {
+        failed = cast_buffer(NULL, typeinfo.type, Vec_as_ptr(&tv->vec), tv->typeinfo.type, len,
+                             mode, 1);
+
+        if (failed < len) {
+            return cast_error(L, tv, typeinfo, failed, mode);
+        }
+    }
+
+    cast_buffer(Vec_as_mut_ptr(&tv->vec), typeinfo.type, Vec_as_ptr(&tv->vec),
+                tv->typeinfo.type, len, mode, 0);
+    tv->typeinfo = typeinfo_of(typeinfo.type);
+    tv->vtbl = get_vtbl(typeinfo.type);
+
+    return 1;
+}
+
+static int can_cast(int from, int to) {
+    const int from_ok = from == TP_NUM || from == TP_INT || from == TP_BOOL;
+    const int to_ok = to == TP_NUM || to == TP_INT || to == TP_BOOL;
+
+    return from_ok && to_ok;
+}
+
+static int can_fail(int from, int to, int mode) {
+    return from == TP_NUM && to == TP_INT && mode != CAST_SATURATE;
+}
+
+/*
+ *  Converts len elements from src to dst, which may be the same buffer,
+ *  or only checks them if check_only is nonzero.
+ *
+ *  @returns len on success, otherwise the index of the first element
+ *           that can't be converted; dst is then only partly written
+ */
+static size_t cast_buffer(void *dst, int to, const void *src, int from, size_t len, int mode,
+                          int check_only) {
+    const size_t from_size = sizeof_type_repr(from);
+    const size_t to_size = sizeof_type_repr(to);
+    CastBlock block;
+    size_t start;
+
+    assert(dst || check_only || len == 0);
+    assert(src || len == 0);
+
+    for (start = 0; start < len; start += CAST_BLOCK) {
+        const size_t count = (len - start < CAST_BLOCK) ? len - start : CAST_BLOCK;
+        const size_t failed = convert_block(&block, to, (const char*) src + start * from_size,
+                                            from, count, mode);
+
+        if (failed < count) {
+            return start + failed;
+        } else if (!check_only) {
+            memcpy((char*) dst + start * to_size, &block, count * to_size);
+        }
+    }
+
+    return len;
+}
+
+/* @returns count, or the index of the first element that failed */
+static size_t convert_block(CastBlock *block, int to, const void *src, int from, size_t count,
+                            int mode) {
+    size_t i;
+
+    assert(block);
+    assert(src);
+    assert(count <= CAST_BLOCK);
+
+    if (from == TP_NUM && to == TP_INT) {
+        return num_to_int_block(block->integer, (const lua_Number*) src, count, mode);
+    } else if (from == TP_INT && to == TP_NUM) {
+        const lua_Integer *const x = (const lua_Integer*) src;
+
+        for (i = 0; i < count; ++i) {
+            block->num[i] = (lua_Number) x[i];
+        }
+    } else if (from == TP_BOOL && to == TP_NUM) {
+        const uint8_t *const x = (const uint8_t*) src;
+
+        for (i = 0; i < count; ++i) {
+            block->num[i] = (lua_Number) (x[i] != 0);
+        }
+    } else if (from == TP_BOOL && to == TP_INT) {
+        const uint8_t *const x = (const uint8_t*) src;
+
+        for (i = 0; i < count; ++i) {
+            block->integer[i] = (lua_Integer) (x[i] != 0);
+        }
+    } else if (from == TP_NUM && to == TP_BOOL) {
+        const lua_Number *const x = (const lua_Number*) src;
+
+        for (i = 0; i < count; ++i) {
+            block->boolean[i] = (uint8_t) (x[i] != 0);
+        }
+    } else if (from == TP_INT && to == TP_BOOL) {
+        const lua_Integer *const x = (const lua_Integer*) src;
+
+        for (i = 0; i < count; ++i) {
+            block->boolean[i] = (uint8_t) (x[i] != 0);
+        }
+    } else {
+        assert(0 && "invalid argument passed");
+    }
+
+    return count;
+}
+
+/* -(lua_Number) LUA_MININTEGER is exactly 2^63, the first float too big */
+static size_t num_to_int_block(lua_Integer *dst, const lua_Number *src, size_t count, int mode) {
+    const lua_Number lo = (lua_Number) LUA_MININTEGER;
+    const lua_Number hi = -(lua_Number) LUA_MININTEGER;
+    int bad = 0;
+    size_t i;
+
+    assert(dst);
+    assert(src);
+
+    switch ((CastMode) mode) {
+        case CAST_EXACT:
+            for (i = 0; i < count; ++i) {
+                const lua_Number x = src[i];
+                const lua_Number y = (x >= lo && x < hi) ? x : 0;
+
+                dst[i] = (lua_Integer) y;
+                bad |= (lua_Number) dst[i] != x;
+            }
+
+            break;
+        case CAST_TRUNC:
+            for (i = 0; i < count; ++i) {
+                const lua_Number x = src[i];
+                const lua_Number y = (x >= lo && x < hi) ? x : 0;
+
+                dst[i] = (lua_Integer) y;
+                bad |= y != x;
+            }
+
+            break;
+        case CAST_ROUND:
+            for (i = 0; i < count; ++i) {
+                const lua_Number x = round_half_even(src[i]);
+                const lua_Number y = (x >= lo && x < hi) ? x : 0;
+
+                dst[i] = (lua_Integer) y;
+                bad |= y != x;
+            }
+
+            break;
+        case CAST_SATURATE:
+            for (i = 0; i < count; ++i) {
+                const lua_Number x = src[i];
+                const lua_Number y = (x >= lo && x < hi) ? x : 0;
+
+                dst[i] = (x >= hi) ? LUA_MAXINTEGER : (x < lo) ? LUA_MININTEGER : (lua_Integer) y;
+            }
+
+            break;
+    }
+
+    if (!bad) {
+        return count;
+    }
+
+    /* the slow path, only for the block that failed */
+    for (i = 0; i < count; ++i) {
+        const lua_Number x = (mode == CAST_ROUND) ? round_half_even(src[i]) : src[i];
+
+        if (!(x >= lo && x < hi) || (mode == CAST_EXACT && (lua_Number) dst[i] != x)) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+/* floor and a comparison, since C90 has no rint() */
+static lua_Number round_half_even(lua_Number x) {
+    const lua_Number r = floor(x);
+    const lua_Number d = x - r;
+
+    if (d > 0.5 || (d == 0.5 && floor(r * 0.5) != r * 0.5)) {
+        return r + 1;
+    }
+
+    return r;
+}
+
+static int cast_error(lua_State *L, const TypeVec *tv, Typeinfo to, size_t index, int mode) {
+    assert(L);
+    assert(tv);
+
+    return luaL_error(L, "can't cast element %I (%f) of larr.Vec<%s> to %s in '%s' mode",
+                      (lua_Integer) index + 1,
+                      ((const lua_Number*) Vec_as_ptr(&tv->vec))[index],
+                      tv->typeinfo.name.str, to.name.str, MODES[mode]);
+}
@@ -0,0 +1,424 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.Columns is a struct-of-arrays record batch. Each field is a
+ *  plain larr.Vec. A column handed out by column() or by indexing is a
+ *  copy-on-write clone, so it shares the column's buffer without
+ *  copying it, and writing to it can't leave the columns with different
+ *  lengths. The userdata's uservalue table holds "fields", the field
+ *  names in sorted order, and "columns", a map from field name to Vec.
+ */
+
+typedef struct Columns {
+    size_t num_fields;
+} Columns;
+
+static const Columns* check_columns(lua_State *L, int arg);
+
+static void push_fields(lua_State *L, int arg);
+
+static void push_columns(lua_State *L, int arg);
+
+static void push_column(lua_State *L, int arg, int name);
+
+static size_t num_rows(lua_State *L, int arg, size_t num_fields);
+
+static size_t check_row(lua_State *L, int arg, size_t rows);
+
+static int compare_names(const void *lhs, const void *rhs);
+
+int l_Columns_new(lua_State *L) {
+    Columns *columns;
+    const char **names;
+    size_t num_fields;
+    size_t i;
+
+    assert(L);
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+
+    num_fields = 0;
+
+    for (lua_pushnil(L); lua_next(L, 1); lua_pop(L, 1)) {
+        if (lua_type(L, -2) != LUA_TSTRING) {
+            return luaL_error(L, "bad schema key (expected string, got %s)",
+                              luaL_typename(L, -2));
+        }
+
+        ++num_fields;
+    }
+
+    luaL_argcheck(L, num_fields > 0, 1, "schema has no fields");
+
+    /* the schema table keeps every name alive while they are sorted */
+    names = (const char**) lua_newuserdata(L, num_fields * sizeof(const char*));
+    i = 0;
+
+    for (lua_pushnil(L); lua_next(L, 1); lua_pop(L, 1)) {
+        names[i++] = lua_tostring(L, -2);
+    }
+
+    qsort(names, num_fields, sizeof(const char*), compare_names);
+
+    lua_createtable(L, (int) num_fields, 0);
+
+    for (i = 0; i < num_fields; ++i) {
+        lua_pushstring(L, names[i]);
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+
+    lua_remove(L, 2);
+    /* schema, fields */
+
+    lua_createtable(L, 0, (int) num_fields);
+
+    for (i = 1; i <= num_fields; ++i) {
+        Typeinfo typeinfo;
+
+        lua_rawgeti(L, 2, (lua_Integer) i);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, 1);
+        /* schema, fields, columns, name, type */
+
+        typeinfo = check_typeinfo(L, -1);
+        lua_pop(L, 1);
+
+        new_tv(L, typeinfo_of(typeinfo.type), 0);
+        lua_rawset(L, 3);
+    }
+    /* schema, fields, columns */
+
+    columns = (Columns*) lua_newuserdata(L, sizeof(Columns));
+    columns->num_fields = num_fields;
+
+    luaL_setmetatable(L, "larr.Columns");
+
+    lua_createtable(L, 0, 2);
+    lua_pushvalue(L, 2);
+    lua_setfield(L, -2, "fields");
+    lua_pushvalue(L, 3);
+    lua_setfield(L, -2, "columns");
+    lua_setuservalue(L, -2);
+
+    return 1;
+}
+
+int l_Columns_meta_len(lua_State *L) {
+    const Columns *columns;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+    push_size_t(L, num_rows(L, 1, columns->num_fields));
+
+    return 1;
+}
+
+int l_Columns_meta_index(lua_State *L) {
+    assert(L);
+
+    check_columns(L, 1);
+
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_settop(L, 2);
+
+        return l_Columns_row(L);
+    } else if (lua_type(L, 2) != LUA_TSTRING) {
+        lua_pushnil(L);
+
+        return 1;
+    } else if (luaL_getmetafield(L, 1, lua_tostring(L, 2)) != LUA_TNIL) {
+        return 1;
+    }
+
+    push_columns(L, 1);
+    lua_pushvalue(L, 2);
+
+    if (lua_rawget(L, -2) == LUA_TNIL) {
+        return 1;
+    }
+
+    lua_pushcfunction(L, l_Vec_clone);
+    lua_insert(L, -2);
+    lua_call(L, 1, 1);
+
+    return 1;
+}
+
+int l_Columns_fields(lua_State *L) {
+    const Columns *columns;
+    size_t i;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+    push_fields(L, 1);
+
+    lua_createtable(L, (int) columns->num_fields, 0);
+
+    for (i = 1; i <= columns->num_fields; ++i) {
+        lua_rawgeti(L, -2, (lua_Integer) i);
+        lua_rawseti(L, -2, (lua_Integer) i);
+    }
+
+    return 1;
+}
+
+int l_Columns_column(lua_State *L) {
+    assert(L);
+
+    check_columns(L, 1);
+    luaL_checkstring(L, 2);
+
+    lua_pushcfunction(L, l_Vec_clone);
+    push_column(L, 1, 2);
+    lua_call(L, 1, 1);
+
+    return 1;
+}
+
+int l_Columns_push(lua_State *L) {
+    const Columns *columns;
+    size_t rows;
+    size_t i;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+
+    if (lua_istable(L, 2)) {
+        /* fetch every value first, since __index may read or push to the columns */
+        lua_settop(L, 2);
+        luaL_checkstack(L, (int) columns->num_fields + 1, "too many fields");
+        push_fields(L, 1);
+
+        for (i = 1; i <= columns->num_fields; ++i) {
+            lua_rawgeti(L, 3, (lua_Integer) i);
+            lua_gettable(L, 2);
+        }
+
+        lua_remove(L, 3);
+        lua_remove(L, 2);
+    } else if ((size_t) lua_gettop(L) - 1 != columns->num_fields) {
+        return luaL_error(L, "expected a table or %I values, got %I", (lua_Integer) columns->num_fields,
+                          (lua_Integer) (lua_gettop(L) - 1));
+    }
+
+    rows = num_rows(L, 1, columns->num_fields);
+
+    push_fields(L, 1);
+    push_columns(L, 1);
+    /* Columns, value..., fields, columns */
+
+    for (i = 1; i <= columns->num_fields; ++i) {
+        TypeVec *tv;
+        int res;
+
+        lua_rawgeti(L, -2, (lua_Integer) i);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -3);
+        tv = check_tv_mut(L, -1);
+        lua_pushvalue(L, (int) i + 1);
+        /* Columns, value..., fields, columns, name, Vec, value */
+
+        res = tv->vtbl->try_push(tv, L);
+
+        if (res != PE_OK) {
+            const char *const name = lua_tostring(L, -3);
+            const char *const got = luaL_typename(L, -1);
+            size_t j;
+
+            for (j = 1; j < i; ++j) {
+                lua_rawgeti(L, -5, (lua_Integer) j);
+                lua_rawget(L, -5);
+                Vec_truncate(&check_tv_mut(L, -1)->vec, rows);
+                lua_pop(L, 1);
+            }
+
+            if (res == PE_NO_MEMORY) {
+                return luaL_error(L, "out of memory");
+            }
+
+            return luaL_error(L, "bad value for field '%s' (expected %s, got %s)", name,
+                              tv->typeinfo.name.str, got);
+        }
+
+        lua_pop(L, 3);
+    }
+
+    return 0;
+}
+
+int l_Columns_row(lua_State *L) {
+    const Columns *columns;
+    size_t row;
+    size_t i;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+    row = check_row(L, 2, num_rows(L, 1, columns->num_fields));
+
+    push_fields(L, 1);
+    push_columns(L, 1);
+    lua_createtable(L, 0, (int) columns->num_fields);
+    /* Columns, index, fields, columns, row */
+
+    for (i = 1; i <= columns->num_fields; ++i) {
+        const TypeVec *tv;
+
+        lua_rawgeti(L, -3, (lua_Integer) i);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -4);
+        tv = check_tv(L, -1);
+        lua_pop(L, 1);
+        /* Columns, index, fields, columns, row, name */
+
+        tv->vtbl->push_elem(tv, row, L);
+        lua_rawset(L, -3);
+    }
+
+    return 1;
+}
+
+int l_Columns_get(lua_State *L) {
+    const Columns *columns;
+    const TypeVec *tv;
+    size_t row;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+    row = check_row(L, 2, num_rows(L, 1, columns->num_fields));
+    luaL_checkstring(L, 3);
+    lua_settop(L, 3);
+
+    push_column(L, 1, 3);
+    tv = check_tv(L, -1);
+
+    tv->vtbl->push_elem(tv, row, L);
+
+    return 1;
+}
+
+int l_Columns_set(lua_State *L) {
+    const Columns *columns;
+    TypeVec *tv;
+    size_t row;
+
+    assert(L);
+
+    columns = check_columns(L, 1);
+    row = check_row(L, 2, num_rows(L, 1, columns->num_fields));
+    luaL_checkstring(L, 3);
+    luaL_checkany(L, 4);
+    lua_settop(L, 4);
+
+    push_column(L, 1, 3);
+    tv = check_tv_mut(L, -1);
+
+    lua_pushvalue(L, 4);
+    tv->vtbl->set_elem(tv, row, L);
+
+    return 0;
+}
+
+static int compare_names(const void *lhs, const void *rhs) {
+    return strcmp(*(const char *const*) lhs, *(const char *const*) rhs);
+}
+
+static const Columns* check_columns(lua_State *L, int arg) {
+    assert(L);
+
+    return (const Columns*) luaL_checkudata(L, arg, "larr.Columns");
+}
+
+static void push_fields(lua_State *L, int arg) {
+    assert(L);
+
+    lua_getuservalue(L, arg);
+    lua_getfield(L, -1, "fields");
+    lua_remove(L, -2);
+}
+
+static void push_columns(lua_State *L, int arg) {
+    assert(L);
+
+    lua_getuservalue(L, arg);
+    lua_getfield(L, -1, "columns");
+    lua_remove(L, -2);
+}
+
+/* pushes the column itself, not a clone; raises if there is no such field */
+static void push_column(lua_State *L, int arg, int name) {
+    assert(L);
+
+    name = lua_absindex(L, name);
+    push_columns(L, arg);
+    lua_pushvalue(L, name);
+
+    if (lua_rawget(L, -2) == LUA_TNIL) {
+        luaL_error(L, "no such field '%s'", lua_tostring(L, name));
+    }
+
+    lua_remove(L, -2);
+}
+
+/* the row count is the length of the shortest column */
+static size_t num_rows(lua_State *L, int arg, size_t num_fields) {
+    size_t rows = 0;
+    size_t i;
+
+    assert(L);
+
+    arg = lua_absindex(L, arg);
+    push_fields(L, arg);
+    push_columns(L, arg);
+
+    for (i = 1; i <= num_fields; ++i) {
+        size_t len;
+
+        lua_rawgeti(L, -2, (lua_Integer) i);
+        lua_rawget(L, -2);
+        len = Vec_len(&check_tv(L, -1)->vec);
+        lua_pop(L, 1);
+
+        if (i == 1 || len < rows) {
+            rows = len;
+        }
+    }
+
+    lua_pop(L, 2);
+
+    return rows;
+}
+
+/* @returns The zero-based row index named by the one-based index at arg. */
+static size_t check_row(lua_State *L, int arg, size_t rows) {
+    size_t index;
+
+    assert(L);
+
+    index = check_size_t(L, arg);
+    luaL_argcheck(L, index >= 1 && index <= rows, arg, "row index out of range");
+
+    return index - 1;
+}
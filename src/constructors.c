@@ -0,0 +1,314 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Constructors that build number and integer Vecs in C instead of one
+ *  push at a time. Every element is written by a plain loop over the
+ *  buffer, and all-zero buffers come straight from calloc().
+ */
+
+/* the longest token from_string will convert */
+#define MAX_TOKEN_LEN 63
+
+static Typeinfo check_numeric_type(lua_State *L, int arg);
+
+static TypeVec* push_zeros(lua_State *L, Typeinfo typeinfo, size_t len);
+
+static void check_fill(lua_State *L, int arg, int type);
+
+static int is_separator(char c);
+
+int l_Vec_zeros(lua_State *L) {
+    Typeinfo typeinfo;
+    size_t len;
+
+    assert(L);
+
+    typeinfo = check_numeric_type(L, 1);
+    len = check_size_t(L, 2);
+
+    push_zeros(L, typeinfo, len);
+
+    return 1;
+}
+
+int l_Vec_filled(lua_State *L) {
+    Typeinfo typeinfo;
+    TypeVec *tv;
+    size_t len;
+
+    assert(L);
+
+    typeinfo = check_numeric_type(L, 1);
+    len = check_size_t(L, 2);
+    check_fill(L, 3, typeinfo.type);
+    lua_settop(L, 3);
+
+    tv = push_zeros(L, typeinfo, len);
+    tv->vtbl->fill(tv, 0, len, 3, L);
+
+    return 1;
+}
+
+int l_Vec_range(lua_State *L) {
+    Typeinfo typeinfo;
+    TypeVec *tv;
+    size_t len;
+    size_t i;
+
+    assert(L);
+
+    typeinfo = check_numeric_type(L, 1);
+    lua_settop(L, 4);
+
+    /* like a numeric for loop, stop is inclusive */
+    if (typeinfo.type == TP_INT) {
+        const lua_Integer start = luaL_checkinteger(L, 2);
+        const lua_Integer stop = luaL_checkinteger(L, 3);
+        const lua_Integer step = luaL_optinteger(L, 4, 1);
+        lua_Integer *data;
+        lua_Unsigned steps;
+
+        luaL_argcheck(L, step != 0, 4, "step must be nonzero");
+
+        if ((step > 0) ? start > stop : start < stop) {
+            len = 0;
+        } else {
+            steps = (step > 0)
+                ? ((lua_Unsigned) stop - (lua_Unsigned) start) / (lua_Unsigned) step
+                : ((lua_Unsigned) start - (lua_Unsigned) stop)
+                    / ((lua_Unsigned) 0 - (lua_Unsigned) step);
+            luaL_argcheck(L, steps < (lua_Unsigned) ((size_t) -1 / sizeof(lua_Integer)), 3,
+                          "range is too long");
+            len = (size_t) steps + 1;
+        }
+
+        tv = new_tv(L, typeinfo, len);
+        data = (lua_Integer*) Vec_as_mut_ptr(&tv->vec);
+
+        for (i = 0; i < len; ++i) {
+            data[i] = (lua_Integer) ((lua_Unsigned) start + (lua_Unsigned) i * (lua_Unsigned) step);
+        }
+    } else {
+        const lua_Number start = luaL_checknumber(L, 2);
+        const lua_Number stop = luaL_checknumber(L, 3);
+        const lua_Number step = luaL_optnumber(L, 4, 1);
+        lua_Number *data;
+        lua_Number count;
+
+        luaL_argcheck(L, step != 0, 4, "step must be nonzero");
+
+        count = floor((stop - start) / step) + 1;
+        luaL_argcheck(L, count == count
+                         && count < (lua_Number) ((size_t) -1 / sizeof(lua_Number)), 3,
+                      "range is too long");
+        len = (count > 0) ? (size_t) count : 0;
+
+        tv = new_tv(L, typeinfo, len);
+        data = (lua_Number*) Vec_as_mut_ptr(&tv->vec);
+
+        /* multiply instead of accumulate so rounding errors don't build up */
+        for (i = 0; i < len; ++i) {
+            data[i] = start + (lua_Number) i * step;
+        }
+    }
+
+    tv->vec.len = len;
+
+    return 1;
+}
+
+int l_Vec_linspace(lua_State *L) {
+    TypeVec *tv;
+    lua_Number *data;
+    lua_Number start;
+    lua_Number stop;
+    lua_Number step;
+    size_t len;
+    size_t i;
+
+    assert(L);
+
+    start = luaL_checknumber(L, 1);
+    stop = luaL_checknumber(L, 2);
+    len = check_size_t(L, 3);
+    lua_settop(L, 3);
+
+    tv = new_tv(L, typeinfo_of(TP_NUM), len);
+    tv->vec.len = len;
+    data = (lua_Number*) Vec_as_mut_ptr(&tv->vec);
+    step = (len > 1) ? (stop - start) / (lua_Number) (len - 1) : 0;
+
+    for (i = 0; i < len; ++i) {
+        data[i] = start + (lua_Number) i * step;
+    }
+
+    if (len > 1) {
+        data[len - 1] = stop;
+    }
+
+    return 1;
+}
+
+int l_Vec_from_string(lua_State *L) {
+    Typeinfo typeinfo;
+    TypeVec *tv;
+    const char *str;
+    size_t str_len;
+    size_t pos;
+
+    assert(L);
+
+    typeinfo = check_numeric_type(L, 1);
+    str = luaL_checklstring(L, 2, &str_len);
+    lua_settop(L, 2);
+
+    tv = new_tv(L, typeinfo, 0);
+    pos = 0;
+
+    /* tokens are separated by any run of whitespace and commas */
+    while (pos < str_len) {
+        char token[MAX_TOKEN_LEN + 1];
+        size_t start;
+        int ok;
+
+        while (pos < str_len && is_separator(str[pos])) {
+            ++pos;
+        }
+
+        start = pos;
+
+        while (pos < str_len && !is_separator(str[pos])) {
+            ++pos;
+        }
+
+        if (pos == start) {
+            break;
+        } else if (pos - start > MAX_TOKEN_LEN) {
+            return luaL_error(L, "token at byte %I is too long", (lua_Integer) start + 1);
+        }
+
+        memcpy(token, str + start, pos - start);
+        token[pos - start] = '\0';
+
+        if (lua_stringtonumber(L, token) == 0) {
+            return luaL_error(L, "bad token '%s' at byte %I", token, (lua_Integer) start + 1);
+        }
+
+        if (typeinfo.type == TP_INT && !lua_isinteger(L, -1)) {
+            return luaL_error(L, "bad token '%s' at byte %I (expected integer)", token,
+                              (lua_Integer) start + 1);
+        } else if (typeinfo.type == TP_INT) {
+            const lua_Integer value = lua_tointeger(L, -1);
+
+            ok = (Vec_push(&tv->vec, &value) == LARR_OK);
+        } else {
+            const lua_Number value = lua_tonumber(L, -1);
+
+            ok = (Vec_push(&tv->vec, &value) == LARR_OK);
+        }
+
+        lua_pop(L, 1);
+
+        if (!ok) {
+            return luaL_error(L, "out of memory");
+        }
+    }
+
+    return 1;
+}
+
+int l_Vec_resize(lua_State *L) {
+    TypeVec *tv;
+    size_t len;
+    size_t old_len;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, 1,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+    len = check_size_t(L, 2);
+    old_len = Vec_len(&tv->vec);
+
+    if (!lua_isnoneornil(L, 3)) {
+        check_fill(L, 3, tv->typeinfo.type);
+    }
+
+    if (len <= old_len) {
+        Vec_truncate(&tv->vec, len);
+
+        return 0;
+    } else if (Vec_reserve(&tv->vec, len - old_len) != LARR_OK) {
+        return luaL_error(L, "out of memory");
+    }
+
+    tv->vec.len = len;
+
+    if (lua_isnoneornil(L, 3)) {
+        memset((char*) Vec_as_mut_ptr(&tv->vec) + old_len * tv->vec.element_size, 0,
+               (len - old_len) * tv->vec.element_size);
+    } else {
+        tv->vtbl->fill(tv, old_len, len, 3, L);
+    }
+
+    return 0;
+}
+
+static Typeinfo check_numeric_type(lua_State *L, int arg) {
+    Typeinfo typeinfo;
+
+    assert(L);
+
+    typeinfo = check_typeinfo(L, arg);
+    luaL_argcheck(L, typeinfo.type == TP_NUM || typeinfo.type == TP_INT, arg,
+                  "expected 'number' or 'integer'");
+
+    /* the argument string may be collected while the Vec lives on */
+    return typeinfo_of(typeinfo.type);
+}
+
+static TypeVec* push_zeros(lua_State *L, Typeinfo typeinfo, size_t len) {
+    TypeVec *tv;
+
+    assert(L);
+
+    tv = new_tv(L, typeinfo, 0);
+
+    if (Vec_zeroed(&tv->vec, tv->vec.element_size, len) != LARR_OK) {
+        luaL_error(L, "couldn't allocate space for %I elements", (lua_Integer) len);
+    }
+
+    return tv;
+}
+
+/* a fill value must be representable in the Vec's element type */
+static void check_fill(lua_State *L, int arg, int type) {
+    assert(L);
+
+    if (type == TP_INT) {
+        luaL_checkinteger(L, arg);
+    } else {
+        luaL_checknumber(L, arg);
+    }
+}
+
+static int is_separator(char c) {
+    return c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
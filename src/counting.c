@@ -0,0 +1,382 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Distribution kernels. Integer inputs whose values span a small range
+ *  are counted in a single pass into a dense table; everything else
+ *  goes through a sorted copy. Counts are always returned as
+ *  Vec<integer>.
+ */
+
+/* a dense counting table is used if the value range is at most this */
+#define DENSE_RANGE_MAX ((size_t) 1 << 24)
+
+static const TypeVec* check_numeric(lua_State *L, int arg);
+
+static int count_sorted(lua_State *L, const TypeVec *tv, int want_counts);
+
+static int count_dense(lua_State *L, const lua_Integer *data, size_t len, lua_Integer min,
+                       size_t range, int want_counts);
+
+int l_Vec_bincount(lua_State *L) {
+    const TypeVec *tv;
+    const lua_Integer *data;
+    TypeVec *out;
+    lua_Integer *counts;
+    lua_Integer max;
+    size_t len;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_argcheck(L, tv->typeinfo.type == TP_INT, 1, "expected larr.Vec<integer>");
+
+    data = (const lua_Integer*) Vec_as_ptr(&tv->vec);
+    len = Vec_len(&tv->vec);
+
+    if (lua_isnoneornil(L, 2)) {
+        max = -1;
+
+        for (i = 0; i < len; ++i) {
+            max = (data[i] > max) ? data[i] : max;
+        }
+    } else {
+        max = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, max >= 0, 2, "must be non-negative");
+    }
+
+    if (max >= (lua_Integer) DENSE_RANGE_MAX * 64) {
+        return luaL_error(L, "bincount range of %I is too large", max + 1);
+    }
+
+    lua_settop(L, 2);
+    out = new_tv(L, typeinfo_of(TP_INT), (size_t) (max + 1));
+    out->vec.len = (size_t) (max + 1);
+    counts = (lua_Integer*) Vec_as_mut_ptr(&out->vec);
+
+    if (max >= 0) {
+        memset(counts, 0, (size_t) (max + 1) * sizeof(lua_Integer));
+    }
+
+    for (i = 0; i < len; ++i) {
+        if (data[i] < 0 || data[i] > max) {
+            return luaL_error(L, "value %I at index %I is out of range [0, %I]", data[i],
+                              (lua_Integer) i + 1, max);
+        }
+
+        ++counts[data[i]];
+    }
+
+    return 1;
+}
+
+static size_t find_bin(const lua_Number *edges, size_t num_bins, lua_Number x, int uniform,
+                       lua_Number inv_width);
+
+int l_Vec_histogram(lua_State *L) {
+    const TypeVec *tv;
+    const TypeVec *edges_tv;
+    const lua_Number *edges;
+    TypeVec *out;
+    lua_Integer *counts;
+    size_t num_bins;
+    size_t len;
+    size_t i;
+    lua_Number lo;
+    lua_Number hi;
+    lua_Number inv_width;
+    int uniform;
+
+    assert(L);
+
+    tv = check_numeric(L, 1);
+    edges_tv = check_tv(L, 2);
+    luaL_argcheck(L, edges_tv->typeinfo.type == TP_NUM, 2, "expected larr.Vec<number>");
+    luaL_argcheck(L, Vec_len(&edges_tv->vec) >= 2, 2, "need at least two edges");
+
+    edges = (const lua_Number*) Vec_as_ptr(&edges_tv->vec);
+    num_bins = Vec_len(&edges_tv->vec) - 1;
+    lo = edges[0];
+    hi = edges[num_bins];
+    inv_width = (lua_Number) num_bins / (hi - lo);
+    uniform = 1;
+
+    for (i = 0; i < num_bins; ++i) {
+        luaL_argcheck(L, edges[i] < edges[i + 1], 2, "edges must be strictly increasing");
+    }
+
+    /* near-uniform edges are found by arithmetic plus a small correction */
+    for (i = 0; i <= num_bins; ++i) {
+        const lua_Number expected = lo + (lua_Number) i / inv_width;
+        const lua_Number error = edges[i] - expected;
+
+        if (error > 1e-9 * (hi - lo) || error < -1e-9 * (hi - lo)) {
+            uniform = 0;
+
+            break;
+        }
+    }
+
+    lua_settop(L, 2);
+    out = new_tv(L, typeinfo_of(TP_INT), num_bins);
+    out->vec.len = num_bins;
+    counts = (lua_Integer*) Vec_as_mut_ptr(&out->vec);
+    memset(counts, 0, num_bins * sizeof(lua_Integer));
+
+    len = Vec_len(&tv->vec);
+
+    /* like numpy, bins are half-open except the last, and outliers are dropped */
+    if (tv->typeinfo.type == TP_NUM) {
+        const lua_Number *const data = (const lua_Number*) Vec_as_ptr(&tv->vec);
+
+        for (i = 0; i < len; ++i) {
+            if (data[i] >= lo && data[i] <= hi) {
+                ++counts[find_bin(edges, num_bins, data[i], uniform, inv_width)];
+            }
+        }
+    } else {
+        const lua_Integer *const data = (const lua_Integer*) Vec_as_ptr(&tv->vec);
+
+        for (i = 0; i < len; ++i) {
+            const lua_Number x = (lua_Number) data[i];
+
+            if (x >= lo && x <= hi) {
+                ++counts[find_bin(edges, num_bins, x, uniform, inv_width)];
+            }
+        }
+    }
+
+    return 1;
+}
+
+int l_Vec_unique(lua_State *L) {
+    assert(L);
+
+    lua_settop(L, 1);
+
+    return count_sorted(L, check_numeric(L, 1), 0);
+}
+
+int l_Vec_value_counts(lua_State *L) {
+    assert(L);
+
+    lua_settop(L, 1);
+
+    return count_sorted(L, check_numeric(L, 1), 1);
+}
+
+static const TypeVec* check_numeric(lua_State *L, int arg) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, arg,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+
+    return tv;
+}
+
+static size_t find_bin(const lua_Number *edges, size_t num_bins, lua_Number x, int uniform,
+                       lua_Number inv_width) {
+    size_t bin;
+
+    assert(edges);
+
+    if (uniform) {
+        const lua_Number guess = (x - edges[0]) * inv_width;
+
+        bin = (guess <= 0) ? 0 : (guess >= (lua_Number) num_bins) ? num_bins - 1 : (size_t) guess;
+
+        while (bin > 0 && x < edges[bin]) {
+            --bin;
+        }
+
+        while (bin + 1 < num_bins && x >= edges[bin + 1]) {
+            ++bin;
+        }
+    } else {
+        size_t lo = 0;
+        size_t hi = num_bins;
+
+        /* the last bin whose left edge is <= x */
+        while (hi - lo > 1) {
+            const size_t mid = lo + (hi - lo) / 2;
+
+            if (x >= edges[mid]) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        bin = lo;
+    }
+
+    return bin;
+}
+
+static int compare_numbers(const void *lhs, const void *rhs);
+
+static int compare_integers(const void *lhs, const void *rhs);
+
+/*
+ *  Pushes the distinct values of tv in ascending order and, if
+ *  want_counts, how often each occurs. NaNs sort last and are counted
+ *  together.
+ */
+static int count_sorted(lua_State *L, const TypeVec *tv, int want_counts) {
+    const size_t len = Vec_len(&tv->vec);
+    const size_t element_size = tv->vec.element_size;
+    TypeVec *values;
+    TypeVec *counts;
+    char *sorted;
+    size_t i;
+
+    assert(L);
+    assert(tv);
+
+    if (tv->typeinfo.type == TP_INT && len > 0) {
+        const lua_Integer *const data = (const lua_Integer*) Vec_as_ptr(&tv->vec);
+        lua_Integer min = data[0];
+        lua_Integer max = data[0];
+        lua_Unsigned range;
+
+        for (i = 1; i < len; ++i) {
+            min = (data[i] < min) ? data[i] : min;
+            max = (data[i] > max) ? data[i] : max;
+        }
+
+        range = (lua_Unsigned) max - (lua_Unsigned) min;
+
+        if (range < DENSE_RANGE_MAX && range <= 4 * (lua_Unsigned) len) {
+            return count_dense(L, data, len, min, (size_t) range + 1, want_counts);
+        }
+    }
+
+    values = new_tv(L, tv->typeinfo, len);
+    counts = want_counts ? new_tv(L, typeinfo_of(TP_INT), len) : NULL;
+
+    if (len == 0) {
+        return want_counts ? 2 : 1;
+    }
+
+    /* sort in values' buffer, then compact it in place */
+    sorted = (char*) Vec_as_mut_ptr(&values->vec);
+    memcpy(sorted, Vec_as_ptr(&tv->vec), len * element_size);
+    qsort(sorted, len, element_size,
+          (tv->typeinfo.type == TP_NUM) ? compare_numbers : compare_integers);
+
+    values->vec.len = 1;
+
+    if (counts) {
+        lua_Integer one = 1;
+
+        Vec_push(&counts->vec, &one);
+    }
+
+    for (i = 1; i < len; ++i) {
+        char *const last = sorted + (values->vec.len - 1) * element_size;
+        const char *const elem = sorted + i * element_size;
+        const int same = (tv->typeinfo.type == TP_NUM)
+            ? compare_numbers(last, elem) == 0 : compare_integers(last, elem) == 0;
+
+        if (same) {
+            if (counts) {
+                ++*(lua_Integer*) Vec_last_mut(&counts->vec);
+            }
+        } else {
+            memmove(last + element_size, elem, element_size);
+            ++values->vec.len;
+
+            if (counts) {
+                lua_Integer one = 1;
+
+                Vec_push(&counts->vec, &one);
+            }
+        }
+    }
+
+    return want_counts ? 2 : 1;
+}
+
+static int count_dense(lua_State *L, const lua_Integer *data, size_t len, lua_Integer min,
+                       size_t range, int want_counts) {
+    lua_Integer *table;
+    TypeVec *values;
+    TypeVec *counts;
+    size_t distinct;
+    size_t i;
+
+    assert(L);
+    assert(data);
+
+    /* the tally lives in a Vec so that it is collected if anything raises */
+    table = (lua_Integer*) Vec_as_mut_ptr(&new_tv(L, typeinfo_of(TP_INT), range)->vec);
+    memset(table, 0, range * sizeof(lua_Integer));
+
+    for (i = 0; i < len; ++i) {
+        ++table[(lua_Unsigned) data[i] - (lua_Unsigned) min];
+    }
+
+    distinct = 0;
+
+    for (i = 0; i < range; ++i) {
+        distinct += table[i] > 0;
+    }
+
+    values = new_tv(L, typeinfo_of(TP_INT), distinct);
+    counts = want_counts ? new_tv(L, typeinfo_of(TP_INT), distinct) : NULL;
+
+    /* both have room for every distinct value, so these pushes can't fail */
+    for (i = 0; i < range; ++i) {
+        if (table[i] > 0) {
+            const lua_Integer value = (lua_Integer) ((lua_Unsigned) min + i);
+
+            Vec_push(&values->vec, &value);
+
+            if (counts) {
+                Vec_push(&counts->vec, &table[i]);
+            }
+        }
+    }
+
+    return want_counts ? 2 : 1;
+}
+
+static int compare_numbers(const void *lhs, const void *rhs) {
+    const lua_Number l = *(const lua_Number*) lhs;
+    const lua_Number r = *(const lua_Number*) rhs;
+    const int l_nan = (l != l);
+    const int r_nan = (r != r);
+
+    if (l_nan || r_nan) {
+        return l_nan - r_nan;
+    }
+
+    return (l < r) ? -1 : (l > r) ? 1 : 0;
+}
+
+static int compare_integers(const void *lhs, const void *rhs) {
+    const lua_Integer l = *(const lua_Integer*) lhs;
+    const lua_Integer r = *(const lua_Integer*) rhs;
+
+    return (l < r) ? -1 : (l > r) ? 1 : 0;
+}
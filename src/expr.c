@@ -0,0 +1,425 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.Expr is a node of a small operator tree. Operands are kept
+ *  alive through the userdata's uservalue table: leaves hold a Vec at
+ *  [1], binary nodes hold their children at [1] and [2] and unary nodes
+ *  at [1]. Nothing is computed until eval, which flattens the tree into
+ *  a postfix program and runs it over EXPR_BLOCK elements at a time so
+ *  that every intermediate stays in a small, cache-resident tile.
+ */
+
+#define EXPR_BLOCK 256
+#define EXPR_MAX_DEPTH 8
+#define EXPR_MAX_PROGRAM 64
+
+typedef enum ExprOp {
+    EXPR_VEC,
+    EXPR_CONST,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_UNM
+} ExprOp;
+
+typedef struct Expr {
+    int op; /* one of ExprOp */
+    lua_Number constant;
+} Expr;
+
+typedef struct Instr {
+    int op; /* one of ExprOp */
+    lua_Number constant;
+    const TypeVec *tv;
+} Instr;
+
+typedef struct Program {
+    Instr instrs[EXPR_MAX_PROGRAM];
+    size_t len;
+    size_t num_nodes;
+    size_t num_elems;
+    int has_vec;
+} Program;
+
+static Expr* push_expr(lua_State *L, int op, int num_children);
+
+static void push_as_expr(lua_State *L, int arg);
+
+static int make_binary(lua_State *L, int op);
+
+int l_Expr_new(lua_State *L) {
+    assert(L);
+
+    luaL_checkany(L, 1);
+    push_as_expr(L, 1);
+
+    return 1;
+}
+
+int l_Expr_meta_add(lua_State *L) {
+    return make_binary(L, EXPR_ADD);
+}
+
+int l_Expr_meta_sub(lua_State *L) {
+    return make_binary(L, EXPR_SUB);
+}
+
+int l_Expr_meta_mul(lua_State *L) {
+    return make_binary(L, EXPR_MUL);
+}
+
+int l_Expr_meta_div(lua_State *L) {
+    return make_binary(L, EXPR_DIV);
+}
+
+int l_Expr_meta_unm(lua_State *L) {
+    assert(L);
+
+    push_as_expr(L, 1);
+    push_expr(L, EXPR_UNM, 1);
+
+    return 1;
+}
+
+static int compile(lua_State *L, int arg, Program *program, int depth);
+
+static void run_block(const Program *program, size_t offset, size_t count,
+                      lua_Number *dst);
+
+int l_Expr_eval(lua_State *L) {
+    Program program;
+    TypeVec *out;
+    lua_Number *dst;
+    size_t offset;
+
+    assert(L);
+
+    luaL_checkudata(L, 1, "larr.Expr");
+
+    program.len = 0;
+    program.num_nodes = 0;
+    program.num_elems = 0;
+    program.has_vec = 0;
+
+    compile(L, 1, &program, 0);
+
+    if (!program.has_vec) {
+        return luaL_error(L, "expression has no larr.Vec operands");
+    }
+
+    if (lua_isnoneornil(L, 2)) {
+        lua_settop(L, 1);
+        out = new_tv(L, typeinfo_of(TP_NUM), program.num_elems);
+    } else {
+        lua_settop(L, 2);
+        out = check_tv_mut(L, 2);
+        luaL_argcheck(L, out->typeinfo.type == TP_NUM, 2, "expected larr.Vec<number>");
+
+        Vec_clear(&out->vec);
+
+        if (Vec_reserve(&out->vec, program.num_elems) != LARR_OK) {
+            return luaL_error(L, "out of memory");
+        }
+    }
+
+    /* out may alias an operand; every block is read before it is written */
+    out->vec.len = program.num_elems;
+    dst = (lua_Number*) Vec_as_mut_ptr(&out->vec);
+
+    for (offset = 0; offset < program.num_elems; offset += EXPR_BLOCK) {
+        const size_t remaining = program.num_elems - offset;
+        const size_t count = (remaining < EXPR_BLOCK) ? remaining : EXPR_BLOCK;
+
+        run_block(&program, offset, count, dst + offset);
+    }
+
+    return 1;
+}
+
+static Expr* push_expr(lua_State *L, int op, int num_children) {
+    Expr *expr;
+    int i;
+
+    assert(L);
+    assert(num_children >= 0 && num_children <= 2);
+
+    /* children are the top num_children values */
+    expr = (Expr*) lua_newuserdata(L, sizeof(Expr));
+    expr->op = op;
+    expr->constant = 0;
+
+    luaL_setmetatable(L, "larr.Expr");
+
+    lua_createtable(L, num_children, 0);
+
+    for (i = 0; i < num_children; ++i) {
+        lua_pushvalue(L, -2 - num_children + i);
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    lua_setuservalue(L, -2);
+
+    lua_rotate(L, -1 - num_children, 1);
+    lua_pop(L, num_children);
+
+    return expr;
+}
+
+static void push_as_expr(lua_State *L, int arg) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    arg = lua_absindex(L, arg);
+
+    if (luaL_testudata(L, arg, "larr.Expr")) {
+        lua_pushvalue(L, arg);
+    } else if ((tv = (const TypeVec*) luaL_testudata(L, arg, "larr.Vec")) != NULL) {
+        if (tv->typeinfo.type != TP_NUM && tv->typeinfo.type != TP_INT) {
+            luaL_error(L, "larr.Vec<%s> cannot be used in an expression", tv->typeinfo.name.str);
+        }
+
+        lua_pushvalue(L, arg);
+        push_expr(L, EXPR_VEC, 1);
+    } else if (lua_type(L, arg) == LUA_TNUMBER) {
+        const lua_Number constant = lua_tonumber(L, arg);
+
+        push_expr(L, EXPR_CONST, 0)->constant = constant;
+    } else {
+        luaL_error(L, "bad expression operand (expected larr.Expr, larr.Vec or number, got %s)",
+                   luaL_typename(L, arg));
+    }
+}
+
+static int make_binary(lua_State *L, int op) {
+    assert(L);
+
+    push_as_expr(L, 1);
+    push_as_expr(L, 2);
+    push_expr(L, op, 2);
+
+    return 1;
+}
+
+static void emit(lua_State *L, Program *program, int op, lua_Number constant,
+                 const TypeVec *tv);
+
+/* appends the postfix form of the expression at arg; returns its stack depth */
+static int compile(lua_State *L, int arg, Program *program, int depth) {
+    const Expr *expr;
+    int needed = depth + 1;
+
+    assert(L);
+    assert(program);
+
+    if (depth >= EXPR_MAX_DEPTH) {
+        return luaL_error(L, "expression is nested too deeply");
+    } else if (++program->num_nodes > EXPR_MAX_PROGRAM) {
+        return luaL_error(L, "expression has too many terms");
+    }
+
+    luaL_checkstack(L, 2, "expression is nested too deeply");
+
+    arg = lua_absindex(L, arg);
+    expr = (const Expr*) lua_touserdata(L, arg);
+    lua_getuservalue(L, arg);
+
+    switch (expr->op) {
+    case EXPR_VEC: {
+        const TypeVec *tv;
+        size_t len;
+
+        lua_rawgeti(L, -1, 1);
+        tv = check_tv(L, -1);
+        len = Vec_len(&tv->vec);
+        lua_pop(L, 1);
+
+        if (program->has_vec && len != program->num_elems) {
+            return luaL_error(L, "expression operands have mismatched lengths (%I and %I)",
+                              (lua_Integer) program->num_elems, (lua_Integer) len);
+        }
+
+        program->has_vec = 1;
+        program->num_elems = len;
+
+        /* the uservalue table keeps tv alive for as long as arg is */
+        emit(L, program, EXPR_VEC, 0, tv);
+
+        break;
+    }
+    case EXPR_CONST:
+        emit(L, program, EXPR_CONST, expr->constant, NULL);
+
+        break;
+    case EXPR_UNM:
+        lua_rawgeti(L, -1, 1);
+        needed = compile(L, -1, program, depth);
+        lua_pop(L, 1);
+
+        emit(L, program, EXPR_UNM, 0, NULL);
+
+        break;
+    default: {
+        int rhs_needed;
+
+        lua_rawgeti(L, -1, 1);
+        needed = compile(L, -1, program, depth);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, -1, 2);
+        rhs_needed = compile(L, -1, program, depth + 1);
+        lua_pop(L, 1);
+
+        if (rhs_needed > needed) {
+            needed = rhs_needed;
+        }
+
+        emit(L, program, expr->op, 0, NULL);
+
+        break;
+    }
+    }
+
+    lua_pop(L, 1);
+
+    return needed;
+}
+
+static void emit(lua_State *L, Program *program, int op, lua_Number constant,
+                 const TypeVec *tv) {
+    Instr *instr;
+
+    assert(L);
+    assert(program);
+
+    if (program->len >= EXPR_MAX_PROGRAM) {
+        luaL_error(L, "expression has too many terms");
+    }
+
+    instr = &program->instrs[program->len++];
+    instr->op = op;
+    instr->constant = constant;
+    instr->tv = tv;
+}
+
+/*
+ *  Runs the program over [offset, offset + count). Each stack slot owns
+ *  a scratch tile; a number Vec operand is read in place instead of
+ *  being copied into one.
+ */
+static void run_block(const Program *program, size_t offset, size_t count,
+                      lua_Number *dst) {
+    lua_Number tiles[EXPR_MAX_DEPTH][EXPR_BLOCK];
+    const lua_Number *slots[EXPR_MAX_DEPTH];
+    size_t top = 0;
+    size_t pc;
+    size_t i;
+
+    assert(program);
+    assert(dst);
+
+    for (pc = 0; pc < program->len; ++pc) {
+        const Instr *const instr = &program->instrs[pc];
+
+        switch (instr->op) {
+        case EXPR_VEC:
+            if (instr->tv->typeinfo.type == TP_NUM) {
+                slots[top] = (const lua_Number*) Vec_as_ptr(&instr->tv->vec) + offset;
+            } else {
+                const lua_Integer *const src =
+                    (const lua_Integer*) Vec_as_ptr(&instr->tv->vec) + offset;
+
+                for (i = 0; i < count; ++i) {
+                    tiles[top][i] = (lua_Number) src[i];
+                }
+
+                slots[top] = tiles[top];
+            }
+
+            ++top;
+
+            break;
+        case EXPR_CONST:
+            for (i = 0; i < count; ++i) {
+                tiles[top][i] = instr->constant;
+            }
+
+            slots[top] = tiles[top];
+            ++top;
+
+            break;
+        case EXPR_UNM: {
+            const lua_Number *const src = slots[top - 1];
+            lua_Number *const out = tiles[top - 1];
+
+            for (i = 0; i < count; ++i) {
+                out[i] = -src[i];
+            }
+
+            slots[top - 1] = out;
+
+            break;
+        }
+        default: {
+            const lua_Number *const lhs = slots[top - 2];
+            const lua_Number *const rhs = slots[top - 1];
+            lua_Number *const out = tiles[top - 2];
+
+            switch (instr->op) {
+            case EXPR_ADD:
+                for (i = 0; i < count; ++i) {
+                    out[i] = lhs[i] + rhs[i];
+                }
+
+                break;
+            case EXPR_SUB:
+                for (i = 0; i < count; ++i) {
+                    out[i] = lhs[i] - rhs[i];
+                }
+
+                break;
+            case EXPR_MUL:
+                for (i = 0; i < count; ++i) {
+                    out[i] = lhs[i] * rhs[i];
+                }
+
+                break;
+            case EXPR_DIV:
+                for (i = 0; i < count; ++i) {
+                    out[i] = lhs[i] / rhs[i];
+                }
+
+                break;
+            default:
+                assert(0 && "invalid opcode");
+            }
+
+            slots[top - 2] = out;
+            --top;
+
+            break;
+        }
+        }
+    }
+
+    assert(top == 1);
+
+    memmove(dst, slots[0], count * sizeof(lua_Number));
+}
@@ -0,0 +1,218 @@
+#include <larr/larr.h>
+
+#include "slice.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  All of these iterate over the Vec's buffer in C and call the Lua
+ *  function once per element as fn(value, index). The length is
+ *  re-read on every iteration, so a callback that shrinks the Vec
+ *  stops the iteration early instead of reading past the end.
+ */
+
+/* continuation contexts of reduce_k */
+#define AFTER_CALL 0
+#define AFTER_SLICE 1
+
+static int reduce_k(lua_State *L, int status, lua_KContext ctx);
+
+int l_Vec_map(lua_State *L) {
+    const TypeVec *tv;
+    TypeVec *out;
+    Typeinfo out_type;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    if (lua_isnoneornil(L, 3)) {
+        out_type = tv->typeinfo;
+    } else {
+        out_type = check_typeinfo(L, 3);
+    }
+
+    lua_settop(L, 3);
+    out = new_tv(L, typeinfo_of(out_type.type), Vec_len(&tv->vec));
+    /* Vec, function, type, out */
+
+    for (i = 0; i < Vec_len(&tv->vec); ++i) {
+        const char *name;
+        int res;
+
+        lua_pushvalue(L, 2);
+        tv->vtbl->push_elem(tv, i, L);
+        push_size_t(L, i + 1);
+        lua_call(L, 2, 1);
+        /* Vec, function, type, out, result */
+
+        res = out->vtbl->try_push(out, L);
+
+        if (res == PE_OK) {
+            lua_pop(L, 1);
+
+            continue;
+        }
+
+        name = luaL_typename(L, -1);
+
+        if (res == PE_NO_MEMORY) {
+            return luaL_error(L, "out of memory");
+        }
+
+        return luaL_error(L, "bad return value from map function (expected %s, got %s)",
+                          out_type.name.str, name);
+    }
+
+    return 1;
+}
+
+int l_Vec_filter(lua_State *L) {
+    const TypeVec *tv;
+    TypeVec *out;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    lua_settop(L, 2);
+    out = new_tv(L, tv->typeinfo, Vec_len(&tv->vec));
+    /* Vec, function, out */
+
+    for (i = 0; i < Vec_len(&tv->vec); ++i) {
+        const void *elem;
+        int keep;
+
+        lua_pushvalue(L, 2);
+        tv->vtbl->push_elem(tv, i, L);
+        push_size_t(L, i + 1);
+        lua_call(L, 2, 1);
+
+        keep = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        /* the callback may have reallocated or shrunk the source */
+        elem = Vec_get(&tv->vec, i);
+
+        if (keep && elem && Vec_push(&out->vec, elem) != LARR_OK) {
+            return luaL_error(L, "out of memory");
+        }
+    }
+
+    return 1;
+}
+
+int l_Vec_reduce(lua_State *L) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    lua_settop(L, 3);
+    /* Vec, function, accumulator */
+
+    if (lua_isnil(L, 3)) {
+        if (Vec_is_empty(&tv->vec)) {
+            return luaL_error(L, "reduce of empty Vec with no initial value");
+        }
+
+        tv->vtbl->first(tv, L);
+        lua_replace(L, 3);
+        lua_pushinteger(L, 1);
+    } else {
+        lua_pushinteger(L, 0);
+    }
+    /* Vec, function, accumulator, index */
+
+    return reduce_k(L, LUA_OK, AFTER_SLICE);
+}
+
+int l_Vec_foreach(lua_State *L) {
+    const TypeVec *tv;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    lua_settop(L, 2);
+
+    for (i = 0; i < Vec_len(&tv->vec); ++i) {
+        lua_pushvalue(L, 2);
+        tv->vtbl->push_elem(tv, i, L);
+        push_size_t(L, i + 1);
+        lua_call(L, 2, 0);
+    }
+
+    return 0;
+}
+
+/*
+ *  The callback may yield, so it is called with a continuation; the
+ *  index of the element being folded is kept on the stack for when it
+ *  returns.
+ */
+static int reduce_k(lua_State *L, int status, lua_KContext ctx) {
+    const TypeVec *tv;
+    size_t quantum;
+    size_t done = 0;
+    size_t i;
+
+    assert(L);
+
+    if (status == LUA_YIELD && ctx == AFTER_SLICE && slice_cancelled(L, 4)) {
+        return luaL_error(L, "operation cancelled");
+    }
+
+    i = (size_t) lua_tointeger(L, 4);
+
+    if (status == LUA_YIELD && ctx == AFTER_CALL) {
+        lua_replace(L, 3);
+        ++i;
+    }
+
+    tv = check_tv(L, 1);
+    quantum = slice_quantum(L);
+
+    for (; i < Vec_len(&tv->vec); ++i) {
+        if (quantum > 0 && done++ == quantum) {
+            lua_pushinteger(L, (lua_Integer) i);
+            lua_replace(L, 4);
+
+            return lua_yieldk(L, 0, AFTER_SLICE, reduce_k);
+        }
+
+        lua_pushinteger(L, (lua_Integer) i);
+        lua_replace(L, 4);
+
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, 3);
+        tv->vtbl->push_elem(tv, i, L);
+        push_size_t(L, i + 1);
+        lua_callk(L, 3, 1, AFTER_CALL, reduce_k);
+        lua_replace(L, 3);
+    }
+
+    lua_settop(L, 3);
+
+    return 1;
+}
@@ -0,0 +1,351 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Gather, scatter and masked selection over number and integer Vecs.
+ *  Indices are a Vec<integer> of 1-based positions; masks are a
+ *  Vec<boolean> or Vec<integer> of the same length as the source, where
+ *  any nonzero element selects. Each kernel is one loop over the raw
+ *  buffers, written without data-dependent branches where possible so
+ *  that the compiler is free to vectorize it.
+ */
+
+/*
+ *  A scalar operand is passed as a pointer with stride 0, so the same
+ *  loop serves both the Vec and the broadcast case.
+ */
+#define DEFINE_GATHER(nickname, T) \
+    static size_t nickname ## _take(const T *src, size_t len, const lua_Integer *idx, size_t n, \
+                                    T *dst) { \
+        size_t k; \
+        \
+        for (k = 0; k < n; ++k) { \
+            if ((lua_Unsigned) idx[k] - 1 >= (lua_Unsigned) len) { \
+                return k; \
+            } \
+            \
+            dst[k] = src[idx[k] - 1]; \
+        } \
+        \
+        return n; \
+    } \
+    \
+    static size_t nickname ## _put(T *dst, size_t len, const lua_Integer *idx, size_t n, \
+                                   const T *vals, size_t stride) { \
+        size_t k; \
+        \
+        for (k = 0; k < n; ++k) { \
+            if ((lua_Unsigned) idx[k] - 1 >= (lua_Unsigned) len) { \
+                return k; \
+            } \
+            \
+            dst[idx[k] - 1] = vals[k * stride]; \
+        } \
+        \
+        return n; \
+    }
+
+#define DEFINE_MASKED(nickname, T, mask_nickname, M) \
+    static size_t nickname ## _select_ ## mask_nickname(const T *src, const M *mask, size_t len, \
+                                                        T *dst) { \
+        size_t i; \
+        size_t k = 0; \
+        \
+        /* always store, then only advance past kept elements */ \
+        for (i = 0; i < len; ++i) { \
+            dst[k] = src[i]; \
+            k += (mask[i] != 0); \
+        } \
+        \
+        return k; \
+    } \
+    \
+    static void nickname ## _where_ ## mask_nickname(const T *src, const M *mask, \
+                                                     const T *other, size_t stride, size_t len, \
+                                                     T *dst) { \
+        size_t i; \
+        \
+        for (i = 0; i < len; ++i) { \
+            dst[i] = (mask[i] != 0) ? src[i] : other[i * stride]; \
+        } \
+    }
+
+DEFINE_GATHER(num, lua_Number)
+DEFINE_GATHER(int, lua_Integer)
+
+DEFINE_MASKED(num, lua_Number, bool, uint8_t)
+DEFINE_MASKED(num, lua_Number, int, lua_Integer)
+DEFINE_MASKED(int, lua_Integer, bool, uint8_t)
+DEFINE_MASKED(int, lua_Integer, int, lua_Integer)
+
+static const TypeVec* check_source(lua_State *L, int arg);
+
+static const TypeVec* check_indices(lua_State *L, int arg);
+
+static const TypeVec* check_mask(lua_State *L, int arg, size_t len);
+
+static const void* check_operand(lua_State *L, int arg, const TypeVec *tv, size_t len,
+                                 void *scalar, size_t *stride);
+
+int l_Vec_take(lua_State *L) {
+    const TypeVec *tv;
+    const TypeVec *indices;
+    TypeVec *out;
+    size_t n;
+    size_t taken;
+
+    assert(L);
+
+    tv = check_source(L, 1);
+    indices = check_indices(L, 2);
+    n = Vec_len(&indices->vec);
+
+    lua_settop(L, 2);
+    out = new_tv(L, tv->typeinfo, n);
+
+    if (tv->typeinfo.type == TP_NUM) {
+        taken = num_take((const lua_Number*) Vec_as_ptr(&tv->vec), Vec_len(&tv->vec),
+                         (const lua_Integer*) Vec_as_ptr(&indices->vec), n,
+                         (lua_Number*) Vec_as_mut_ptr(&out->vec));
+    } else {
+        taken = int_take((const lua_Integer*) Vec_as_ptr(&tv->vec), Vec_len(&tv->vec),
+                         (const lua_Integer*) Vec_as_ptr(&indices->vec), n,
+                         (lua_Integer*) Vec_as_mut_ptr(&out->vec));
+    }
+
+    if (taken != n) {
+        return luaL_error(L, "index %I at position %I is out of range [1, %I]",
+                          ((const lua_Integer*) Vec_as_ptr(&indices->vec))[taken],
+                          (lua_Integer) taken + 1, (lua_Integer) Vec_len(&tv->vec));
+    }
+
+    out->vec.len = n;
+
+    return 1;
+}
+
+int l_Vec_put(lua_State *L) {
+    TypeVec *tv;
+    const TypeVec *indices;
+    const void *vals;
+    lua_Number num;
+    lua_Integer integer;
+    size_t n;
+    size_t stride;
+    size_t put;
+
+    assert(L);
+
+    check_source(L, 1);
+    indices = check_indices(L, 2);
+    n = Vec_len(&indices->vec);
+    tv = check_tv_mut(L, 1);
+
+    /* a failed index leaves the elements before it written */
+    if (tv->typeinfo.type == TP_NUM) {
+        vals = check_operand(L, 3, tv, n, &num, &stride);
+        put = num_put((lua_Number*) Vec_as_mut_ptr(&tv->vec), Vec_len(&tv->vec),
+                      (const lua_Integer*) Vec_as_ptr(&indices->vec), n,
+                      (const lua_Number*) vals, stride);
+    } else {
+        vals = check_operand(L, 3, tv, n, &integer, &stride);
+        put = int_put((lua_Integer*) Vec_as_mut_ptr(&tv->vec), Vec_len(&tv->vec),
+                      (const lua_Integer*) Vec_as_ptr(&indices->vec), n,
+                      (const lua_Integer*) vals, stride);
+    }
+
+    if (put != n) {
+        return luaL_error(L, "index %I at position %I is out of range [1, %I]",
+                          ((const lua_Integer*) Vec_as_ptr(&indices->vec))[put],
+                          (lua_Integer) put + 1, (lua_Integer) Vec_len(&tv->vec));
+    }
+
+    return 0;
+}
+
+int l_Vec_select(lua_State *L) {
+    const TypeVec *tv;
+    const TypeVec *mask;
+    TypeVec *out;
+    const void *src;
+    const void *mask_data;
+    void *dst;
+    size_t len;
+    int bool_mask;
+
+    assert(L);
+
+    tv = check_source(L, 1);
+    len = Vec_len(&tv->vec);
+    mask = check_mask(L, 2, len);
+    bool_mask = (mask->typeinfo.type == TP_BOOL);
+
+    lua_settop(L, 2);
+    out = new_tv(L, tv->typeinfo, len);
+
+    src = Vec_as_ptr(&tv->vec);
+    mask_data = Vec_as_ptr(&mask->vec);
+    dst = Vec_as_mut_ptr(&out->vec);
+
+    if (len == 0) {
+        return 1;
+    }
+
+    if (tv->typeinfo.type == TP_NUM) {
+        out->vec.len = bool_mask
+            ? num_select_bool((const lua_Number*) src, (const uint8_t*) mask_data, len,
+                              (lua_Number*) dst)
+            : num_select_int((const lua_Number*) src, (const lua_Integer*) mask_data, len,
+                             (lua_Number*) dst);
+    } else {
+        out->vec.len = bool_mask
+            ? int_select_bool((const lua_Integer*) src, (const uint8_t*) mask_data, len,
+                              (lua_Integer*) dst)
+            : int_select_int((const lua_Integer*) src, (const lua_Integer*) mask_data, len,
+                             (lua_Integer*) dst);
+    }
+
+    return 1;
+}
+
+int l_Vec_where(lua_State *L) {
+    const TypeVec *tv;
+    const TypeVec *mask;
+    TypeVec *out;
+    const void *mask_data;
+    const void *other;
+    lua_Number num;
+    lua_Integer integer;
+    size_t len;
+    size_t stride;
+    int bool_mask;
+
+    assert(L);
+
+    tv = check_source(L, 1);
+    len = Vec_len(&tv->vec);
+    mask = check_mask(L, 2, len);
+    bool_mask = (mask->typeinfo.type == TP_BOOL);
+    other = check_operand(L, 3, tv, len,
+                          (tv->typeinfo.type == TP_NUM) ? (void*) &num : (void*) &integer,
+                          &stride);
+
+    lua_settop(L, 3);
+    out = new_tv(L, tv->typeinfo, len);
+    out->vec.len = len;
+    mask_data = Vec_as_ptr(&mask->vec);
+
+    if (len == 0) {
+        return 1;
+    }
+
+    if (tv->typeinfo.type == TP_NUM) {
+        const lua_Number *const src = (const lua_Number*) Vec_as_ptr(&tv->vec);
+        lua_Number *const dst = (lua_Number*) Vec_as_mut_ptr(&out->vec);
+
+        if (bool_mask) {
+            num_where_bool(src, (const uint8_t*) mask_data, (const lua_Number*) other, stride,
+                           len, dst);
+        } else {
+            num_where_int(src, (const lua_Integer*) mask_data, (const lua_Number*) other, stride,
+                          len, dst);
+        }
+    } else {
+        const lua_Integer *const src = (const lua_Integer*) Vec_as_ptr(&tv->vec);
+        lua_Integer *const dst = (lua_Integer*) Vec_as_mut_ptr(&out->vec);
+
+        if (bool_mask) {
+            int_where_bool(src, (const uint8_t*) mask_data, (const lua_Integer*) other, stride,
+                           len, dst);
+        } else {
+            int_where_int(src, (const lua_Integer*) mask_data, (const lua_Integer*) other, stride,
+                          len, dst);
+        }
+    }
+
+    return 1;
+}
+
+static const TypeVec* check_source(lua_State *L, int arg) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, arg,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+
+    return tv;
+}
+
+static const TypeVec* check_indices(lua_State *L, int arg) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_INT, arg, "expected larr.Vec<integer>");
+
+    return tv;
+}
+
+static const TypeVec* check_mask(lua_State *L, int arg, size_t len) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_BOOL || tv->typeinfo.type == TP_INT, arg,
+                  "expected larr.Vec<boolean> or larr.Vec<integer>");
+    luaL_argcheck(L, Vec_len(&tv->vec) == len, arg, "mask must have the same length");
+
+    return tv;
+}
+
+/*
+ *  Returns the data of the Vec at arg, which must have tv's type and
+ *  length len, with *stride 1; or reads a scalar at arg into *scalar
+ *  and returns it with *stride 0.
+ */
+static const void* check_operand(lua_State *L, int arg, const TypeVec *tv, size_t len,
+                                 void *scalar, size_t *stride) {
+    assert(L);
+    assert(tv);
+    assert(scalar);
+    assert(stride);
+
+    if (lua_isuserdata(L, arg)) {
+        const TypeVec *const other = check_tv(L, arg);
+
+        luaL_argcheck(L, other->typeinfo.type == tv->typeinfo.type, arg,
+                      "Vec must have the same element type");
+        luaL_argcheck(L, Vec_len(&other->vec) == len, arg, "Vec has the wrong length");
+        *stride = 1;
+
+        return Vec_as_ptr(&other->vec);
+    }
+
+    if (tv->typeinfo.type == TP_NUM) {
+        *(lua_Number*) scalar = luaL_checknumber(L, arg);
+    } else {
+        *(lua_Integer*) scalar = luaL_checkinteger(L, arg);
+    }
+
+    *stride = 0;
+
+    return scalar;
+}
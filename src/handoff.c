@@ -0,0 +1,188 @@
+#include <larr/larr.h>
+
+#include "storage.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Handing Vecs between lua_States, which may run on different threads.
+ *  v:share(mode) returns a token, a light userdata that the host passes
+ *  to another lua_State however it likes; Vec.from_shared(token) there
+ *  turns it back into a Vec without copying any elements. Each token
+ *  is redeemed at most once: redeeming frees it, Vec.discard_shared
+ *  frees one that won't be redeemed, and a token that is neither leaks
+ *  its reference to the buffer. A token is a serial number disguised
+ *  as a pointer, never an address, and outstanding tokens are kept in
+ *  one process-wide list behind a mutex. A token that was already
+ *  redeemed or discarded, or any other light userdata, is looked up and
+ *  rejected without being dereferenced, and can't alias a newer token.
+ *
+ *  In "read" mode, the default, both Vecs share the buffer as
+ *  copy-on-write clones do, so either side copies it before writing to
+ *  it and neither sees the other's writes. In "write" mode the buffer
+ *  moves to the receiving Vec, which can then write to it in place, and
+ *  v is left empty; there is never more than one writer.
+ *
+ *  Only Vecs of plain values (numbers, integers and booleans) can be
+ *  shared, since other elements are references into one lua_State.
+ */
+
+typedef struct ShareToken {
+    struct ShareToken *prev;
+    struct ShareToken *next;
+    size_t serial;
+    Vec vec;
+    Storage *storage;
+    int type;
+} ShareToken;
+
+static pthread_mutex_t tokens_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ShareToken *tokens = NULL;
+
+static size_t last_serial = 0;
+
+static void* add_token(ShareToken *token);
+
+static ShareToken* take_token(const void *key);
+
+int l_Vec_share(lua_State *L) {
+    static const char *const modes[] = { "read", "write", NULL };
+
+    TypeVec *tv;
+    ShareToken *token;
+    int mode;
+
+    assert(L);
+
+    /* not check_tv_mut, which would copy a shared buffer just to share it */
+    tv = (TypeVec*) luaL_checkudata(L, 1, "larr.Vec");
+    mode = luaL_checkoption(L, 2, "read", modes);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT
+                     || tv->typeinfo.type == TP_BOOL, 1,
+                  "expected larr.Vec<number>, larr.Vec<integer> or larr.Vec<boolean>");
+    luaL_argcheck(L, mode == 1 || !tv->storage || !tv->storage->writable, 2,
+                  "a Vec from larr.Vec.shared can only be shared in 'write' mode");
+
+    token = (ShareToken*) malloc(sizeof(ShareToken));
+
+    if (!token) {
+        return luaL_error(L, "out of memory");
+    }
+
+    token->type = tv->typeinfo.type;
+
+    if (mode == 1) {
+        token->vec = tv->vec;
+        token->storage = tv->storage;
+        Vec_new(&tv->vec, sizeof_type_repr(tv->typeinfo.type));
+        tv->storage = NULL;
+    } else if (Storage_clone(&tv->vec, &tv->storage, &token->vec, &token->storage) != LARR_OK) {
+        free(token);
+
+        return luaL_error(L, "out of memory");
+    }
+
+    lua_pushlightuserdata(L, add_token(token));
+
+    return 1;
+}
+
+int l_Vec_from_shared(lua_State *L) {
+    ShareToken *token;
+    TypeVec *tv;
+
+    assert(L);
+
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    lua_settop(L, 1);
+
+    /* created first, so that nothing can raise once the token is taken */
+    tv = new_tv(L, typeinfo_of(TP_NUM), 0);
+    token = take_token(lua_touserdata(L, 1));
+    luaL_argcheck(L, token != NULL, 1, "expected an unredeemed token from Vec:share");
+
+    Vec_delete(&tv->vec);
+    tv->vec = token->vec;
+    tv->typeinfo = typeinfo_of(token->type);
+    tv->vtbl = get_vtbl(token->type);
+    tv->storage = token->storage;
+    free(token);
+
+    return 1;
+}
+
+int l_Vec_discard_shared(lua_State *L) {
+    ShareToken *token;
+
+    assert(L);
+
+    luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+    token = take_token(lua_touserdata(L, 1));
+    luaL_argcheck(L, token != NULL, 1, "expected an unredeemed token from Vec:share");
+
+    Storage_release(&token->vec, &token->storage);
+    free(token);
+
+    return 0;
+}
+
+/* @returns The key that names token, which is never NULL */
+static void* add_token(ShareToken *token) {
+    assert(token);
+
+    pthread_mutex_lock(&tokens_mutex);
+
+    token->serial = ++last_serial;
+    token->prev = NULL;
+    token->next = tokens;
+
+    if (tokens) {
+        tokens->prev = token;
+    }
+
+    tokens = token;
+
+    pthread_mutex_unlock(&tokens_mutex);
+
+    return (void*) token->serial;
+}
+
+/* @returns The outstanding token named by key, now unlisted, or NULL if there is none */
+static ShareToken* take_token(const void *key) {
+    ShareToken *token;
+
+    pthread_mutex_lock(&tokens_mutex);
+
+    for (token = tokens; token && (const void*) token->serial != key; token = token->next) { }
+
+    if (token) {
+        if (token->prev) {
+            token->prev->next = token->next;
+        } else {
+            tokens = token->next;
+        }
+
+        if (token->next) {
+            token->next->prev = token->prev;
+        }
+    }
+
+    pthread_mutex_unlock(&tokens_mutex);
+
+    return token;
+}
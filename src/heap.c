@@ -0,0 +1,517 @@
+#include <larr/larr.h>
+
+#include "storage.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.Heap is a priority queue over a number or integer Vec of keys,
+ *  kept in place as an implicit HEAP_ARITY-ary heap. A wider node means
+ *  a shallower tree, and its children sit next to each other in one or
+ *  two cache lines, so sift-down touches fewer lines than with a binary
+ *  heap. A keyed heap also carries a Vec<integer> payload that is moved
+ *  in lockstep with the keys. Both Vecs live in the uservalue table
+ *  under "keys" and "payloads".
+ */
+
+#define HEAP_ARITY 4
+
+typedef struct Heap {
+    int type; /* TP_NUM or TP_INT */
+    int max; /* nonzero if the largest key is on top */
+    int keyed;
+} Heap;
+
+typedef struct HeapOps {
+    void (*sift_up)(void *keys, lua_Integer *payloads, size_t i);
+    void (*sift_down)(void *keys, lua_Integer *payloads, size_t len, size_t i);
+} HeapOps;
+
+#define MIN_FIRST(lhs, rhs) ((lhs) < (rhs))
+#define MAX_FIRST(lhs, rhs) ((lhs) > (rhs))
+
+/*
+ *  Both sifts move a hole instead of swapping, so each level costs one
+ *  store per Vec. payloads may be NULL.
+ */
+#define DEFINE_HEAP(nickname, T, FIRST) \
+    static void nickname ## _sift_up(void *keys_ptr, lua_Integer *payloads, size_t i) { \
+        T *const keys = (T*) keys_ptr; \
+        const T key = keys[i]; \
+        const lua_Integer payload = payloads ? payloads[i] : 0; \
+        \
+        while (i > 0) { \
+            const size_t parent = (i - 1) / HEAP_ARITY; \
+            \
+            if (!FIRST(key, keys[parent])) { \
+                break; \
+            } \
+            \
+            keys[i] = keys[parent]; \
+            \
+            if (payloads) { \
+                payloads[i] = payloads[parent]; \
+            } \
+            \
+            i = parent; \
+        } \
+        \
+        keys[i] = key; \
+        \
+        if (payloads) { \
+            payloads[i] = payload; \
+        } \
+    } \
+    \
+    static void nickname ## _sift_down(void *keys_ptr, lua_Integer *payloads, size_t len, \
+                                       size_t i) { \
+        T *const keys = (T*) keys_ptr; \
+        const T key = keys[i]; \
+        const lua_Integer payload = payloads ? payloads[i] : 0; \
+        \
+        for (;;) { \
+            const size_t first = i * HEAP_ARITY + 1; \
+            const size_t last = (len - first < HEAP_ARITY) ? len : first + HEAP_ARITY; \
+            size_t best; \
+            size_t c; \
+            \
+            if (first >= len) { \
+                break; \
+            } \
+            \
+            for (best = first, c = first + 1; c < last; ++c) { \
+                best = FIRST(keys[c], keys[best]) ? c : best; \
+            } \
+            \
+            if (!FIRST(keys[best], key)) { \
+                break; \
+            } \
+            \
+            keys[i] = keys[best]; \
+            \
+            if (payloads) { \
+                payloads[i] = payloads[best]; \
+            } \
+            \
+            i = best; \
+        } \
+        \
+        keys[i] = key; \
+        \
+        if (payloads) { \
+            payloads[i] = payload; \
+        } \
+    }
+
+DEFINE_HEAP(num_min, lua_Number, MIN_FIRST)
+DEFINE_HEAP(num_max, lua_Number, MAX_FIRST)
+DEFINE_HEAP(int_min, lua_Integer, MIN_FIRST)
+DEFINE_HEAP(int_max, lua_Integer, MAX_FIRST)
+
+static const HeapOps HEAP_OPS[2][2] = {
+    { { num_min_sift_up, num_min_sift_down }, { num_max_sift_up, num_max_sift_down } },
+    { { int_min_sift_up, int_min_sift_down }, { int_max_sift_up, int_max_sift_down } }
+};
+
+static const char *const ORDER_NAMES[] = { "min", "max", NULL };
+
+static const Heap* check_heap(lua_State *L, int arg);
+
+static const HeapOps* ops_of(const Heap *self);
+
+static void get_parts(lua_State *L, int arg, TypeVec **keys, TypeVec **payloads);
+
+static void make_parts_unique(lua_State *L, TypeVec *keys, TypeVec *payloads);
+
+static void check_key(lua_State *L, int arg, const Heap *self, lua_Number *num,
+                      lua_Integer *integer);
+
+static void push_top(lua_State *L, const Heap *self, const TypeVec *keys,
+                     const TypeVec *payloads);
+
+int l_Heap_new(lua_State *L) {
+    Heap *self;
+    Typeinfo typeinfo;
+
+    assert(L);
+
+    typeinfo = check_typeinfo(L, 1);
+    luaL_argcheck(L, typeinfo.type == TP_NUM || typeinfo.type == TP_INT, 1,
+                  "expected 'number' or 'integer'");
+    lua_settop(L, 3);
+
+    self = (Heap*) lua_newuserdata(L, sizeof(Heap));
+    self->type = typeinfo.type;
+    self->max = luaL_checkoption(L, 2, "min", ORDER_NAMES);
+    self->keyed = lua_toboolean(L, 3);
+    luaL_setmetatable(L, "larr.Heap");
+
+    lua_createtable(L, 0, 2);
+    new_tv(L, typeinfo_of(typeinfo.type), 0);
+    lua_setfield(L, -2, "keys");
+
+    if (self->keyed) {
+        new_tv(L, typeinfo_of(TP_INT), 0);
+        lua_setfield(L, -2, "payloads");
+    }
+
+    lua_setuservalue(L, -2);
+
+    return 1;
+}
+
+int l_Heap_meta_len(lua_State *L) {
+    TypeVec *keys;
+    TypeVec *payloads;
+
+    assert(L);
+
+    check_heap(L, 1);
+    get_parts(L, 1, &keys, &payloads);
+    push_size_t(L, Vec_len(&keys->vec));
+
+    return 1;
+}
+
+int l_Heap_is_empty(lua_State *L) {
+    TypeVec *keys;
+    TypeVec *payloads;
+
+    assert(L);
+
+    check_heap(L, 1);
+    get_parts(L, 1, &keys, &payloads);
+    lua_pushboolean(L, Vec_is_empty(&keys->vec));
+
+    return 1;
+}
+
+int l_Heap_push(lua_State *L) {
+    const Heap *self;
+    TypeVec *keys;
+    TypeVec *payloads;
+    lua_Number num;
+    lua_Integer integer;
+    lua_Integer payload;
+
+    assert(L);
+
+    self = check_heap(L, 1);
+    check_key(L, 2, self, &num, &integer);
+    payload = self->keyed ? luaL_checkinteger(L, 3) : 0;
+
+    get_parts(L, 1, &keys, &payloads);
+    make_parts_unique(L, keys, payloads);
+
+    if (Vec_reserve(&keys->vec, 1) != LARR_OK
+        || (payloads && Vec_reserve(&payloads->vec, 1) != LARR_OK)) {
+        return luaL_error(L, "out of memory");
+    }
+
+    Vec_push(&keys->vec, (self->type == TP_NUM) ? (const void*) &num : (const void*) &integer);
+
+    if (payloads) {
+        Vec_push(&payloads->vec, &payload);
+    }
+
+    ops_of(self)->sift_up(Vec_as_mut_ptr(&keys->vec),
+                          payloads ? (lua_Integer*) Vec_as_mut_ptr(&payloads->vec) : NULL,
+                          Vec_len(&keys->vec) - 1);
+
+    return 0;
+}
+
+int l_Heap_top(lua_State *L) {
+    const Heap *self;
+    TypeVec *keys;
+    TypeVec *payloads;
+
+    assert(L);
+
+    self = check_heap(L, 1);
+    get_parts(L, 1, &keys, &payloads);
+
+    if (Vec_is_empty(&keys->vec)) {
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    push_top(L, self, keys, payloads);
+
+    return self->keyed ? 2 : 1;
+}
+
+int l_Heap_pop(lua_State *L) {
+    const Heap *self;
+    TypeVec *keys;
+    TypeVec *payloads;
+    size_t last;
+    char *key_data;
+
+    assert(L);
+
+    self = check_heap(L, 1);
+    get_parts(L, 1, &keys, &payloads);
+
+    if (Vec_is_empty(&keys->vec)) {
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    make_parts_unique(L, keys, payloads);
+    push_top(L, self, keys, payloads);
+
+    last = Vec_len(&keys->vec) - 1;
+    key_data = (char*) Vec_as_mut_ptr(&keys->vec);
+    memcpy(key_data, key_data + last * keys->vec.element_size, keys->vec.element_size);
+    keys->vec.len = last;
+
+    if (payloads) {
+        lua_Integer *const payload_data = (lua_Integer*) Vec_as_mut_ptr(&payloads->vec);
+
+        payload_data[0] = payload_data[last];
+        payloads->vec.len = last;
+    }
+
+    if (last > 0) {
+        ops_of(self)->sift_down(key_data,
+                                payloads ? (lua_Integer*) Vec_as_mut_ptr(&payloads->vec) : NULL,
+                                last, 0);
+    }
+
+    return self->keyed ? 2 : 1;
+}
+
+/* pops the top and pushes a new entry with a single sift */
+int l_Heap_replace(lua_State *L) {
+    const Heap *self;
+    TypeVec *keys;
+    TypeVec *payloads;
+    lua_Number num;
+    lua_Integer integer;
+    lua_Integer payload;
+
+    assert(L);
+
+    self = check_heap(L, 1);
+    check_key(L, 2, self, &num, &integer);
+    payload = self->keyed ? luaL_checkinteger(L, 3) : 0;
+    get_parts(L, 1, &keys, &payloads);
+
+    if (Vec_is_empty(&keys->vec)) {
+        lua_settop(L, 3);
+        l_Heap_push(L);
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    make_parts_unique(L, keys, payloads);
+    push_top(L, self, keys, payloads);
+
+    memcpy(Vec_as_mut_ptr(&keys->vec),
+           (self->type == TP_NUM) ? (const void*) &num : (const void*) &integer,
+           keys->vec.element_size);
+
+    if (payloads) {
+        *(lua_Integer*) Vec_as_mut_ptr(&payloads->vec) = payload;
+    }
+
+    ops_of(self)->sift_down(Vec_as_mut_ptr(&keys->vec),
+                            payloads ? (lua_Integer*) Vec_as_mut_ptr(&payloads->vec) : NULL,
+                            Vec_len(&keys->vec), 0);
+
+    return self->keyed ? 2 : 1;
+}
+
+/* replaces the contents with copies of the given Vecs in O(n) */
+int l_Heap_heapify(lua_State *L) {
+    const Heap *self;
+    const TypeVec *src_keys;
+    const TypeVec *src_payloads;
+    TypeVec *keys;
+    TypeVec *payloads;
+    size_t len;
+    size_t i;
+
+    assert(L);
+
+    self = check_heap(L, 1);
+    src_keys = check_tv(L, 2);
+    luaL_argcheck(L, src_keys->typeinfo.type == self->type, 2,
+                  "Vec must have the heap's key type");
+    len = Vec_len(&src_keys->vec);
+
+    if (self->keyed) {
+        src_payloads = check_tv(L, 3);
+        luaL_argcheck(L, src_payloads->typeinfo.type == TP_INT, 3, "expected larr.Vec<integer>");
+        luaL_argcheck(L, Vec_len(&src_payloads->vec) == len, 3,
+                      "payloads must have the same length as the keys");
+    } else {
+        src_payloads = NULL;
+    }
+
+    get_parts(L, 1, &keys, &payloads);
+    make_parts_unique(L, keys, payloads);
+
+    Vec_clear(&keys->vec);
+
+    if (payloads) {
+        Vec_clear(&payloads->vec);
+    }
+
+    if (Vec_append(&keys->vec, Vec_as_ptr(&src_keys->vec), len) != LARR_OK
+        || (payloads
+            && Vec_append(&payloads->vec, Vec_as_ptr(&src_payloads->vec), len) != LARR_OK)) {
+        Vec_clear(&keys->vec);
+
+        if (payloads) {
+            Vec_clear(&payloads->vec);
+        }
+
+        return luaL_error(L, "out of memory");
+    }
+
+    for (i = (len + HEAP_ARITY - 2) / HEAP_ARITY; i > 0; --i) {
+        ops_of(self)->sift_down(Vec_as_mut_ptr(&keys->vec),
+                                payloads ? (lua_Integer*) Vec_as_mut_ptr(&payloads->vec) : NULL,
+                                len, i - 1);
+    }
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+int l_Heap_clear(lua_State *L) {
+    TypeVec *keys;
+    TypeVec *payloads;
+
+    assert(L);
+
+    check_heap(L, 1);
+    get_parts(L, 1, &keys, &payloads);
+    make_parts_unique(L, keys, payloads);
+
+    Vec_clear(&keys->vec);
+
+    if (payloads) {
+        Vec_clear(&payloads->vec);
+    }
+
+    return 0;
+}
+
+/* returns copy-on-write clones in heap order */
+static int push_part(lua_State *L, const char *name);
+
+int l_Heap_keys(lua_State *L) {
+    return push_part(L, "keys");
+}
+
+int l_Heap_payloads(lua_State *L) {
+    return push_part(L, "payloads");
+}
+
+static const Heap* check_heap(lua_State *L, int arg) {
+    assert(L);
+
+    return (const Heap*) luaL_checkudata(L, arg, "larr.Heap");
+}
+
+static const HeapOps* ops_of(const Heap *self) {
+    assert(self);
+
+    return &HEAP_OPS[self->type == TP_INT][self->max != 0];
+}
+
+/* the uservalue keeps both Vecs alive; *payloads is NULL for an unkeyed heap */
+static void get_parts(lua_State *L, int arg, TypeVec **keys, TypeVec **payloads) {
+    assert(L);
+    assert(keys);
+    assert(payloads);
+
+    lua_getuservalue(L, arg);
+    lua_getfield(L, -1, "keys");
+    *keys = (TypeVec*) lua_touserdata(L, -1);
+    lua_getfield(L, -2, "payloads");
+    *payloads = (TypeVec*) lua_touserdata(L, -1);
+    lua_pop(L, 3);
+}
+
+static void make_parts_unique(lua_State *L, TypeVec *keys, TypeVec *payloads) {
+    assert(L);
+    assert(keys);
+
+    if (Storage_make_unique(&keys->vec, &keys->storage) != LARR_OK
+        || (payloads && Storage_make_unique(&payloads->vec, &payloads->storage) != LARR_OK)) {
+        luaL_error(L, "out of memory");
+    }
+}
+
+static void check_key(lua_State *L, int arg, const Heap *self, lua_Number *num,
+                      lua_Integer *integer) {
+    assert(L);
+    assert(self);
+    assert(num);
+    assert(integer);
+
+    if (self->type == TP_NUM) {
+        *num = luaL_checknumber(L, arg);
+        luaL_argcheck(L, *num == *num, arg, "key must not be NaN");
+    } else {
+        *integer = luaL_checkinteger(L, arg);
+    }
+}
+
+static void push_top(lua_State *L, const Heap *self, const TypeVec *keys,
+                     const TypeVec *payloads) {
+    assert(L);
+    assert(self);
+    assert(keys);
+
+    if (self->type == TP_NUM) {
+        lua_pushnumber(L, *(const lua_Number*) Vec_as_ptr(&keys->vec));
+    } else {
+        lua_pushinteger(L, *(const lua_Integer*) Vec_as_ptr(&keys->vec));
+    }
+
+    if (payloads) {
+        lua_pushinteger(L, *(const lua_Integer*) Vec_as_ptr(&payloads->vec));
+    }
+}
+
+static int push_part(lua_State *L, const char *name) {
+    assert(L);
+    assert(name);
+
+    check_heap(L, 1);
+    lua_settop(L, 1);
+
+    lua_getuservalue(L, 1);
+
+    if (lua_getfield(L, -1, name) == LUA_TNIL) {
+        return 1;
+    }
+
+    lua_pushcfunction(L, l_Vec_clone);
+    lua_insert(L, -2);
+    lua_call(L, 1, 1);
+
+    return 1;
+}
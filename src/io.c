@@ -0,0 +1,571 @@
+#include <larr/larr.h>
+
+#include "storage.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Loading and saving Vecs on a worker thread. Each call starts one
+ *  detached thread that moves the file in IO_CHUNK byte pieces and
+ *  signals a condition variable when it is done; the returned
+ *  larr.IOHandle only takes the job's mutex to check on it. A load
+ *  reads into a buffer of its own, which becomes the new Vec's buffer
+ *  without a copy. A save holds its own reference to the Vec's buffer,
+ *  like a copy-on-write clone, so the Vec can still be changed while
+ *  the save runs. The reference lives in the job rather than in a Lua
+ *  object, since finalizers may run in any order, and is only dropped
+ *  once the worker is done with it.
+ *
+ *  Files start with a FILE_HEADER_SIZE byte header: the magic "LARR",
+ *  the format version, a type code, the element size, a byte order
+ *  flag (1 for little endian) and the element count as 8 little-endian
+ *  bytes. The elements follow in native representation, so a file can
+ *  only be loaded on a host with the same element size and byte order.
+ */
+
+#define IO_CHUNK ((size_t) 1 << 20)
+
+#define FILE_HEADER_SIZE 16
+
+#define FILE_VERSION 1
+
+/* type codes on disk, independent of the order of TYPES */
+#define FILE_TYPE_NUMBER 1
+#define FILE_TYPE_INTEGER 2
+#define FILE_TYPE_BOOLEAN 3
+
+typedef struct IOJob {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    const char *error; /* NULL on success */
+    int error_no; /* errno for the error, or 0 */
+    int is_save;
+    int type;
+    int file_type;
+    size_t element_size;
+    void *data; /* a load's own buffer, or saved's */
+    size_t len;
+    Vec saved; /* a save's reference to the Vec's buffer */
+    Storage *saved_storage;
+    char *path;
+} IOJob;
+
+typedef struct IOHandle {
+    IOJob *job;
+} IOHandle;
+
+static int file_type_of(int type);
+
+static IOJob* new_job(lua_State *L, const char *path, int type);
+
+static void delete_job(IOJob *job);
+
+static IOHandle* push_handle(lua_State *L);
+
+static void start_job(lua_State *L, IOHandle *handle);
+
+static void* run_job(void *arg);
+
+static void load_file(IOJob *job);
+
+static void save_file(IOJob *job);
+
+static int is_little_endian(void);
+
+static IOHandle* check_handle(lua_State *L, int arg);
+
+static int finish(lua_State *L, IOHandle *handle);
+
+int l_load_async(lua_State *L) {
+    const char *path;
+    Typeinfo typeinfo;
+    IOHandle *handle;
+
+    assert(L);
+
+    path = luaL_checkstring(L, 1);
+    typeinfo = check_typeinfo(L, 2);
+    luaL_argcheck(L, file_type_of(typeinfo.type) != 0, 2,
+                  "expected 'number', 'integer' or 'boolean'");
+
+    lua_settop(L, 2);
+    handle = push_handle(L);
+    handle->job = new_job(L, path, typeinfo.type);
+    start_job(L, handle);
+
+    return 1;
+}
+
+int l_Vec_save_async(lua_State *L) {
+    TypeVec *tv;
+    const char *path;
+    IOHandle *handle;
+    IOJob *job;
+
+    assert(L);
+
+    /* not check_tv_mut, which would copy a shared buffer just to save it */
+    tv = (TypeVec*) luaL_checkudata(L, 1, "larr.Vec");
+    path = luaL_checkstring(L, 2);
+    luaL_argcheck(L, file_type_of(tv->typeinfo.type) != 0, 1,
+                  "expected larr.Vec<number>, larr.Vec<integer> or larr.Vec<boolean>");
+
+    lua_settop(L, 2);
+    handle = push_handle(L);
+    job = new_job(L, path, tv->typeinfo.type);
+
+    if (Storage_clone(&tv->vec, &tv->storage, &job->saved, &job->saved_storage) != LARR_OK) {
+        delete_job(job);
+
+        return luaL_error(L, "out of memory");
+    }
+
+    handle->job = job;
+    job->is_save = 1;
+    job->data = Vec_as_mut_ptr(&job->saved);
+    job->len = Vec_len(&job->saved);
+    start_job(L, handle);
+
+    return 1;
+}
+
+/* waits for a job that is still running, since the worker uses it */
+int l_IOHandle_meta_gc(lua_State *L) {
+    IOHandle *handle;
+
+    assert(L);
+
+    handle = (IOHandle*) luaL_checkudata(L, 1, "larr.IOHandle");
+
+    if (handle->job) {
+        IOJob *const job = handle->job;
+
+        pthread_mutex_lock(&job->mutex);
+
+        while (!job->done) {
+            pthread_cond_wait(&job->cond, &job->mutex);
+        }
+
+        pthread_mutex_unlock(&job->mutex);
+
+        if (!job->is_save) {
+            free(job->data);
+        }
+
+        delete_job(job);
+        handle->job = NULL;
+    }
+
+    return 0;
+}
+
+int l_IOHandle_ready(lua_State *L) {
+    IOHandle *handle;
+    int done;
+
+    assert(L);
+
+    handle = check_handle(L, 1);
+
+    if (!handle->job) {
+        lua_pushboolean(L, 1);
+
+        return 1;
+    }
+
+    pthread_mutex_lock(&handle->job->mutex);
+    done = handle->job->done;
+    pthread_mutex_unlock(&handle->job->mutex);
+
+    lua_pushboolean(L, done);
+
+    return 1;
+}
+
+int l_IOHandle_wait(lua_State *L) {
+    IOHandle *handle;
+
+    assert(L);
+
+    handle = check_handle(L, 1);
+
+    if (handle->job) {
+        pthread_mutex_lock(&handle->job->mutex);
+
+        while (!handle->job->done) {
+            pthread_cond_wait(&handle->job->cond, &handle->job->mutex);
+        }
+
+        pthread_mutex_unlock(&handle->job->mutex);
+    }
+
+    return finish(L, handle);
+}
+
+int l_IOHandle_poll(lua_State *L) {
+    IOHandle *handle;
+    int done;
+
+    assert(L);
+
+    handle = check_handle(L, 1);
+
+    if (!handle->job) {
+        return finish(L, handle);
+    }
+
+    pthread_mutex_lock(&handle->job->mutex);
+    done = handle->job->done;
+    pthread_mutex_unlock(&handle->job->mutex);
+
+    if (!done) {
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    return finish(L, handle);
+}
+
+static int file_type_of(int type) {
+    switch (type) {
+        case TP_NUM: return FILE_TYPE_NUMBER;
+        case TP_INT: return FILE_TYPE_INTEGER;
+        case TP_BOOL: return FILE_TYPE_BOOLEAN;
+        default: return 0;
+    }
+}
+
+static IOJob* new_job(lua_State *L, const char *path, int type) {
+    IOJob *job;
+    char *path_copy;
+
+    assert(L);
+    assert(path);
+
+    job = (IOJob*) malloc(sizeof(IOJob));
+    path_copy = (char*) malloc(strlen(path) + 1);
+
+    if (!job || !path_copy) {
+        free(job);
+        free(path_copy);
+        luaL_error(L, "out of memory");
+    }
+
+    strcpy(path_copy, path);
+    job->path = path_copy;
+
+    if (pthread_mutex_init(&job->mutex, NULL) != 0) {
+        free(job->path);
+        free(job);
+        luaL_error(L, "couldn't create a mutex");
+    } else if (pthread_cond_init(&job->cond, NULL) != 0) {
+        pthread_mutex_destroy(&job->mutex);
+        free(job->path);
+        free(job);
+        luaL_error(L, "couldn't create a condition variable");
+    }
+
+    job->done = 0;
+    job->error = NULL;
+    job->error_no = 0;
+    job->is_save = 0;
+    job->type = type;
+    job->file_type = file_type_of(type);
+    job->element_size = sizeof_type_repr(type);
+    job->data = NULL;
+    job->len = 0;
+    Vec_new(&job->saved, job->element_size);
+    job->saved_storage = NULL;
+
+    return job;
+}
+
+/* the worker must be done with the job, or never have started */
+static void delete_job(IOJob *job) {
+    assert(job);
+
+    Storage_release(&job->saved, &job->saved_storage);
+    pthread_cond_destroy(&job->cond);
+    pthread_mutex_destroy(&job->mutex);
+    free(job->path);
+    free(job);
+}
+
+/* the job is attached afterwards, so a failure to create it leaks nothing */
+static IOHandle* push_handle(lua_State *L) {
+    IOHandle *handle;
+
+    assert(L);
+
+    handle = (IOHandle*) lua_newuserdata(L, sizeof(IOHandle));
+    handle->job = NULL;
+    luaL_setmetatable(L, "larr.IOHandle");
+
+    return handle;
+}
+
+/* a job whose thread can't start is marked as failed, not raised */
+static void start_job(lua_State *L, IOHandle *handle) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    assert(L);
+    assert(handle);
+    assert(handle->job);
+
+    ret = pthread_attr_init(&attr);
+
+    if (ret == 0) {
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&thread, &attr, run_job, handle->job);
+        pthread_attr_destroy(&attr);
+    }
+
+    if (ret != 0) {
+        handle->job->error = "couldn't start a worker thread";
+        handle->job->error_no = ret;
+        handle->job->done = 1;
+    }
+}
+
+static void* run_job(void *arg) {
+    IOJob *const job = (IOJob*) arg;
+
+    assert(job);
+
+    if (job->is_save) {
+        save_file(job);
+    } else {
+        load_file(job);
+    }
+
+    pthread_mutex_lock(&job->mutex);
+    job->done = 1;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->mutex);
+
+    return NULL;
+}
+
+static void load_file(IOJob *job) {
+    unsigned char header[FILE_HEADER_SIZE];
+    FILE *file;
+    size_t len;
+    size_t size;
+    size_t offset;
+    int i;
+
+    assert(job);
+
+    file = fopen(job->path, "rb");
+
+    if (!file) {
+        job->error = "couldn't open the file";
+        job->error_no = errno;
+
+        return;
+    }
+
+    if (fread(header, 1, FILE_HEADER_SIZE, file) != FILE_HEADER_SIZE
+        || memcmp(header, "LARR", 4) != 0 || header[4] != FILE_VERSION) {
+        job->error = "not a larr Vec file";
+        fclose(file);
+
+        return;
+    } else if (header[5] != job->file_type) {
+        job->error = "the file holds a different element type";
+        fclose(file);
+
+        return;
+    } else if (header[6] != job->element_size || header[7] != is_little_endian()) {
+        job->error = "the file was written with a different element size or byte order";
+        fclose(file);
+
+        return;
+    }
+
+    len = 0;
+
+    for (i = FILE_HEADER_SIZE - 1; i >= 8; --i) {
+        if (len > ((size_t) -1 >> 8)) {
+            len = (size_t) -1;
+
+            break;
+        }
+
+        len = (len << 8) | header[i];
+    }
+
+    if (len > (size_t) -1 / job->element_size) {
+        job->error = "the file is too large";
+        fclose(file);
+
+        return;
+    }
+
+    size = len * job->element_size;
+    job->data = malloc((size > 0) ? size : 1);
+
+    if (!job->data) {
+        job->error = "out of memory";
+        fclose(file);
+
+        return;
+    }
+
+    for (offset = 0; offset < size; ) {
+        const size_t chunk = (size - offset < IO_CHUNK) ? size - offset : IO_CHUNK;
+        const size_t read = fread((char*) job->data + offset, 1, chunk, file);
+
+        offset += read;
+
+        if (read != chunk) {
+            job->error = ferror(file) ? "couldn't read the file" : "the file is truncated";
+            job->error_no = ferror(file) ? errno : 0;
+            free(job->data);
+            job->data = NULL;
+            fclose(file);
+
+            return;
+        }
+    }
+
+    fclose(file);
+    job->len = len;
+}
+
+static void save_file(IOJob *job) {
+    unsigned char header[FILE_HEADER_SIZE];
+    FILE *file;
+    size_t size;
+    size_t offset;
+    size_t len;
+    int i;
+
+    assert(job);
+
+    memcpy(header, "LARR", 4);
+    header[4] = FILE_VERSION;
+    header[5] = (unsigned char) job->file_type;
+    header[6] = (unsigned char) job->element_size;
+    header[7] = (unsigned char) is_little_endian();
+
+    for (i = 8, len = job->len; i < FILE_HEADER_SIZE; ++i) {
+        header[i] = (unsigned char) (len & 0xff);
+        len >>= 8;
+    }
+
+    file = fopen(job->path, "wb");
+
+    if (!file) {
+        job->error = "couldn't open the file";
+        job->error_no = errno;
+
+        return;
+    } else if (fwrite(header, 1, FILE_HEADER_SIZE, file) != FILE_HEADER_SIZE) {
+        job->error = "couldn't write the file";
+        job->error_no = errno;
+        fclose(file);
+
+        return;
+    }
+
+    size = job->len * job->element_size;
+
+    for (offset = 0; offset < size; offset += IO_CHUNK) {
+        const size_t chunk = (size - offset < IO_CHUNK) ? size - offset : IO_CHUNK;
+
+        if (fwrite((const char*) job->data + offset, 1, chunk, file) != chunk) {
+            job->error = "couldn't write the file";
+            job->error_no = errno;
+            fclose(file);
+
+            return;
+        }
+    }
+
+    if (fclose(file) != 0) {
+        job->error = "couldn't write the file";
+        job->error_no = errno;
+    }
+}
+
+static int is_little_endian(void) {
+    const unsigned int one = 1;
+
+    return *(const unsigned char*) &one == 1;
+}
+
+static IOHandle* check_handle(lua_State *L, int arg) {
+    assert(L);
+
+    return (IOHandle*) luaL_checkudata(L, arg, "larr.IOHandle");
+}
+
+/*
+ *  Pushes the result of a finished job: the loaded Vec, which takes
+ *  over the job's buffer and is kept in the uservalue for later calls,
+ *  or true for a save. A failed job raises its error every time.
+ */
+static int finish(lua_State *L, IOHandle *handle) {
+    IOJob *job;
+
+    assert(L);
+    assert(handle);
+
+    job = handle->job;
+
+    if (job && job->error) {
+        if (job->error_no != 0) {
+            return luaL_error(L, "%s: %s (%s)", job->path, job->error, strerror(job->error_no));
+        }
+
+        return luaL_error(L, "%s: %s", job->path, job->error);
+    } else if (job && job->is_save) {
+        /* the worker is done, so the saved buffer can go */
+        Storage_release(&job->saved, &job->saved_storage);
+        job->data = NULL;
+        lua_pushboolean(L, 1);
+
+        return 1;
+    } else if (job) {
+        TypeVec *tv;
+
+        tv = new_tv(L, typeinfo_of(job->type), 0);
+        Vec_delete(&tv->vec);
+        tv->vec.data = job->data;
+        tv->vec.len = job->len;
+        tv->vec.capacity = job->len;
+
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, 1);
+        delete_job(job);
+        handle->job = NULL;
+
+        return 1;
+    }
+
+    lua_getuservalue(L, 1);
+
+    return 1;
+}
@@ -0,0 +1,121 @@
+#include "kernels.h"
+
+#include <assert.h>
+
+/*
+ *  Scalar kernels and runtime dispatch. The x86 kernels live in their
+ *  own translation units so that only they are compiled with wider ISA
+ *  flags; nothing in them runs unless the CPU reported the feature.
+ */
+
+static lua_Number scalar_num_sum(const lua_Number *x, size_t len);
+
+static lua_Number scalar_num_dot(const lua_Number *x, const lua_Number *y, size_t len);
+
+static void scalar_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len);
+
+static const Kernels scalar_kernels = {
+    "scalar", scalar_num_sum, scalar_num_dot, scalar_num_axpy
+};
+
+#ifdef LARR_X86_KERNELS
+static const Kernels sse2_kernels = { "sse2", sse2_num_sum, sse2_num_dot, sse2_num_axpy };
+
+static const Kernels avx2_kernels = { "avx2", avx2_num_sum, avx2_num_dot, avx2_num_axpy };
+
+static const Kernels avx512_kernels = {
+    "avx512", avx512_num_sum, avx512_num_dot, avx512_num_axpy
+};
+#endif
+
+/* NULL until kernels_init publishes its choice; the tables are never written */
+static const Kernels *volatile selected = NULL;
+
+void kernels_init(void) {
+    const Kernels *choice = &scalar_kernels;
+
+    if (selected) {
+        return;
+    }
+
+#if defined(LARR_X86_KERNELS) && defined(__GNUC__)
+    /* the vector kernels assume lua_Number is a double */
+    if (sizeof(lua_Number) == sizeof(double)) {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f")) {
+            choice = &avx512_kernels;
+        } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            choice = &avx2_kernels;
+        } else if (__builtin_cpu_supports("sse2")) {
+            choice = &sse2_kernels;
+        }
+    }
+#endif
+
+    /* lua_States opened on several threads at once all pick the same table */
+    __sync_bool_compare_and_swap(&selected, (const Kernels*) NULL, choice);
+}
+
+const Kernels* get_kernels(void) {
+    const Kernels *const kernels = selected;
+
+    return kernels ? kernels : &scalar_kernels;
+}
+
+/* four accumulators break the add dependency chain, as in gemv */
+static lua_Number scalar_num_sum(const lua_Number *x, size_t len) {
+    lua_Number acc0 = 0;
+    lua_Number acc1 = 0;
+    lua_Number acc2 = 0;
+    lua_Number acc3 = 0;
+    size_t i;
+
+    assert(x || len == 0);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        acc0 += x[i];
+        acc1 += x[i + 1];
+        acc2 += x[i + 2];
+        acc3 += x[i + 3];
+    }
+
+    for (; i < len; ++i) {
+        acc0 += x[i];
+    }
+
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+static lua_Number scalar_num_dot(const lua_Number *x, const lua_Number *y, size_t len) {
+    lua_Number acc0 = 0;
+    lua_Number acc1 = 0;
+    lua_Number acc2 = 0;
+    lua_Number acc3 = 0;
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        acc0 += x[i] * y[i];
+        acc1 += x[i + 1] * y[i + 1];
+        acc2 += x[i + 2] * y[i + 2];
+        acc3 += x[i + 3] * y[i + 3];
+    }
+
+    for (; i < len; ++i) {
+        acc0 += x[i] * y[i];
+    }
+
+    return (acc0 + acc1) + (acc2 + acc3);
+}
+
+static void scalar_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len) {
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i < len; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
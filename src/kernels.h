@@ -0,0 +1,55 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+
+#include <lua.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Hot loops over Vec<number> buffers, with one implementation per
+ *  instruction set. kernels_init picks the widest set that both the
+ *  build and the running CPU support; until then, and on builds without
+ *  the x86 kernels, the scalar versions are used. Wider kernels sum in
+ *  a different order, so results may differ in the last bits between
+ *  hosts.
+ */
+typedef struct Kernels {
+    const char *isa; /* "scalar", "sse2", "avx2" or "avx512" */
+    lua_Number (*num_sum)(const lua_Number *x, size_t len);
+    lua_Number (*num_dot)(const lua_Number *x, const lua_Number *y, size_t len);
+    void (*num_axpy)(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len);
+} Kernels;
+
+/**
+ *  Detects the CPU's features and selects the kernels. Called from
+ *  luaopen_liblarr; only the first call has any effect, and it is safe
+ *  to call from several threads at once.
+ */
+void kernels_init(void);
+
+/** @returns The selected kernels. Never NULL. */
+const Kernels* get_kernels(void);
+
+#ifdef LARR_X86_KERNELS
+lua_Number sse2_num_sum(const lua_Number *x, size_t len);
+lua_Number sse2_num_dot(const lua_Number *x, const lua_Number *y, size_t len);
+void sse2_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len);
+
+lua_Number avx2_num_sum(const lua_Number *x, size_t len);
+lua_Number avx2_num_dot(const lua_Number *x, const lua_Number *y, size_t len);
+void avx2_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len);
+
+lua_Number avx512_num_sum(const lua_Number *x, size_t len);
+lua_Number avx512_num_dot(const lua_Number *x, const lua_Number *y, size_t len);
+void avx512_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len);
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
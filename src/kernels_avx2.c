@@ -0,0 +1,79 @@
+#include "kernels.h"
+
+#include <assert.h>
+
+#include <immintrin.h>
+
+/*
+ *  AVX2 + FMA kernels, four doubles per register. This file is built
+ *  with -mavx2 -mfma and is only called once kernels_init has seen both
+ *  features.
+ */
+
+static lua_Number hsum(__m256d v) {
+    const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    double lanes[2];
+
+    _mm_storeu_pd(lanes, pair);
+
+    return lanes[0] + lanes[1];
+}
+
+lua_Number avx2_num_sum(const lua_Number *x, size_t len) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    lua_Number sum;
+    size_t i;
+
+    assert(x || len == 0);
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+    }
+
+    sum = hsum(_mm256_add_pd(acc0, acc1));
+
+    for (; i < len; ++i) {
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+lua_Number avx2_num_dot(const lua_Number *x, const lua_Number *y, size_t len) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    lua_Number sum;
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), acc1);
+    }
+
+    sum = hsum(_mm256_add_pd(acc0, acc1));
+
+    for (; i < len; ++i) {
+        sum += x[i] * y[i];
+    }
+
+    return sum;
+}
+
+void avx2_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len) {
+    const __m256d a = _mm256_set1_pd(alpha);
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+
+    for (; i < len; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
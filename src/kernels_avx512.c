@@ -0,0 +1,74 @@
+#include "kernels.h"
+
+#include <assert.h>
+
+#include <immintrin.h>
+
+/*
+ *  AVX-512F kernels, eight doubles per register. This file is built
+ *  with -mavx512f and is only called once kernels_init has seen the
+ *  feature. Tails are handled with masked loads instead of a scalar
+ *  loop.
+ */
+
+static __mmask8 tail_mask(size_t n) {
+    return (__mmask8) ((1u << n) - 1);
+}
+
+lua_Number avx512_num_sum(const lua_Number *x, size_t len) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    size_t i;
+
+    assert(x || len == 0);
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        acc0 = _mm512_add_pd(acc0, _mm512_loadu_pd(x + i));
+        acc1 = _mm512_add_pd(acc1, _mm512_loadu_pd(x + i + 8));
+    }
+
+    for (; i < len; i += 8) {
+        const __mmask8 mask = (len - i < 8) ? tail_mask(len - i) : (__mmask8) 0xff;
+
+        acc0 = _mm512_add_pd(acc0, _mm512_maskz_loadu_pd(mask, x + i));
+    }
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+}
+
+lua_Number avx512_num_dot(const lua_Number *x, const lua_Number *y, size_t len) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8), acc1);
+    }
+
+    for (; i < len; i += 8) {
+        const __mmask8 mask = (len - i < 8) ? tail_mask(len - i) : (__mmask8) 0xff;
+
+        acc0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, x + i),
+                               _mm512_maskz_loadu_pd(mask, y + i), acc0);
+    }
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+}
+
+void avx512_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len) {
+    const __m512d a = _mm512_set1_pd(alpha);
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i < len; i += 8) {
+        const __mmask8 mask = (len - i < 8) ? tail_mask(len - i) : (__mmask8) 0xff;
+        const __m512d result = _mm512_fmadd_pd(a, _mm512_maskz_loadu_pd(mask, x + i),
+                                               _mm512_maskz_loadu_pd(mask, y + i));
+
+        _mm512_mask_storeu_pd(y + i, mask, result);
+    }
+}
@@ -0,0 +1,73 @@
+#include "kernels.h"
+
+#include <assert.h>
+
+#include <emmintrin.h>
+
+/*
+ *  SSE2 kernels, two doubles per register. Compiled with the baseline
+ *  x86-64 flags, since SSE2 is part of the architecture.
+ */
+
+lua_Number sse2_num_sum(const lua_Number *x, size_t len) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    double lanes[2];
+    lua_Number sum;
+    size_t i;
+
+    assert(x || len == 0);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+    }
+
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+
+    for (; i < len; ++i) {
+        sum += x[i];
+    }
+
+    return sum;
+}
+
+lua_Number sse2_num_dot(const lua_Number *x, const lua_Number *y, size_t len) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    double lanes[2];
+    lua_Number sum;
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+
+    for (; i < len; ++i) {
+        sum += x[i] * y[i];
+    }
+
+    return sum;
+}
+
+void sse2_num_axpy(lua_Number alpha, const lua_Number *x, lua_Number *y, size_t len) {
+    const __m128d a = _mm_set1_pd(alpha);
+    size_t i;
+
+    assert((x && y) || len == 0);
+
+    for (i = 0; i + 2 <= len; i += 2) {
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(a, _mm_loadu_pd(x + i))));
+    }
+
+    for (; i < len; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
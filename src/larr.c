@@ -1,5 +1,7 @@
 #include <larr/larr.h>
 
+#include "kernels.h"
+#include "slice.h"
 #include "util.h"
 #include "vec.h"
 
@@ -21,21 +23,11 @@ extern "C" {
 
 int l_Vec_new(lua_State *L) {
     Typeinfo typeinfo;
-    TypeVec *tv;
 
     assert(L);
 
     typeinfo = check_typeinfo(L, -1);
-
-    tv = (TypeVec*) lua_newuserdata(L, sizeof(TypeVec));
-
-    Vec_new(&tv->vec, sizeof_type_repr(typeinfo.type));
-    tv->typeinfo = typeinfo;
-    tv->vtbl = get_vtbl(typeinfo.type);
-
-    luaL_setmetatable(L, "larr.Vec");
-    /*lua_pushvalue(L, -1);
-    lua_setfield(L, -2, "__index");*/
+    new_tv(L, typeinfo, 0);
 
     return 1;
 }
@@ -43,24 +35,13 @@ int l_Vec_new(lua_State *L) {
 int l_Vec_with_capacity(lua_State *L) {
     Typeinfo typeinfo;
     size_t capacity;
-    TypeVec *tv;
 
     assert(L);
 
     typeinfo = check_typeinfo(L, -2);
     capacity = check_size_t(L, -1);
 
-    tv = (TypeVec*) lua_newuserdata(L, sizeof(TypeVec));
-
-    if (Vec_with_capacity(&tv->vec, sizeof_type_repr(typeinfo.type),
-                          (size_t) capacity) != LARR_OK) {
-        return luaL_error(L, "couldn't allocate space for %ld elements", (long) capacity);
-    }
-
-    tv->typeinfo = typeinfo;
-    tv->vtbl = get_vtbl(typeinfo.type);
-
-    luaL_setmetatable(L, "larr.Vec");
+    new_tv(L, typeinfo, capacity);
 
     return 1;
 }
@@ -70,10 +51,14 @@ int l_Vec_meta_gc(lua_State *L) {
 
     assert(L);
 
-    tv = check_tv_mut(L, -1);
+    /* not check_tv_mut, which would copy a shared buffer just to free it */
+    tv = (TypeVec*) luaL_checkudata(L, -1, "larr.Vec");
 
-    tv->vtbl->clear(tv, L);
-    Vec_delete(&tv->vec);
+    if (!tv->storage) {
+        tv->vtbl->clear(tv, L);
+    }
+
+    Storage_release(&tv->vec, &tv->storage);
 
     return 0;
 }
@@ -231,7 +216,14 @@ int l_Vec_clear(lua_State *L) {
 
     assert(L);
 
-    tv = check_tv_mut(L, -1);
+    tv = (TypeVec*) luaL_checkudata(L, -1, "larr.Vec");
+
+    if (tv->storage && !tv->storage->writable) {
+        /* nothing to copy, just stop sharing */
+        Storage_release(&tv->vec, &tv->storage);
+
+        return 0;
+    }
 
     tv->vtbl->clear(tv, L);
     Vec_clear(&tv->vec);
@@ -239,6 +231,28 @@ int l_Vec_clear(lua_State *L) {
     return 0;
 }
 
+int l_Vec_clone(lua_State *L) {
+    TypeVec *tv;
+    TypeVec *clone;
+
+    assert(L);
+
+    tv = (TypeVec*) luaL_checkudata(L, 1, "larr.Vec");
+    lua_settop(L, 1);
+
+    clone = new_tv(L, tv->typeinfo, 0);
+    Vec_delete(&clone->vec);
+
+    if (Storage_clone(&tv->vec, &tv->storage, &clone->vec, &clone->storage) != LARR_OK) {
+        return luaL_error(L, "out of memory");
+    }
+
+    return 1;
+}
+
+/* elements are converted this many at a time, bounding the stack used */
+#define TOSTRING_CHUNK 64
+
 int l_Vec_meta_tostring(lua_State *L) {
     const TypeVec *tv;
 
@@ -249,21 +263,48 @@ int l_Vec_meta_tostring(lua_State *L) {
     if (Vec_is_empty(&tv->vec)) {
         lua_pushliteral(L, "{}");
     } else {
-        size_t i;
-        int first = 1;
+        const size_t len = Vec_len(&tv->vec);
+        size_t start;
+        int base;
 
         luaL_Buffer buf;
         luaL_buffinit(L, &buf);
         luaL_addchar(&buf, '{');
 
-        for (i = 0; i < Vec_len(&tv->vec); ++i) {
-            if (!first) {
+        /*
+         *  each chunk is pushed in one call, converted and joined on the
+         *  stack, then added to the buffer as a single string
+         */
+        for (start = 0; start < len; start += TOSTRING_CHUNK) {
+            const int count = (len - start < TOSTRING_CHUNK) ? (int) (len - start)
+                                                             : TOSTRING_CHUNK;
+            int i;
+
+            if (start > 0) {
                 luaL_addlstring(&buf, ", ", 2);
-            } else {
-                first = 0;
             }
 
-            tv->vtbl->push_elem(tv, i, L);
+            /* buffer operations may move the top, so take it anew */
+            base = lua_gettop(L);
+            luaL_checkstack(L, 2 * TOSTRING_CHUNK, "too many elements to convert");
+            tv->vtbl->push_range_to_stack(tv, start, (size_t) count, L);
+
+            for (i = count; i >= 1; --i) {
+                const int index = base + i;
+
+                /* lua_concat converts numbers itself */
+                if (lua_type(L, index) != LUA_TNUMBER) {
+                    luaL_tolstring(L, index, NULL);
+                    lua_replace(L, index);
+                }
+
+                if (i < count) {
+                    lua_pushliteral(L, ", ");
+                    lua_insert(L, index + 1);
+                }
+            }
+
+            lua_concat(L, 2 * count - 1);
             luaL_addvalue(&buf);
         }
 
@@ -278,6 +319,8 @@ static int append_vec_or_table(TypeVec *tv, lua_State *L);
 
 static int append_iterator(TypeVec *tv, lua_State *L);
 
+static void find_builtin_iterators(lua_State *L);
+
 int l_Vec_append(lua_State *L) {
     TypeVec *tv;
     int num_args;
@@ -294,10 +337,119 @@ int l_Vec_append(lua_State *L) {
     }
 }
 
+/*
+ *  Resumes the coroutine until it finishes, appending every value it
+ *  yields or returns; a producer may yield many values at once. With a
+ *  batch size, stops after the first resume that brings the number of
+ *  appended elements to at least that many. Returns the number of
+ *  elements appended. If the coroutine raises an error or produces a
+ *  value of the wrong type, the elements appended by this call are
+ *  removed and the error is raised again. The coroutine may use the Vec
+ *  itself, so it is looked up again after every resume.
+ */
+int l_Vec_extend_from_coroutine(lua_State *L) {
+    TypeVec *tv;
+    lua_State *co;
+    size_t init_len;
+    size_t batch;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+    luaL_checktype(L, 2, LUA_TTHREAD);
+    co = lua_tothread(L, 2);
+
+    if (lua_isnoneornil(L, 3)) {
+        batch = (size_t) -1;
+    } else {
+        batch = check_size_t(L, 3);
+        luaL_argcheck(L, batch > 0, 3, "batch size must be positive");
+    }
+
+    lua_settop(L, 2);
+    init_len = Vec_len(&tv->vec);
+
+    while (Vec_len(&tv->vec) - init_len < batch) {
+        lua_Debug ar;
+        int status;
+        int num_results;
+        int i;
+
+        status = lua_status(co);
+
+        if (status == LUA_OK && lua_gettop(co) == 0) {
+            break; /* dead */
+        } else if (co == L || (status == LUA_OK && lua_getstack(co, 0, &ar))) {
+            return luaL_error(L, "cannot resume non-suspended coroutine");
+        } else if (status != LUA_OK && status != LUA_YIELD) {
+            return luaL_error(L, "cannot resume dead coroutine");
+        }
+
+        status = lua_resume(co, L, 0);
+
+        /* the coroutine may have cloned, shrunk or cleared the Vec meanwhile */
+        tv = check_tv_mut(L, 1);
+
+        if (init_len > Vec_len(&tv->vec)) {
+            init_len = Vec_len(&tv->vec);
+        }
+
+        if (status != LUA_OK && status != LUA_YIELD) {
+            tv->vtbl->truncate(tv, init_len, L);
+            lua_xmove(co, L, 1);
+
+            return lua_error(L);
+        }
+
+        num_results = lua_gettop(co);
+        luaL_checkstack(L, num_results + 1, "too many results to append");
+        lua_xmove(co, L, num_results);
+
+        for (i = 1; i <= num_results; ++i) {
+            int res;
+
+            lua_pushvalue(L, 2 + i);
+            res = tv->vtbl->try_push(tv, L);
+
+            if (res != PE_OK) {
+                const char *const self_type = tv->typeinfo.name.str;
+                const char *const name = luaL_typename(L, -1);
+
+                tv->vtbl->truncate(tv, init_len, L);
+
+                if (res == PE_NO_MEMORY) {
+                    return luaL_error(L, "out of memory");
+                }
+
+                return luaL_error(L, "bad coroutine value (expected %s, got %s)", self_type,
+                                  name);
+            }
+
+            lua_pop(L, 1);
+        }
+
+        lua_settop(L, 2);
+
+        if (status == LUA_OK) {
+            break;
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer) (Vec_len(&tv->vec) - init_len));
+
+    return 1;
+}
+
 int luaopen_liblarr(lua_State *L) {
     static const luaL_Reg funcs[] = {
         { "new", l_Vec_new },
         { "with_capacity", l_Vec_with_capacity },
+        { "zeros", l_Vec_zeros },
+        { "filled", l_Vec_filled },
+        { "range", l_Vec_range },
+        { "linspace", l_Vec_linspace },
+        { "from_string", l_Vec_from_string },
+        { "resize", l_Vec_resize },
         { "__gc", l_Vec_meta_gc },
         { "capacity", l_Vec_capacity },
         { "__len", l_Vec_meta_len },
@@ -311,13 +463,166 @@ int luaopen_liblarr(lua_State *L) {
         { "insert", l_Vec_insert },
         { "remove", l_Vec_remove },
         { "clear", l_Vec_clear },
+        { "clone", l_Vec_clone },
         { "__tostring", l_Vec_meta_tostring },
         { "append", l_Vec_append },
+        { "extend_from_coroutine", l_Vec_extend_from_coroutine },
+        { "map", l_Vec_map },
+        { "filter", l_Vec_filter },
+        { "reduce", l_Vec_reduce },
+        { "foreach", l_Vec_foreach },
+        { "cumsum", l_Vec_cumsum },
+        { "cumprod", l_Vec_cumprod },
+        { "cummin", l_Vec_cummin },
+        { "cummax", l_Vec_cummax },
+        { "exclusive_cumsum", l_Vec_exclusive_cumsum },
+        { "diff", l_Vec_diff },
+        { "bincount", l_Vec_bincount },
+        { "histogram", l_Vec_histogram },
+        { "unique", l_Vec_unique },
+        { "value_counts", l_Vec_value_counts },
+        { "take", l_Vec_take },
+        { "put", l_Vec_put },
+        { "select", l_Vec_select },
+        { "where", l_Vec_where },
+        { "compress", l_Vec_compress },
+        { "fill_random", l_Vec_fill_random },
+        { "shuffle", l_Vec_shuffle },
+        { "sample", l_Vec_sample },
+        { "cast", l_Vec_cast },
+        { "cast_inplace", l_Vec_cast_inplace },
+        { "sum", l_Vec_sum },
+        { "dot", l_Vec_dot },
+        { "save_async", l_Vec_save_async },
+        { "shared", l_Vec_shared },
+        { "attach", l_Vec_attach },
+        { "unlink", l_Vec_unlink },
+        { "publish", l_Vec_publish },
+        { "generation", l_Vec_generation },
+        { "share", l_Vec_share },
+        { "from_shared", l_Vec_from_shared },
+        { "discard_shared", l_Vec_discard_shared },
+        { "open_log", l_Vec_open_log },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg expr_funcs[] = {
+        { "__add", l_Expr_meta_add },
+        { "__sub", l_Expr_meta_sub },
+        { "__mul", l_Expr_meta_mul },
+        { "__div", l_Expr_meta_div },
+        { "__unm", l_Expr_meta_unm },
+        { "eval", l_Expr_eval },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg columns_funcs[] = {
+        { "__len", l_Columns_meta_len },
+        { "__index", l_Columns_meta_index },
+        { "fields", l_Columns_fields },
+        { "column", l_Columns_column },
+        { "push", l_Columns_push },
+        { "row", l_Columns_row },
+        { "get", l_Columns_get },
+        { "set", l_Columns_set },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg ndarray_funcs[] = {
+        { "__len", l_NDArray_meta_len },
+        { "ndim", l_NDArray_ndim },
+        { "shape", l_NDArray_shape },
+        { "strides", l_NDArray_strides },
+        { "vec", l_NDArray_vec },
+        { "get", l_NDArray_get },
+        { "set", l_NDArray_set },
+        { "reshape", l_NDArray_reshape },
+        { "transpose", l_NDArray_transpose },
+        { "slice", l_NDArray_slice },
+        { "broadcast_to", l_NDArray_broadcast_to },
+        { "to_vec", l_NDArray_to_vec },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg packed_funcs[] = {
+        { "__gc", l_PackedVec_meta_gc },
+        { "__len", l_PackedVec_meta_len },
+        { "__index", l_PackedVec_meta_index },
+        { "__tostring", l_PackedVec_meta_tostring },
+        { "get", l_PackedVec_get },
+        { "decompress", l_PackedVec_decompress },
+        { "sum", l_PackedVec_sum },
+        { "min", l_PackedVec_min },
+        { "max", l_PackedVec_max },
+        { "codec", l_PackedVec_codec },
+        { "nbytes", l_PackedVec_nbytes },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg sparse_funcs[] = {
+        { "__len", l_SparseVec_meta_len },
+        { "__tostring", l_SparseVec_meta_tostring },
+        { "nnz", l_SparseVec_nnz },
+        { "get", l_SparseVec_get },
+        { "set", l_SparseVec_set },
+        { "indices", l_SparseVec_indices },
+        { "values", l_SparseVec_values },
+        { "to_dense", l_SparseVec_to_dense },
+        { "from_dense", l_SparseVec_from_dense },
+        { "dot", l_SparseVec_dot },
+        { "axpy", l_SparseVec_axpy },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg heap_funcs[] = {
+        { "__len", l_Heap_meta_len },
+        { "is_empty", l_Heap_is_empty },
+        { "push", l_Heap_push },
+        { "top", l_Heap_top },
+        { "pop", l_Heap_pop },
+        { "replace", l_Heap_replace },
+        { "heapify", l_Heap_heapify },
+        { "clear", l_Heap_clear },
+        { "keys", l_Heap_keys },
+        { "payloads", l_Heap_payloads },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg append_buffer_funcs[] = {
+        { "__gc", l_AppendBuffer_meta_gc },
+        { "push", l_AppendBuffer_push },
+        { "drain_into", l_AppendBuffer_drain_into },
+        { "seal", l_AppendBuffer_seal },
+        { "is_sealed", l_AppendBuffer_is_sealed },
+        { "dropped", l_AppendBuffer_dropped },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg vec_log_funcs[] = {
+        { "__gc", l_VecLog_meta_gc },
+        { "__len", l_VecLog_meta_len },
+        { "push", l_VecLog_push },
+        { "append", l_VecLog_append },
+        { "vec", l_VecLog_vec },
+        { "flush", l_VecLog_flush },
+        { "sync", l_VecLog_sync },
+        { "close", l_VecLog_close },
+        { NULL, NULL }
+    };
+
+    static const luaL_Reg io_handle_funcs[] = {
+        { "__gc", l_IOHandle_meta_gc },
+        { "ready", l_IOHandle_ready },
+        { "wait", l_IOHandle_wait },
+        { "poll", l_IOHandle_poll },
         { NULL, NULL }
     };
 
     assert(L);
 
+    kernels_init();
+    find_builtin_iterators(L);
+
     lua_newtable(L);
 
     luaL_newmetatable(L, "larr.Vec");
@@ -325,12 +630,101 @@ int luaopen_liblarr(lua_State *L) {
 
     lua_setfield(L, -2, "Vec");
 
+    luaL_newmetatable(L, "larr.Expr");
+    luaL_setfuncs(L, expr_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_Expr_new);
+    lua_setfield(L, -2, "expr");
+
+    luaL_newmetatable(L, "larr.Columns");
+    luaL_setfuncs(L, columns_funcs, 0);
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_Columns_new);
+    lua_setfield(L, -2, "Columns");
+
+    luaL_newmetatable(L, "larr.NDArray");
+    luaL_setfuncs(L, ndarray_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_NDArray_new);
+    lua_setfield(L, -2, "NDArray");
+
+    luaL_newmetatable(L, "larr.PackedVec");
+    luaL_setfuncs(L, packed_funcs, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "larr.SparseVec");
+    luaL_setfuncs(L, sparse_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_SparseVec_new);
+    lua_setfield(L, -2, "SparseVec");
+
+    luaL_newmetatable(L, "larr.Heap");
+    luaL_setfuncs(L, heap_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_Heap_new);
+    lua_setfield(L, -2, "Heap");
+
+    luaL_newmetatable(L, "larr.IOHandle");
+    luaL_setfuncs(L, io_handle_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_load_async);
+    lua_setfield(L, -2, "load_async");
+
+    luaL_newmetatable(L, "larr.AppendBuffer");
+    luaL_setfuncs(L, append_buffer_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_AppendBuffer_new);
+    lua_setfield(L, -2, "AppendBuffer");
+
+    luaL_newmetatable(L, "larr.VecLog");
+    luaL_setfuncs(L, vec_log_funcs, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, l_gemm);
+    lua_setfield(L, -2, "gemm");
+
+    lua_pushcfunction(L, l_gemv);
+    lua_setfield(L, -2, "gemv");
+
+    lua_pushcfunction(L, l_axpy);
+    lua_setfield(L, -2, "axpy");
+
+    lua_pushcfunction(L, l_simd);
+    lua_setfield(L, -2, "simd");
+
+    lua_pushcfunction(L, l_quantum);
+    lua_setfield(L, -2, "quantum");
+
+    push_cancel(L);
+    lua_setfield(L, -2, "cancel");
+
     return 1;
 }
 
 static int append_vec(TypeVec *tv, TypeVec *other, lua_State *L);
 
-static int append_table(TypeVec *tv, lua_State *L);
+static int append_table(TypeVec *tv, int arg, lua_State *L);
 
 static const char *const APPEND_ERR_FMT =
     "bad argument #2 to 'l_Vec_append' (expected larr.Vec<%s> or table, got %s)";
@@ -346,7 +740,7 @@ static int append_vec_or_table(TypeVec *tv, lua_State *L) {
     if (maybe_other) {
         return append_vec(tv, maybe_other, L);
     } else if (lua_istable(L, 2)) {
-        return append_table(tv, L);
+        return append_table(tv, 2, L);
     } else {
         const char *const self_typename = tv->typeinfo.name.str;
         const char *const typename = luaL_typename(L, 2);
@@ -357,6 +751,22 @@ static int append_vec_or_table(TypeVec *tv, lua_State *L) {
 
 static int append_iterator(TypeVec *tv, lua_State *L);
 
+static int is_ipairs_over_table(lua_State *L);
+
+static int is_next_over_table(lua_State *L);
+
+static int append_next(TypeVec *tv, lua_State *L);
+
+static int append_table_k(lua_State *L, int status, lua_KContext ctx);
+
+static int append_iterator_k(lua_State *L, int status, lua_KContext ctx);
+
+static int append_iterator_step(lua_State *L);
+
+static int append_next_k(lua_State *L, int status, lua_KContext ctx);
+
+static int cancel_append(lua_State *L, size_t init_len);
+
 static int append_vec(TypeVec *tv, TypeVec *other, lua_State *L) {
     const Typeinfo *self_type;
     const Typeinfo *other_type;
@@ -388,100 +798,287 @@ static int append_vec(TypeVec *tv, TypeVec *other, lua_State *L) {
     return 0;
 }
 
-static int append_table(TypeVec *tv, lua_State *L) {
-    size_t len;
-    lua_Integer i;
-    int type;
-
+/* ..., table, initial length, next key; ctx is the table's index */
+static int append_table(TypeVec *tv, int arg, lua_State *L) {
     assert(tv);
     assert(L);
 
-    len = Vec_len(&tv->vec);
+    lua_settop(L, arg);
+    push_size_t(L, Vec_len(&tv->vec));
+    lua_pushinteger(L, 1);
 
-    for (i = 1; (type = lua_rawgeti(L, 2, i)) != LUA_TNIL; ++i) {
-        const char *name;
-        const int res = tv->vtbl->try_push(tv, L);
+    return append_table_k(L, LUA_OK, arg);
+}
 
-        if (res != PE_OK) {
-            name = luaL_typename(L, 2);
-            tv->vtbl->truncate(tv, len, L);
-        }
+static int append_table_k(lua_State *L, int status, lua_KContext ctx) {
+    const int arg = (int) ctx;
+    TypeVec *tv;
+    size_t init_len;
+    size_t quantum;
+    lua_Integer first;
+    lua_Integer next;
+    int res;
 
-        lua_pop(L, 1);
+    assert(L);
 
-        if (res == PE_NO_MEMORY) {
-            return luaL_error(L, "out of memory");
-        } else if (res == PE_INVALID_TYPE) {
-            const char *const self_type = tv->typeinfo.name.str;
+    if (status == LUA_YIELD && slice_cancelled(L, arg + 2)) {
+        return cancel_append(L, (size_t) lua_tointeger(L, arg + 1));
+    }
 
-            return luaL_error(L, "bad table member #%d to 'l_Vec_append' (expected %s, got %s)",
-                              i, self_type, name);
-        }
+    tv = check_tv_mut(L, 1);
+    init_len = (size_t) lua_tointeger(L, arg + 1);
+    first = lua_tointeger(L, arg + 2);
+    quantum = slice_quantum(L);
+    res = tv->vtbl->push_many_from_table(tv, arg, first, (quantum > 0) ? quantum : (size_t) -1,
+                                         &next, L);
+
+    if (res == PE_OK && quantum > 0 && (size_t) (next - first) == quantum) {
+        lua_pushinteger(L, next);
+        lua_replace(L, arg + 2);
+
+        return lua_yieldk(L, 0, ctx, append_table_k);
+    } else if (res == PE_OK) {
+        return 0;
     }
 
-    return 0;
+    tv->vtbl->truncate(tv, init_len, L);
+
+    if (res == PE_NO_MEMORY) {
+        return luaL_error(L, "out of memory");
+    } else {
+        const char *const self_type = tv->typeinfo.name.str;
+        const char *name;
+
+        lua_rawgeti(L, arg, next);
+        name = luaL_typename(L, -1);
+
+        return luaL_error(L, "bad table member #%I to 'l_Vec_append' (expected %s, got %s)",
+                          next, self_type, name);
+    }
 }
 
-static int append_iterator(TypeVec *tv, lua_State *L) {
-    int pushed_nil;
-    size_t init_len;
+/* continuation contexts of append_iterator_k */
+#define AFTER_CALL 0
+#define AFTER_SLICE 1
 
+static int append_iterator(TypeVec *tv, lua_State *L) {
     assert(tv);
     assert(L);
 
-    if (lua_gettop(L) == 3) {
-        lua_pushnil(L);
-        pushed_nil = 1;
-    } else {
-        pushed_nil = 0;
+    if (lua_gettop(L) == 4 && is_ipairs_over_table(L)) {
+        return append_table(tv, 3, L);
+    } else if (lua_gettop(L) >= 3 && is_next_over_table(L)) {
+        return append_next(tv, L);
     }
-    /* Vec, function, invariant, init */
 
-    lua_pushvalue(L, 2);
-    lua_pushvalue(L, 3);
+    lua_settop(L, 4);
+    push_size_t(L, Vec_len(&tv->vec));
     lua_pushvalue(L, 4);
-    /* Vec, function, invariant, init, function, invariant, init */
+    /* Vec, function, invariant, init, initial length, control */
 
-    init_len = Vec_len(&tv->vec);
-
-    while (lua_call(L, 2, 2), !lua_isnil(L, 5)) {
-        /* Vec, function, invariant, init, next init, value */
+    return append_iterator_k(L, LUA_OK, AFTER_SLICE);
+}
 
-        const char *name;
-        const int res = tv->vtbl->try_push(tv, L);
+/*
+ *  The iterator may itself yield, so it is called with a continuation
+ *  too; either way its results are handled by append_iterator_step.
+ */
+static int append_iterator_k(lua_State *L, int status, lua_KContext ctx) {
+    size_t quantum;
+    size_t done = 0;
 
-        if (res == PE_OK) {
-            lua_pop(L, 1);
-            /* Vec, function, invariant, init, next init */
+    assert(L);
 
-            lua_pushvalue(L, 2);
-            lua_pushvalue(L, 3);
-            /* Vec, function, invariant, init, next init, function,
-               invariant */
+    if (status == LUA_YIELD && ctx == AFTER_SLICE && slice_cancelled(L, 6)) {
+        return cancel_append(L, (size_t) lua_tointeger(L, 5));
+    } else if (status == LUA_YIELD && ctx == AFTER_CALL && !append_iterator_step(L)) {
+        return 0;
+    }
 
-            lua_rotate(L, 5, 2);
-            /* Vec, function, invariant, function, invariant,
-               next init */
+    quantum = slice_quantum(L);
 
-            continue;
+    for (;;) {
+        if (quantum > 0 && done++ == quantum) {
+            return lua_yieldk(L, 0, AFTER_SLICE, append_iterator_k);
         }
 
-        name = luaL_typename(L, 6);
-        tv->vtbl->truncate(tv, init_len, L);
+        lua_pushvalue(L, 2);
+        lua_pushvalue(L, 3);
+        lua_pushvalue(L, 6);
+        lua_callk(L, 2, 2, AFTER_CALL, append_iterator_k);
 
-        if (pushed_nil) {
-            lua_pop(L, 3);
-        } else {
-            lua_pop(L, 2);
+        if (!append_iterator_step(L)) {
+            return 0;
         }
+    }
+}
+
+/*
+ *  Pushes the value the iterator returned and makes its control value
+ *  the next one. Returns 0 once the iterator is exhausted.
+ */
+static int append_iterator_step(lua_State *L) {
+    TypeVec *tv;
+    int res;
+
+    assert(L);
+
+    /* Vec, function, invariant, init, initial length, control, next control, value */
+    if (lua_isnil(L, 7)) {
+        return 0;
+    }
+
+    tv = check_tv_mut(L, 1);
+    res = tv->vtbl->try_push(tv, L);
+
+    if (res != PE_OK) {
+        const char *const self_type = tv->typeinfo.name.str;
+        const char *const name = luaL_typename(L, 8);
+
+        tv->vtbl->truncate(tv, (size_t) lua_tointeger(L, 5), L);
 
         if (res == PE_NO_MEMORY) {
             return luaL_error(L, "out of memory");
-        } else if (res == PE_INVALID_TYPE) {
+        }
+
+        return luaL_error(L, "bad iterator type (expected %s, got %s)", self_type, name);
+    }
+
+    lua_pop(L, 1);
+    lua_replace(L, 6);
+
+    return 1;
+}
+
+/* removes what an append had pushed so far, then raises the cancellation */
+static int cancel_append(lua_State *L, size_t init_len) {
+    TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+
+    if (Vec_len(&tv->vec) > init_len) {
+        tv->vtbl->truncate(tv, init_len, L);
+    }
+
+    return luaL_error(L, "operation cancelled");
+}
+
+/*
+ *  The C functions behind next and the iterator returned by ipairs,
+ *  found once when the library is loaded. append compares against them
+ *  to drain a table directly instead of calling the iterator per element.
+ *  They are the same for every state, since they live in the Lua library,
+ *  but states may load the library concurrently, so they're accessed
+ *  atomically.
+ */
+static lua_CFunction next_fn = NULL;
+
+static lua_CFunction ipairs_fn = NULL;
+
+static void find_builtin_iterators(lua_State *L) {
+    assert(L);
+
+    if (lua_getglobal(L, "next") == LUA_TFUNCTION) {
+        __atomic_store_n(&next_fn, lua_tocfunction(L, -1), __ATOMIC_RELAXED);
+    }
+
+    lua_pop(L, 1);
+
+    if (lua_getglobal(L, "ipairs") == LUA_TFUNCTION) {
+        lua_newtable(L);
+
+        if (lua_pcall(L, 1, 1, 0) == LUA_OK) {
+            __atomic_store_n(&ipairs_fn, lua_tocfunction(L, -1), __ATOMIC_RELAXED);
+        }
+    }
+
+    lua_pop(L, 1);
+}
+
+/* ipairs over a table with no metatable, so no __index can intervene */
+static int is_ipairs_over_table(lua_State *L) {
+    lua_CFunction fn;
+    int isnum;
+
+    assert(L);
+
+    fn = __atomic_load_n(&ipairs_fn, __ATOMIC_RELAXED);
+
+    if (!fn || lua_tocfunction(L, 2) != fn || !lua_istable(L, 3)) {
+        return 0;
+    } else if (lua_getmetatable(L, 3)) {
+        lua_pop(L, 1);
+
+        return 0;
+    }
+
+    return lua_tointegerx(L, 4, &isnum) == 0 && isnum;
+}
+
+/* next is raw, so any table will do as long as the traversal starts from nil */
+static int is_next_over_table(lua_State *L) {
+    lua_CFunction fn;
+
+    assert(L);
+
+    fn = __atomic_load_n(&next_fn, __ATOMIC_RELAXED);
+
+    return fn && lua_tocfunction(L, 2) == fn && lua_istable(L, 3)
+           && lua_isnoneornil(L, 4);
+}
+
+static int append_next(TypeVec *tv, lua_State *L) {
+    assert(tv);
+    assert(L);
+
+    lua_settop(L, 3);
+    push_size_t(L, Vec_len(&tv->vec));
+    lua_pushnil(L);
+    /* Vec, next, table, initial length, key */
+
+    return append_next_k(L, LUA_OK, 0);
+}
+
+static int append_next_k(lua_State *L, int status, lua_KContext ctx) {
+    TypeVec *tv;
+    size_t init_len;
+    size_t quantum;
+    size_t done = 0;
+
+    assert(L);
+    (void) ctx;
+
+    if (status == LUA_YIELD && slice_cancelled(L, 5)) {
+        return cancel_append(L, (size_t) lua_tointeger(L, 4));
+    }
+
+    tv = check_tv_mut(L, 1);
+    init_len = (size_t) lua_tointeger(L, 4);
+    quantum = slice_quantum(L);
+
+    while (lua_next(L, 3)) {
+        const int res = tv->vtbl->try_push(tv, L);
+
+        if (res != PE_OK) {
             const char *const self_type = tv->typeinfo.name.str;
+            const char *const name = luaL_typename(L, -1);
+
+            tv->vtbl->truncate(tv, init_len, L);
+
+            if (res == PE_NO_MEMORY) {
+                return luaL_error(L, "out of memory");
+            }
 
             return luaL_error(L, "bad iterator type (expected %s, got %s)", self_type, name);
         }
+
+        lua_pop(L, 1);
+
+        if (quantum > 0 && ++done == quantum) {
+            return lua_yieldk(L, 0, 0, append_next_k);
+        }
     }
 
     return 0;
@@ -0,0 +1,636 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Append-only logs of Vecs. Vec.open_log(path, type[, policy]) returns
+ *  a larr.VecLog, which keeps a Vec in its uservalue and writes every
+ *  element pushed or appended through it to the end of the file, so a
+ *  checkpoint costs only what was added since the last one.
+ *
+ *  The file starts with a FILE_HEADER_SIZE byte header like the one
+ *  that Vec:save_async writes, with the magic "LARL" and no length.
+ *  Segments follow: a SEGMENT_HEADER_SIZE byte header holding the magic
+ *  "LSEG", the element count, the CRC-32 of the elements and the CRC-32
+ *  of the header's first 12 bytes, then the elements. Elements are
+ *  buffered until policy.batch of them are pending (1024 by default),
+ *  then written as one segment with a single write().
+ *
+ *  fsync() runs once policy.sync_every elements have been written since
+ *  the last one, or on the first push policy.sync_ms milliseconds after
+ *  it, writing the pending segment early if need be. Both are off by
+ *  default. log:sync() and log:close() always flush and sync; the
+ *  finalizer only flushes.
+ *
+ *  Opening an existing log maps it, walks the segments and copies the
+ *  elements of the valid prefix into the Vec. A torn or corrupt segment
+ *  ends the prefix and is truncated away along with everything after it;
+ *  Vec.open_log returns the number of bytes dropped after the log.
+ */
+
+#define FILE_HEADER_SIZE 16
+
+#define SEGMENT_HEADER_SIZE 16
+
+#define LOG_VERSION 1
+
+#define DEFAULT_BATCH 1024
+
+/* type codes on disk, the same as Vec:save_async's */
+#define FILE_TYPE_NUMBER 1
+#define FILE_TYPE_INTEGER 2
+#define FILE_TYPE_BOOLEAN 3
+
+typedef struct VecLog {
+    int fd; /* -1 once closed */
+    char *path;
+    int file_type;
+    size_t element_size;
+    off_t file_size; /* the end of the last complete segment */
+    size_t batch;
+    size_t sync_every;
+    long sync_ms;
+    unsigned char *pending; /* a segment header, then up to batch elements */
+    size_t pending_len;
+    size_t unsynced; /* elements written since the last fsync() */
+    struct timespec last_sync;
+} VecLog;
+
+static uint32_t crc_table[256];
+
+static void init_crc_table(void);
+
+static uint32_t crc32(const unsigned char *data, size_t size);
+
+static void put_u32(unsigned char *dst, uint32_t x);
+
+static uint32_t get_u32(const unsigned char *src);
+
+static int file_type_of(int type);
+
+static int is_little_endian(void);
+
+static VecLog* check_log(lua_State *L, int arg);
+
+static void read_policy(lua_State *L, int arg, VecLog *log);
+
+static size_t recover(lua_State *L, VecLog *log, TypeVec *tv);
+
+static void log_tail(lua_State *L, VecLog *log, const TypeVec *tv, size_t from);
+
+static void flush(lua_State *L, VecLog *log);
+
+static void sync_log(lua_State *L, VecLog *log);
+
+static long ms_since(const struct timespec *then);
+
+int l_Vec_open_log(lua_State *L) {
+    const char *path;
+    Typeinfo typeinfo;
+    VecLog *log;
+    TypeVec *tv;
+    size_t dropped;
+
+    assert(L);
+
+    path = luaL_checkstring(L, 1);
+    typeinfo = check_typeinfo(L, 2);
+    luaL_argcheck(L, file_type_of(typeinfo.type) != 0, 2,
+                  "expected 'number', 'integer' or 'boolean'");
+
+    if (!lua_isnoneornil(L, 3)) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+    }
+
+    lua_settop(L, 3);
+    init_crc_table();
+
+    log = (VecLog*) lua_newuserdata(L, sizeof(VecLog));
+    memset(log, 0, sizeof(VecLog));
+    log->fd = -1;
+    luaL_setmetatable(L, "larr.VecLog");
+
+    log->file_type = file_type_of(typeinfo.type);
+    log->element_size = sizeof_type_repr(typeinfo.type);
+    log->batch = DEFAULT_BATCH;
+    read_policy(L, 3, log);
+
+    log->path = (char*) malloc(strlen(path) + 1);
+    log->pending = (unsigned char*) malloc(SEGMENT_HEADER_SIZE + log->batch * log->element_size);
+
+    if (!log->path || !log->pending) {
+        return luaL_error(L, "out of memory");
+    }
+
+    strcpy(log->path, path);
+
+    tv = new_tv(L, typeinfo_of(typeinfo.type), 0);
+    lua_setuservalue(L, 4);
+
+    log->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+
+    if (log->fd < 0) {
+        return luaL_error(L, "couldn't open log '%s': %s", path, strerror(errno));
+    }
+
+    dropped = recover(L, log, tv);
+    clock_gettime(CLOCK_MONOTONIC, &log->last_sync);
+    push_size_t(L, dropped);
+
+    return 2;
+}
+
+/* flushes, but leaves syncing to the operating system */
+int l_VecLog_meta_gc(lua_State *L) {
+    VecLog *log;
+
+    assert(L);
+
+    log = (VecLog*) luaL_checkudata(L, 1, "larr.VecLog");
+
+    if (log->fd >= 0) {
+        if (log->pending_len > 0) {
+            lua_pushcfunction(L, l_VecLog_flush);
+            lua_pushvalue(L, 1);
+            lua_pcall(L, 1, 0, 0);
+        }
+
+        close(log->fd);
+        log->fd = -1;
+    }
+
+    free(log->pending);
+    log->pending = NULL;
+    free(log->path);
+    log->path = NULL;
+
+    return 0;
+}
+
+int l_VecLog_meta_len(lua_State *L) {
+    assert(L);
+
+    check_log(L, 1);
+    lua_getuservalue(L, 1);
+    push_size_t(L, Vec_len(&check_tv(L, -1)->vec));
+
+    return 1;
+}
+
+int l_VecLog_push(lua_State *L) {
+    VecLog *log;
+    TypeVec *tv;
+
+    assert(L);
+
+    log = check_log(L, 1);
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    lua_getuservalue(L, 1);
+    tv = check_tv_mut(L, 3);
+    lua_pushvalue(L, 2);
+    tv->vtbl->push(tv, L);
+
+    log_tail(L, log, tv, Vec_len(&tv->vec) - 1);
+
+    return 0;
+}
+
+/* takes the same arguments as Vec:append */
+int l_VecLog_append(lua_State *L) {
+    VecLog *log;
+    TypeVec *tv;
+    size_t old_len;
+    int num_args;
+
+    assert(L);
+
+    log = check_log(L, 1);
+    num_args = lua_gettop(L);
+    lua_getuservalue(L, 1);
+    tv = check_tv_mut(L, -1);
+    old_len = Vec_len(&tv->vec);
+
+    lua_pushcfunction(L, l_Vec_append);
+    lua_insert(L, 2);
+    lua_insert(L, 3);
+
+    /* whatever was appended before an error is logged before raising it */
+    if (lua_pcall(L, num_args, 0, 0) != LUA_OK) {
+        log_tail(L, log, tv, old_len);
+
+        return lua_error(L);
+    }
+
+    log_tail(L, log, tv, old_len);
+
+    return 0;
+}
+
+/* @returns A copy-on-write clone of the logged Vec */
+int l_VecLog_vec(lua_State *L) {
+    assert(L);
+
+    check_log(L, 1);
+    lua_settop(L, 1);
+    lua_pushcfunction(L, l_Vec_clone);
+    lua_getuservalue(L, 1);
+    lua_call(L, 1, 1);
+
+    return 1;
+}
+
+int l_VecLog_flush(lua_State *L) {
+    VecLog *log;
+
+    assert(L);
+
+    log = check_log(L, 1);
+    flush(L, log);
+
+    return 0;
+}
+
+int l_VecLog_sync(lua_State *L) {
+    VecLog *log;
+
+    assert(L);
+
+    log = check_log(L, 1);
+    flush(L, log);
+    sync_log(L, log);
+
+    return 0;
+}
+
+int l_VecLog_close(lua_State *L) {
+    VecLog *log;
+
+    assert(L);
+
+    log = (VecLog*) luaL_checkudata(L, 1, "larr.VecLog");
+
+    if (log->fd < 0) {
+        return 0;
+    }
+
+    flush(L, log);
+    sync_log(L, log);
+
+    if (close(log->fd) != 0) {
+        log->fd = -1;
+
+        return luaL_error(L, "couldn't close log '%s': %s", log->path, strerror(errno));
+    }
+
+    log->fd = -1;
+
+    return 0;
+}
+
+/* the table only depends on the polynomial, so racing initializers agree */
+static void init_crc_table(void) {
+    uint32_t i;
+
+    if (crc_table[1] != 0) {
+        return;
+    }
+
+    for (i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        int j;
+
+        for (j = 0; j < 8; ++j) {
+            c = (c & 1) ? (c >> 1) ^ 0xedb88320u : (c >> 1);
+        }
+
+        crc_table[i] = c;
+    }
+}
+
+/* CRC-32 as in zlib; init_crc_table must have been called */
+static uint32_t crc32(const unsigned char *data, size_t size) {
+    uint32_t c = 0xffffffffu;
+    size_t i;
+
+    assert(data || size == 0);
+
+    for (i = 0; i < size; ++i) {
+        c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+
+    return c ^ 0xffffffffu;
+}
+
+static void put_u32(unsigned char *dst, uint32_t x) {
+    int i;
+
+    assert(dst);
+
+    for (i = 0; i < 4; ++i) {
+        dst[i] = (unsigned char) (x & 0xff);
+        x >>= 8;
+    }
+}
+
+static uint32_t get_u32(const unsigned char *src) {
+    assert(src);
+
+    return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16)
+           | ((uint32_t) src[3] << 24);
+}
+
+/* @returns 0 if type can't be logged */
+static int file_type_of(int type) {
+    switch (type) {
+        case TP_NUM: return FILE_TYPE_NUMBER;
+        case TP_INT: return FILE_TYPE_INTEGER;
+        case TP_BOOL: return FILE_TYPE_BOOLEAN;
+        default: return 0;
+    }
+}
+
+static int is_little_endian(void) {
+    const unsigned int one = 1;
+
+    return *(const unsigned char*) &one == 1;
+}
+
+static VecLog* check_log(lua_State *L, int arg) {
+    VecLog *log;
+
+    assert(L);
+
+    log = (VecLog*) luaL_checkudata(L, arg, "larr.VecLog");
+
+    if (log->fd < 0) {
+        luaL_error(L, "larr.VecLog is closed");
+    }
+
+    return log;
+}
+
+/* reads batch, sync_every and sync_ms from the table at arg, if any */
+static void read_policy(lua_State *L, int arg, VecLog *log) {
+    assert(L);
+    assert(log);
+
+    if (lua_isnil(L, arg)) {
+        return;
+    }
+
+    lua_getfield(L, arg, "batch");
+
+    if (!lua_isnil(L, -1)) {
+        log->batch = check_size_t(L, -1);
+        luaL_argcheck(L, log->batch > 0 && log->batch <= 0xffffffffu / log->element_size, arg,
+                      "batch must be positive and fit in a segment");
+    }
+
+    lua_getfield(L, arg, "sync_every");
+
+    if (!lua_isnil(L, -1)) {
+        log->sync_every = check_size_t(L, -1);
+    }
+
+    lua_getfield(L, arg, "sync_ms");
+
+    if (!lua_isnil(L, -1)) {
+        log->sync_ms = (long) luaL_checkinteger(L, -1);
+        luaL_argcheck(L, log->sync_ms >= 0, arg, "sync_ms must not be negative");
+    }
+
+    lua_pop(L, 3);
+}
+
+/*
+ *  Writes the header of a new log, or loads the valid prefix of an
+ *  existing one into tv and truncates the rest.
+ *
+ *  @returns The number of bytes truncated
+ */
+static size_t recover(lua_State *L, VecLog *log, TypeVec *tv) {
+    unsigned char header[FILE_HEADER_SIZE];
+    const unsigned char *map;
+    struct stat st;
+    size_t size;
+    size_t offset;
+    size_t total;
+
+    assert(L);
+    assert(log);
+    assert(tv);
+
+    if (fstat(log->fd, &st) != 0) {
+        return luaL_error(L, "couldn't open log '%s': %s", log->path, strerror(errno));
+    }
+
+    size = (size_t) st.st_size;
+
+    if (size == 0) {
+        memset(header, 0, sizeof(header));
+        memcpy(header, "LARL", 4);
+        header[4] = LOG_VERSION;
+        header[5] = (unsigned char) log->file_type;
+        header[6] = (unsigned char) log->element_size;
+        header[7] = (unsigned char) is_little_endian();
+
+        if (write(log->fd, header, FILE_HEADER_SIZE) != FILE_HEADER_SIZE) {
+            ftruncate(log->fd, 0);
+
+            return luaL_error(L, "couldn't write log '%s': %s", log->path, strerror(errno));
+        }
+
+        log->file_size = FILE_HEADER_SIZE;
+
+        return 0;
+    } else if (size < FILE_HEADER_SIZE) {
+        return luaL_error(L, "'%s' is not a larr log", log->path);
+    }
+
+    map = (const unsigned char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, log->fd, 0);
+
+    if (map == (const unsigned char*) MAP_FAILED) {
+        return luaL_error(L, "couldn't map log '%s': %s", log->path, strerror(errno));
+    }
+
+    if (memcmp(map, "LARL", 4) != 0 || map[4] != LOG_VERSION) {
+        munmap((void*) map, size);
+
+        return luaL_error(L, "'%s' is not a larr log", log->path);
+    } else if (map[5] != log->file_type || map[6] != log->element_size
+               || map[7] != is_little_endian()) {
+        munmap((void*) map, size);
+
+        return luaL_error(L, "'%s' holds a different element type or byte order", log->path);
+    }
+
+    /* the first pass finds the valid prefix, so the Vec is allocated once */
+    for (offset = FILE_HEADER_SIZE, total = 0; size - offset >= SEGMENT_HEADER_SIZE; ) {
+        const unsigned char *const segment = map + offset;
+        const size_t count = get_u32(segment + 4);
+
+        if (memcmp(segment, "LSEG", 4) != 0
+            || get_u32(segment + 12) != crc32(segment, 12)
+            || count > (size - offset - SEGMENT_HEADER_SIZE) / log->element_size
+            || get_u32(segment + 8) != crc32(segment + SEGMENT_HEADER_SIZE,
+                                             count * log->element_size)) {
+            break;
+        }
+
+        offset += SEGMENT_HEADER_SIZE + count * log->element_size;
+        total += count;
+    }
+
+    if (Vec_reserve(&tv->vec, total) != LARR_OK) {
+        munmap((void*) map, size);
+
+        return luaL_error(L, "couldn't allocate space for %I elements", (lua_Integer) total);
+    }
+
+    for (log->file_size = FILE_HEADER_SIZE; (size_t) log->file_size < offset; ) {
+        const unsigned char *const segment = map + log->file_size;
+        const size_t bytes = get_u32(segment + 4) * log->element_size;
+
+        memcpy((char*) Vec_as_mut_ptr(&tv->vec) + Vec_len(&tv->vec) * log->element_size,
+               segment + SEGMENT_HEADER_SIZE, bytes);
+        tv->vec.len += get_u32(segment + 4);
+        log->file_size += (off_t) (SEGMENT_HEADER_SIZE + bytes);
+    }
+
+    munmap((void*) map, size);
+
+    if (offset < size && ftruncate(log->fd, (off_t) offset) != 0) {
+        return luaL_error(L, "couldn't truncate log '%s': %s", log->path, strerror(errno));
+    }
+
+    return size - offset;
+}
+
+/* logs the elements of tv from index from on, applying the sync policy */
+static void log_tail(lua_State *L, VecLog *log, const TypeVec *tv, size_t from) {
+    const char *const data = (const char*) Vec_as_ptr(&tv->vec);
+    const size_t len = Vec_len(&tv->vec);
+
+    assert(L);
+    assert(log);
+    assert(tv);
+
+    while (from < len) {
+        size_t count = log->batch - log->pending_len;
+
+        if (count > len - from) {
+            count = len - from;
+        }
+
+        memcpy(log->pending + SEGMENT_HEADER_SIZE + log->pending_len * log->element_size,
+               data + from * log->element_size, count * log->element_size);
+        log->pending_len += count;
+        from += count;
+
+        if (log->pending_len == log->batch
+            || (log->sync_every > 0 && log->unsynced + log->pending_len >= log->sync_every)) {
+            flush(L, log);
+        }
+
+        if (log->sync_every > 0 && log->unsynced >= log->sync_every) {
+            sync_log(L, log);
+        }
+    }
+
+    if (log->sync_ms > 0 && ms_since(&log->last_sync) >= log->sync_ms) {
+        flush(L, log);
+        sync_log(L, log);
+    }
+}
+
+/* writes the pending elements as one segment */
+static void flush(lua_State *L, VecLog *log) {
+    const size_t bytes = log->pending_len * log->element_size;
+    size_t written;
+
+    assert(L);
+    assert(log);
+
+    if (log->pending_len == 0) {
+        return;
+    }
+
+    memcpy(log->pending, "LSEG", 4);
+    put_u32(log->pending + 4, (uint32_t) log->pending_len);
+    put_u32(log->pending + 8, crc32(log->pending + SEGMENT_HEADER_SIZE, bytes));
+    put_u32(log->pending + 12, crc32(log->pending, 12));
+
+    for (written = 0; written < SEGMENT_HEADER_SIZE + bytes; ) {
+        const ssize_t n = write(log->fd, log->pending + written,
+                                SEGMENT_HEADER_SIZE + bytes - written);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            const int error_no = errno;
+
+            /* drop the partial segment, so a retry isn't hidden behind it */
+            ftruncate(log->fd, log->file_size);
+
+            luaL_error(L, "couldn't write log '%s': %s", log->path, strerror(error_no));
+        }
+
+        written += (size_t) n;
+    }
+
+    log->file_size += (off_t) written;
+    log->unsynced += log->pending_len;
+    log->pending_len = 0;
+}
+
+static void sync_log(lua_State *L, VecLog *log) {
+    assert(L);
+    assert(log);
+
+    if (log->unsynced == 0) {
+        return;
+    }
+
+    if (fsync(log->fd) != 0) {
+        luaL_error(L, "couldn't sync log '%s': %s", log->path, strerror(errno));
+    }
+
+    log->unsynced = 0;
+    clock_gettime(CLOCK_MONOTONIC, &log->last_sync);
+}
+
+static long ms_since(const struct timespec *then) {
+    struct timespec now;
+
+    assert(then);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long) (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
@@ -0,0 +1,490 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.NDArray is a strided view over the buffer of the Vec held in
+ *  its uservalue. Strides and the offset are counted in elements. Every
+ *  view operation (reshape, transpose, slice, broadcast_to) builds a new
+ *  NDArray over the same Vec without copying; only to_vec copies.
+ *  Indices are 1-based and slice bounds are inclusive, as in Lua.
+ */
+
+#define NDARRAY_MAX_DIMS 8
+
+typedef struct NDArray {
+    size_t ndim;
+    size_t offset;
+    size_t shape[NDARRAY_MAX_DIMS];
+    ptrdiff_t strides[NDARRAY_MAX_DIMS];
+} NDArray;
+
+static const NDArray* check_ndarray(lua_State *L, int arg);
+
+static NDArray* push_view(lua_State *L, int arg, const NDArray *view);
+
+static size_t check_shape(lua_State *L, int arg, size_t *shape);
+
+static size_t num_elems(const size_t *shape, size_t ndim);
+
+static int is_contiguous(const NDArray *self);
+
+static size_t check_offset(lua_State *L, const NDArray *self, int arg);
+
+int l_NDArray_new(lua_State *L) {
+    const TypeVec *tv;
+    NDArray view;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, 1,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+
+    view.ndim = check_shape(L, 2, view.shape);
+    view.offset = 0;
+
+    if (num_elems(view.shape, view.ndim) != Vec_len(&tv->vec)) {
+        return luaL_error(L, "shape has %I elements but Vec has %I",
+                          (lua_Integer) num_elems(view.shape, view.ndim),
+                          (lua_Integer) Vec_len(&tv->vec));
+    }
+
+    for (i = view.ndim; i > 0; --i) {
+        view.strides[i - 1] = (i == view.ndim)
+            ? 1 : view.strides[i] * (ptrdiff_t) view.shape[i];
+    }
+
+    push_view(L, 1, &view);
+
+    return 1;
+}
+
+int l_NDArray_ndim(lua_State *L) {
+    assert(L);
+
+    push_size_t(L, check_ndarray(L, 1)->ndim);
+
+    return 1;
+}
+
+int l_NDArray_meta_len(lua_State *L) {
+    const NDArray *self;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    push_size_t(L, num_elems(self->shape, self->ndim));
+
+    return 1;
+}
+
+int l_NDArray_shape(lua_State *L) {
+    const NDArray *self;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    luaL_checkstack(L, (int) self->ndim, NULL);
+
+    for (i = 0; i < self->ndim; ++i) {
+        push_size_t(L, self->shape[i]);
+    }
+
+    return (int) self->ndim;
+}
+
+int l_NDArray_strides(lua_State *L) {
+    const NDArray *self;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    luaL_checkstack(L, (int) self->ndim, NULL);
+
+    for (i = 0; i < self->ndim; ++i) {
+        lua_pushinteger(L, (lua_Integer) self->strides[i]);
+    }
+
+    return (int) self->ndim;
+}
+
+int l_NDArray_vec(lua_State *L) {
+    assert(L);
+
+    check_ndarray(L, 1);
+    lua_getuservalue(L, 1);
+
+    return 1;
+}
+
+int l_NDArray_get(lua_State *L) {
+    const NDArray *self;
+    const TypeVec *tv;
+    size_t offset;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    luaL_argcheck(L, (size_t) lua_gettop(L) - 1 == self->ndim, 2, "wrong number of indices");
+
+    offset = check_offset(L, self, 2);
+
+    lua_getuservalue(L, 1);
+    tv = check_tv(L, -1);
+
+    if (offset >= Vec_len(&tv->vec)) {
+        return luaL_error(L, "view is out of range of its Vec");
+    }
+
+    tv->vtbl->push_elem(tv, offset, L);
+
+    return 1;
+}
+
+int l_NDArray_set(lua_State *L) {
+    const NDArray *self;
+    TypeVec *tv;
+    size_t offset;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    luaL_argcheck(L, (size_t) lua_gettop(L) - 2 == self->ndim, 2, "wrong number of indices");
+
+    offset = check_offset(L, self, 2);
+
+    lua_getuservalue(L, 1);
+    tv = check_tv_mut(L, -1);
+
+    if (offset >= Vec_len(&tv->vec)) {
+        return luaL_error(L, "view is out of range of its Vec");
+    }
+
+    lua_pushvalue(L, (int) self->ndim + 2);
+    tv->vtbl->set_elem(tv, offset, L);
+
+    return 0;
+}
+
+int l_NDArray_reshape(lua_State *L) {
+    const NDArray *self;
+    NDArray view;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    view.ndim = check_shape(L, 2, view.shape);
+    view.offset = self->offset;
+
+    if (num_elems(view.shape, view.ndim) != num_elems(self->shape, self->ndim)) {
+        return luaL_error(L, "cannot reshape %I elements into %I",
+                          (lua_Integer) num_elems(self->shape, self->ndim),
+                          (lua_Integer) num_elems(view.shape, view.ndim));
+    } else if (!is_contiguous(self)) {
+        return luaL_error(L, "reshape requires a contiguous view; use to_vec first");
+    }
+
+    for (i = view.ndim; i > 0; --i) {
+        view.strides[i - 1] = (i == view.ndim)
+            ? 1 : view.strides[i] * (ptrdiff_t) view.shape[i];
+    }
+
+    push_view(L, 1, &view);
+
+    return 1;
+}
+
+int l_NDArray_transpose(lua_State *L) {
+    const NDArray *self;
+    NDArray view;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    view = *self;
+
+    if (lua_gettop(L) == 1) {
+        for (i = 0; i < self->ndim; ++i) {
+            view.shape[i] = self->shape[self->ndim - 1 - i];
+            view.strides[i] = self->strides[self->ndim - 1 - i];
+        }
+    } else {
+        int seen[NDARRAY_MAX_DIMS];
+
+        luaL_argcheck(L, (size_t) lua_gettop(L) - 1 == self->ndim, 2,
+                      "permutation must name every axis");
+        memset(seen, 0, sizeof(seen));
+
+        for (i = 0; i < self->ndim; ++i) {
+            const size_t axis = check_size_t(L, (int) i + 2);
+
+            luaL_argcheck(L, axis >= 1 && axis <= self->ndim && !seen[axis - 1], (int) i + 2,
+                          "not a permutation of the axes");
+            seen[axis - 1] = 1;
+
+            view.shape[i] = self->shape[axis - 1];
+            view.strides[i] = self->strides[axis - 1];
+        }
+    }
+
+    push_view(L, 1, &view);
+
+    return 1;
+}
+
+int l_NDArray_slice(lua_State *L) {
+    const NDArray *self;
+    NDArray view;
+    size_t axis;
+    size_t start;
+    size_t stop;
+    lua_Integer step;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    axis = check_size_t(L, 2);
+    luaL_argcheck(L, axis >= 1 && axis <= self->ndim, 2, "axis out of range");
+
+    start = check_size_t(L, 3);
+    stop = (size_t) luaL_optinteger(L, 4, (lua_Integer) self->shape[axis - 1]);
+    step = luaL_optinteger(L, 5, 1);
+
+    luaL_argcheck(L, start >= 1 && start <= self->shape[axis - 1] + 1, 3, "out of range");
+    luaL_argcheck(L, stop + 1 >= start && stop <= self->shape[axis - 1], 4, "out of range");
+    luaL_argcheck(L, step >= 1, 5, "must be positive");
+
+    view = *self;
+    view.shape[axis - 1] = (stop + 1 - start + (size_t) step - 1) / (size_t) step;
+
+    if (view.shape[axis - 1] > 0) {
+        view.offset = (size_t) ((ptrdiff_t) self->offset
+                                + (ptrdiff_t) (start - 1) * self->strides[axis - 1]);
+    }
+
+    view.strides[axis - 1] = self->strides[axis - 1] * (ptrdiff_t) step;
+
+    push_view(L, 1, &view);
+
+    return 1;
+}
+
+int l_NDArray_broadcast_to(lua_State *L) {
+    const NDArray *self;
+    NDArray view;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    view.ndim = check_shape(L, 2, view.shape);
+    view.offset = self->offset;
+
+    if (view.ndim < self->ndim) {
+        return luaL_error(L, "cannot broadcast %I dimensions to %I",
+                          (lua_Integer) self->ndim, (lua_Integer) view.ndim);
+    }
+
+    /* align trailing axes; new leading axes and stretched axes get stride 0 */
+    for (i = 0; i < view.ndim; ++i) {
+        const size_t lead = view.ndim - self->ndim;
+
+        if (i < lead) {
+            view.strides[i] = 0;
+        } else if (self->shape[i - lead] == view.shape[i]) {
+            view.strides[i] = self->strides[i - lead];
+        } else if (self->shape[i - lead] == 1) {
+            view.strides[i] = 0;
+        } else {
+            return luaL_error(L, "cannot broadcast axis %I of size %I to %I",
+                              (lua_Integer) (i - lead + 1),
+                              (lua_Integer) self->shape[i - lead], (lua_Integer) view.shape[i]);
+        }
+    }
+
+    push_view(L, 1, &view);
+
+    return 1;
+}
+
+int l_NDArray_to_vec(lua_State *L) {
+    const NDArray *self;
+    const TypeVec *tv;
+    TypeVec *out;
+    size_t index[NDARRAY_MAX_DIMS];
+    size_t total;
+    size_t i;
+
+    assert(L);
+
+    self = check_ndarray(L, 1);
+    lua_settop(L, 1);
+    lua_getuservalue(L, 1);
+    tv = check_tv(L, 2);
+
+    total = num_elems(self->shape, self->ndim);
+    out = new_tv(L, tv->typeinfo, total);
+    memset(index, 0, sizeof(index));
+
+    for (i = 0; i < total; ++i) {
+        ptrdiff_t offset = (ptrdiff_t) self->offset;
+        const void *elem;
+        size_t axis;
+
+        for (axis = 0; axis < self->ndim; ++axis) {
+            offset += (ptrdiff_t) index[axis] * self->strides[axis];
+        }
+
+        elem = Vec_get(&tv->vec, (size_t) offset);
+
+        if (!elem) {
+            return luaL_error(L, "view is out of range of its Vec");
+        }
+
+        Vec_push(&out->vec, elem);
+
+        /* odometer increment, last axis fastest */
+        for (axis = self->ndim; axis > 0; --axis) {
+            if (++index[axis - 1] < self->shape[axis - 1]) {
+                break;
+            }
+
+            index[axis - 1] = 0;
+        }
+    }
+
+    return 1;
+}
+
+static const NDArray* check_ndarray(lua_State *L, int arg) {
+    assert(L);
+
+    return (const NDArray*) luaL_checkudata(L, arg, "larr.NDArray");
+}
+
+/* pushes a copy of view sharing the Vec of the NDArray or Vec at arg */
+static NDArray* push_view(lua_State *L, int arg, const NDArray *view) {
+    NDArray *self;
+
+    assert(L);
+    assert(view);
+
+    arg = lua_absindex(L, arg);
+
+    self = (NDArray*) lua_newuserdata(L, sizeof(NDArray));
+    *self = *view;
+
+    luaL_setmetatable(L, "larr.NDArray");
+
+    if (luaL_testudata(L, arg, "larr.NDArray")) {
+        lua_getuservalue(L, arg);
+    } else {
+        lua_pushvalue(L, arg);
+    }
+
+    lua_setuservalue(L, -2);
+
+    return self;
+}
+
+/* reads a shape from a table or from the integers at arg and after it */
+static size_t check_shape(lua_State *L, int arg, size_t *shape) {
+    size_t ndim;
+    size_t i;
+
+    assert(L);
+    assert(shape);
+
+    if (lua_istable(L, arg)) {
+        ndim = (size_t) lua_rawlen(L, arg);
+        luaL_argcheck(L, ndim >= 1 && ndim <= NDARRAY_MAX_DIMS, arg, "bad number of dimensions");
+
+        for (i = 0; i < ndim; ++i) {
+            lua_rawgeti(L, arg, (lua_Integer) i + 1);
+            shape[i] = check_size_t(L, -1);
+            lua_pop(L, 1);
+        }
+    } else {
+        ndim = (lua_gettop(L) >= arg) ? (size_t) (lua_gettop(L) - arg + 1) : 0;
+        luaL_argcheck(L, ndim >= 1 && ndim <= NDARRAY_MAX_DIMS, arg, "bad number of dimensions");
+
+        for (i = 0; i < ndim; ++i) {
+            shape[i] = check_size_t(L, arg + (int) i);
+        }
+    }
+
+    return ndim;
+}
+
+static size_t num_elems(const size_t *shape, size_t ndim) {
+    size_t total = 1;
+    size_t i;
+
+    assert(shape);
+
+    for (i = 0; i < ndim; ++i) {
+        total *= shape[i];
+    }
+
+    return total;
+}
+
+static int is_contiguous(const NDArray *self) {
+    ptrdiff_t expected = 1;
+    size_t i;
+
+    assert(self);
+
+    for (i = self->ndim; i > 0; --i) {
+        if (self->shape[i - 1] != 1 && self->strides[i - 1] != expected) {
+            return 0;
+        }
+
+        expected *= (ptrdiff_t) self->shape[i - 1];
+    }
+
+    return 1;
+}
+
+/* converts the 1-based indices at arg and after it into an element offset */
+static size_t check_offset(lua_State *L, const NDArray *self, int arg) {
+    ptrdiff_t offset;
+    size_t i;
+
+    assert(L);
+    assert(self);
+
+    offset = (ptrdiff_t) self->offset;
+
+    for (i = 0; i < self->ndim; ++i) {
+        const size_t index = check_size_t(L, arg + (int) i);
+
+        luaL_argcheck(L, index >= 1 && index <= self->shape[i], arg + (int) i,
+                      "index out of range");
+
+        offset += (ptrdiff_t) (index - 1) * self->strides[i];
+    }
+
+    return (size_t) offset;
+}
@@ -0,0 +1,517 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.PackedVec is a read-only, compressed copy of a Vec<integer>.
+ *  Values are split into blocks of PACKED_BLOCK_LEN. Each block stores
+ *  its values relative to a per-block reference, bit-packed at the
+ *  smallest width that fits them all. With the "delta" codec the packed
+ *  values are the differences between neighbours, which suits sorted or
+ *  slowly changing sequences; with the "for" (frame-of-reference) codec
+ *  they are the values themselves.
+ *
+ *  A block of width w occupies exactly 2 * w words, so blocks start on
+ *  word boundaries and can be located from their header alone. Reads
+ *  decode a whole block at a time into a cache, which makes sequential
+ *  access (including ipairs) cost one block decode per
+ *  PACKED_BLOCK_LEN elements.
+ */
+
+#define PACKED_BLOCK_LEN 128
+#define PACKED_WORD_BITS 64
+
+#define PACKED_NO_BLOCK ((size_t) -1)
+
+typedef enum PackedCodec {
+    PACKED_DELTA,
+    PACKED_FOR
+} PackedCodec;
+
+typedef struct PackedBlock {
+    lua_Integer first;
+    lua_Integer reference;
+    size_t offset;
+    unsigned int width;
+} PackedBlock;
+
+typedef struct PackedVec {
+    size_t len;
+    size_t num_blocks;
+    size_t num_words;
+    int codec;
+    PackedBlock *blocks;
+    lua_Unsigned *words;
+    size_t cached_block;
+    lua_Integer cache[PACKED_BLOCK_LEN];
+} PackedVec;
+
+static const char *const CODEC_NAMES[] = { "delta", "for", NULL };
+
+static PackedVec* check_packed(lua_State *L, int arg);
+
+static unsigned int bit_width(lua_Unsigned x);
+
+static void pack_block(const lua_Integer *src, size_t n, int codec, PackedBlock *block,
+                       lua_Unsigned *words);
+
+static const lua_Integer* decode_block(PackedVec *self, size_t block);
+
+int l_Vec_compress(lua_State *L) {
+    const TypeVec *tv;
+    const lua_Integer *data;
+    PackedVec *self;
+    size_t len;
+    size_t b;
+    int codec;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    luaL_argcheck(L, tv->typeinfo.type == TP_INT, 1, "expected larr.Vec<integer>");
+    codec = luaL_checkoption(L, 2, "delta", CODEC_NAMES);
+
+    data = (const lua_Integer*) Vec_as_ptr(&tv->vec);
+    len = Vec_len(&tv->vec);
+
+    lua_settop(L, 2);
+    self = (PackedVec*) lua_newuserdata(L, sizeof(PackedVec));
+    self->len = len;
+    self->num_blocks = (len + PACKED_BLOCK_LEN - 1) / PACKED_BLOCK_LEN;
+    self->num_words = 0;
+    self->codec = codec;
+    self->blocks = NULL;
+    self->words = NULL;
+    self->cached_block = PACKED_NO_BLOCK;
+    luaL_setmetatable(L, "larr.PackedVec");
+
+    if (len == 0) {
+        return 1;
+    }
+
+    self->blocks = (PackedBlock*) malloc(self->num_blocks * sizeof(PackedBlock));
+
+    if (!self->blocks) {
+        return luaL_error(L, "out of memory");
+    }
+
+    /* size every block first so the words can be allocated exactly once */
+    for (b = 0; b < self->num_blocks; ++b) {
+        const size_t start = b * PACKED_BLOCK_LEN;
+        const size_t n = (len - start < PACKED_BLOCK_LEN) ? len - start : PACKED_BLOCK_LEN;
+
+        pack_block(data + start, n, codec, &self->blocks[b], NULL);
+        self->blocks[b].offset = self->num_words;
+        self->num_words += 2 * self->blocks[b].width;
+    }
+
+    if (self->num_words > 0) {
+        self->words = (lua_Unsigned*) calloc(self->num_words, sizeof(lua_Unsigned));
+
+        if (!self->words) {
+            return luaL_error(L, "out of memory");
+        }
+    }
+
+    for (b = 0; b < self->num_blocks; ++b) {
+        const size_t start = b * PACKED_BLOCK_LEN;
+        const size_t n = (len - start < PACKED_BLOCK_LEN) ? len - start : PACKED_BLOCK_LEN;
+
+        pack_block(data + start, n, codec, &self->blocks[b],
+                   self->words + self->blocks[b].offset);
+    }
+
+    return 1;
+}
+
+int l_PackedVec_meta_gc(lua_State *L) {
+    PackedVec *self;
+
+    assert(L);
+
+    self = (PackedVec*) luaL_checkudata(L, 1, "larr.PackedVec");
+
+    free(self->blocks);
+    free(self->words);
+    self->blocks = NULL;
+    self->words = NULL;
+    self->len = 0;
+    self->num_blocks = 0;
+
+    return 0;
+}
+
+int l_PackedVec_meta_len(lua_State *L) {
+    assert(L);
+
+    push_size_t(L, check_packed(L, 1)->len);
+
+    return 1;
+}
+
+/*
+ *  Integer keys read elements, returning nil past the end so that
+ *  ipairs works. String keys find methods; any other key gives nil.
+ */
+int l_PackedVec_meta_index(lua_State *L) {
+    PackedVec *self;
+    lua_Integer index;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+
+    if (lua_type(L, 2) == LUA_TSTRING && luaL_getmetafield(L, 1, lua_tostring(L, 2)) != LUA_TNIL) {
+        return 1;
+    } else if (lua_type(L, 2) != LUA_TNUMBER) {
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    index = lua_tointeger(L, 2);
+
+    if (index < 1 || (lua_Unsigned) index > (lua_Unsigned) self->len) {
+        lua_pushnil(L);
+    } else {
+        const size_t i = (size_t) index - 1;
+
+        lua_pushinteger(L, decode_block(self, i / PACKED_BLOCK_LEN)[i % PACKED_BLOCK_LEN]);
+    }
+
+    return 1;
+}
+
+int l_PackedVec_get(lua_State *L) {
+    PackedVec *self;
+    size_t index;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+    index = check_size_t(L, 2);
+    luaL_argcheck(L, index >= 1 && index <= self->len, 2, "index out of range");
+
+    --index;
+    lua_pushinteger(L, decode_block(self, index / PACKED_BLOCK_LEN)[index % PACKED_BLOCK_LEN]);
+
+    return 1;
+}
+
+int l_PackedVec_decompress(lua_State *L) {
+    PackedVec *self;
+    TypeVec *out;
+    lua_Integer *dst;
+    size_t b;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+    out = new_tv(L, typeinfo_of(TP_INT), self->len);
+    out->vec.len = self->len;
+    dst = (lua_Integer*) Vec_as_mut_ptr(&out->vec);
+
+    for (b = 0; b < self->num_blocks; ++b) {
+        const size_t start = b * PACKED_BLOCK_LEN;
+        const size_t n = (self->len - start < PACKED_BLOCK_LEN)
+            ? self->len - start : PACKED_BLOCK_LEN;
+
+        memcpy(dst + start, decode_block(self, b), n * sizeof(lua_Integer));
+    }
+
+    return 1;
+}
+
+int l_PackedVec_sum(lua_State *L) {
+    PackedVec *self;
+    lua_Unsigned acc;
+    size_t b;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+    acc = 0;
+
+    for (b = 0; b < self->num_blocks; ++b) {
+        const PackedBlock *const block = &self->blocks[b];
+        const size_t start = b * PACKED_BLOCK_LEN;
+        const size_t n = (self->len - start < PACKED_BLOCK_LEN)
+            ? self->len - start : PACKED_BLOCK_LEN;
+        const lua_Integer *values;
+        size_t i;
+
+        /* a frame-of-reference block of width 0 is n copies of its reference */
+        if (self->codec == PACKED_FOR && block->width == 0) {
+            acc += (lua_Unsigned) block->reference * (lua_Unsigned) n;
+
+            continue;
+        }
+
+        values = decode_block(self, b);
+
+        for (i = 0; i < n; ++i) {
+            acc += (lua_Unsigned) values[i];
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer) acc);
+
+    return 1;
+}
+
+static int minmax(lua_State *L, int want_max);
+
+int l_PackedVec_min(lua_State *L) {
+    return minmax(L, 0);
+}
+
+int l_PackedVec_max(lua_State *L) {
+    return minmax(L, 1);
+}
+
+int l_PackedVec_codec(lua_State *L) {
+    assert(L);
+
+    lua_pushstring(L, CODEC_NAMES[check_packed(L, 1)->codec]);
+
+    return 1;
+}
+
+int l_PackedVec_nbytes(lua_State *L) {
+    const PackedVec *self;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+    push_size_t(L, sizeof(PackedVec) + self->num_blocks * sizeof(PackedBlock)
+                   + self->num_words * sizeof(lua_Unsigned));
+
+    return 1;
+}
+
+int l_PackedVec_meta_tostring(lua_State *L) {
+    const PackedVec *self;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+    lua_pushfstring(L, "larr.PackedVec<integer>(%I values, %s)", (lua_Integer) self->len,
+                    CODEC_NAMES[self->codec]);
+
+    return 1;
+}
+
+static PackedVec* check_packed(lua_State *L, int arg) {
+    assert(L);
+
+    return (PackedVec*) luaL_checkudata(L, arg, "larr.PackedVec");
+}
+
+static int minmax(lua_State *L, int want_max) {
+    PackedVec *self;
+    lua_Integer acc;
+    size_t b;
+
+    assert(L);
+
+    self = check_packed(L, 1);
+
+    if (self->len == 0) {
+        lua_pushnil(L);
+
+        return 1;
+    }
+
+    acc = decode_block(self, 0)[0];
+
+    for (b = 0; b < self->num_blocks; ++b) {
+        const size_t start = b * PACKED_BLOCK_LEN;
+        const size_t n = (self->len - start < PACKED_BLOCK_LEN)
+            ? self->len - start : PACKED_BLOCK_LEN;
+        const lua_Integer *values;
+        size_t i;
+
+        values = decode_block(self, b);
+
+        if (want_max) {
+            for (i = 0; i < n; ++i) {
+                acc = (values[i] > acc) ? values[i] : acc;
+            }
+        } else {
+            for (i = 0; i < n; ++i) {
+                acc = (values[i] < acc) ? values[i] : acc;
+            }
+        }
+    }
+
+    lua_pushinteger(L, acc);
+
+    return 1;
+}
+
+static unsigned int bit_width(lua_Unsigned x) {
+    unsigned int width = 0;
+
+    while (x != 0) {
+        ++width;
+        x >>= 1;
+    }
+
+    return width;
+}
+
+/*
+ *  Fills in block's first, reference and width for the n values at src
+ *  and, if words is not NULL, bit-packs them there. The packed value of
+ *  element i is its delta (or, for PACKED_FOR, itself) minus the
+ *  reference; the first delta of a block is defined to be the reference.
+ */
+static void pack_block(const lua_Integer *src, size_t n, int codec, PackedBlock *block,
+                       lua_Unsigned *words) {
+    lua_Unsigned values[PACKED_BLOCK_LEN];
+    lua_Unsigned reference;
+    lua_Unsigned widest;
+    unsigned int width;
+    size_t i;
+
+    assert(src);
+    assert(n > 0 && n <= PACKED_BLOCK_LEN);
+    assert(block);
+
+    if (codec == PACKED_DELTA) {
+        values[0] = 0;
+
+        for (i = 1; i < n; ++i) {
+            values[i] = (lua_Unsigned) src[i] - (lua_Unsigned) src[i - 1];
+        }
+
+        reference = (n > 1) ? values[1] : 0;
+
+        for (i = 2; i < n; ++i) {
+            reference = ((lua_Integer) values[i] < (lua_Integer) reference)
+                ? values[i] : reference;
+        }
+
+        values[0] = reference;
+    } else {
+        for (i = 0; i < n; ++i) {
+            values[i] = (lua_Unsigned) src[i];
+        }
+
+        reference = values[0];
+
+        for (i = 1; i < n; ++i) {
+            reference = ((lua_Integer) values[i] < (lua_Integer) reference)
+                ? values[i] : reference;
+        }
+    }
+
+    widest = 0;
+
+    for (i = 0; i < n; ++i) {
+        values[i] -= reference;
+        widest |= values[i];
+    }
+
+    width = bit_width(widest);
+
+    block->first = src[0];
+    block->reference = (lua_Integer) reference;
+    block->width = width;
+
+    if (!words || width == 0) {
+        return;
+    }
+
+    for (i = 0; i < n; ++i) {
+        const size_t bit = i * width;
+        const size_t word = bit / PACKED_WORD_BITS;
+        const unsigned int shift = (unsigned int) (bit % PACKED_WORD_BITS);
+
+        words[word] |= values[i] << shift;
+
+        if (shift + width > PACKED_WORD_BITS) {
+            words[word + 1] |= values[i] >> (PACKED_WORD_BITS - shift);
+        }
+    }
+}
+
+/* unpacks a whole block at a fixed width; the loop has no data-dependent branches */
+static void unpack(const lua_Unsigned *words, unsigned int width, lua_Unsigned *out) {
+    const lua_Unsigned mask = (width == PACKED_WORD_BITS)
+        ? ~(lua_Unsigned) 0 : (((lua_Unsigned) 1 << width) - 1);
+    size_t i;
+
+    for (i = 0; i < PACKED_BLOCK_LEN; ++i) {
+        const size_t bit = i * width;
+        const size_t word = bit / PACKED_WORD_BITS;
+        const unsigned int shift = (unsigned int) (bit % PACKED_WORD_BITS);
+        lua_Unsigned value = words[word] >> shift;
+
+        if (shift + width > PACKED_WORD_BITS) {
+            value |= words[word + 1] << (PACKED_WORD_BITS - shift);
+        }
+
+        out[i] = value & mask;
+    }
+}
+
+/* returns the decoded values of block, decoding it into the cache if needed */
+static const lua_Integer* decode_block(PackedVec *self, size_t block) {
+    const PackedBlock *header;
+    lua_Unsigned values[PACKED_BLOCK_LEN];
+    lua_Unsigned reference;
+    size_t i;
+
+    assert(self);
+    assert(block < self->num_blocks);
+
+    if (self->cached_block == block) {
+        return self->cache;
+    }
+
+    header = &self->blocks[block];
+    reference = (lua_Unsigned) header->reference;
+
+    if (header->width == 0) {
+        for (i = 0; i < PACKED_BLOCK_LEN; ++i) {
+            values[i] = 0;
+        }
+    } else {
+        unpack(self->words + header->offset, header->width, values);
+    }
+
+    if (self->codec == PACKED_DELTA) {
+        lua_Unsigned acc = (lua_Unsigned) header->first;
+
+        self->cache[0] = header->first;
+
+        for (i = 1; i < PACKED_BLOCK_LEN; ++i) {
+            acc += values[i] + reference;
+            self->cache[i] = (lua_Integer) acc;
+        }
+    } else {
+        for (i = 0; i < PACKED_BLOCK_LEN; ++i) {
+            self->cache[i] = (lua_Integer) (values[i] + reference);
+        }
+    }
+
+    self->cached_block = block;
+
+    return self->cache;
+}
@@ -0,0 +1,504 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Random fills, shuffles and samples. Numbers come from xoshiro256+
+ *  run as RANDOM_LANES independent generators side by side, so one step
+ *  is a loop over lanes of adds, shifts and xors that the compiler can
+ *  vectorize. Fills restart the generators every RANDOM_CHUNK elements
+ *  from a splitmix64 hash of the seed and the chunk's index, so each
+ *  element depends only on the seed and where it is: a fill could be
+ *  split between threads at chunk boundaries and give the same Vec.
+ *
+ *  Every function takes an optional integer seed; without one, the seed
+ *  is made up from the clock and a counter. Integers in a range are
+ *  drawn by masking the top bits and rejecting values past the end,
+ *  which is unbiased. xoshiro256+'s weak low bits are never used.
+ */
+
+#define RANDOM_LANES 4
+
+#define RANDOM_CHUNK 4096
+
+/* 64-bit constants from 32-bit halves, since C90 has no long long */
+#define U64(hi, lo) (((uint64_t) (hi) << 32) | (uint64_t) (lo))
+
+#define GOLDEN_GAMMA U64(0x9e3779b9, 0x7f4a7c15)
+
+/* without rejection, sample uses a hash set while k is this small a fraction of n */
+#define SPARSE_SAMPLE_RATIO 16
+
+typedef struct Xoshiro {
+    uint64_t s[4][RANDOM_LANES]; /* lane j's state is s[0][j], ..., s[3][j] */
+} Xoshiro;
+
+/* a single sequential stream over the lanes, for shuffle and sample */
+typedef struct Stream {
+    Xoshiro gen;
+    uint64_t batch[RANDOM_LANES];
+    int next;
+} Stream;
+
+static uint64_t check_seed(lua_State *L, int arg);
+
+static uint64_t splitmix64(uint64_t x);
+
+static void seed_chunk(Xoshiro *gen, uint64_t seed, uint64_t chunk);
+
+static void next_batch(Xoshiro *gen, uint64_t out[RANDOM_LANES]);
+
+static void stream_init(Stream *stream, uint64_t seed);
+
+static uint64_t stream_next(Stream *stream);
+
+static size_t stream_below(Stream *stream, size_t n);
+
+static unsigned leading_zeros(uint64_t x);
+
+static void fill_uniform(lua_Number *data, size_t len, uint64_t seed, lua_Number a, lua_Number b);
+
+static void fill_normal(lua_Number *data, size_t len, uint64_t seed, lua_Number mean,
+                        lua_Number sd);
+
+static void fill_range(TypeVec *tv, uint64_t seed, lua_Integer a, lua_Integer b);
+
+static void swap_elements(char *data, size_t size, size_t i, size_t j);
+
+static void sample_sparse(lua_State *L, const TypeVec *tv, TypeVec *dst, size_t k,
+                          Stream *stream);
+
+int l_Vec_fill_random(lua_State *L) {
+    static const char *const dists[] = { "uniform", "normal", "integer", NULL };
+
+    TypeVec *tv;
+    uint64_t seed;
+    int dist;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+    dist = luaL_checkoption(L, 2, NULL, dists);
+    seed = check_seed(L, 3);
+
+    if (dist == 2) {
+        const lua_Integer a = luaL_checkinteger(L, 4);
+        const lua_Integer b = luaL_checkinteger(L, 5);
+
+        luaL_argcheck(L, tv->typeinfo.type == TP_INT || tv->typeinfo.type == TP_NUM, 1,
+                      "expected larr.Vec<integer> or larr.Vec<number>");
+        luaL_argcheck(L, a <= b, 5, "empty range");
+
+        fill_range(tv, seed, a, b);
+    } else {
+        luaL_argcheck(L, tv->typeinfo.type == TP_NUM, 1, "expected larr.Vec<number>");
+
+        if (dist == 0) {
+            fill_uniform((lua_Number*) Vec_as_mut_ptr(&tv->vec), Vec_len(&tv->vec), seed,
+                         luaL_optnumber(L, 4, 0), luaL_optnumber(L, 5, 1));
+        } else {
+            fill_normal((lua_Number*) Vec_as_mut_ptr(&tv->vec), Vec_len(&tv->vec), seed,
+                        luaL_optnumber(L, 4, 0), luaL_optnumber(L, 5, 1));
+        }
+    }
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+/* Fisher-Yates */
+int l_Vec_shuffle(lua_State *L) {
+    TypeVec *tv;
+    Stream stream;
+    char *data;
+    size_t i;
+
+    assert(L);
+
+    tv = check_tv_mut(L, 1);
+    stream_init(&stream, check_seed(L, 2));
+    data = (char*) Vec_as_mut_ptr(&tv->vec);
+
+    for (i = Vec_len(&tv->vec); i > 1; --i) {
+        swap_elements(data, tv->vec.element_size, i - 1, stream_below(&stream, i));
+    }
+
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+int l_Vec_sample(lua_State *L) {
+    const TypeVec *tv;
+    TypeVec *dst;
+    Stream stream;
+    size_t n;
+    size_t k;
+    size_t i;
+    int replace;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    k = check_size_t(L, 2);
+    replace = lua_toboolean(L, 3);
+    stream_init(&stream, check_seed(L, 4));
+    n = Vec_len(&tv->vec);
+
+    luaL_argcheck(L, replace ? (n > 0 || k == 0) : k <= n, 2,
+                  "sample is larger than the Vec");
+
+    lua_settop(L, 4);
+    dst = new_tv(L, tv->typeinfo, k);
+
+    if (replace) {
+        const size_t size = tv->vec.element_size;
+        const char *const src = (const char*) Vec_as_ptr(&tv->vec);
+        char *const data = (char*) Vec_as_mut_ptr(&dst->vec);
+
+        for (i = 0; i < k; ++i) {
+            memcpy(data + i * size, src + stream_below(&stream, n) * size, size);
+        }
+
+        dst->vec.len = k;
+    } else if (k <= n / SPARSE_SAMPLE_RATIO) {
+        sample_sparse(L, tv, dst, k, &stream);
+    } else {
+        /* a partial Fisher-Yates over a copy, stopping after k elements */
+        char *data;
+
+        if (Vec_reserve(&dst->vec, n) != LARR_OK) {
+            return luaL_error(L, "couldn't allocate space for %I elements", (lua_Integer) n);
+        }
+
+        data = (char*) Vec_as_mut_ptr(&dst->vec);
+        memcpy(data, Vec_as_ptr(&tv->vec), n * tv->vec.element_size);
+
+        for (i = 0; i < k; ++i) {
+            swap_elements(data, tv->vec.element_size, i, i + stream_below(&stream, n - i));
+        }
+
+        dst->vec.len = k;
+    }
+
+    return 1;
+}
+
+static uint64_t check_seed(lua_State *L, int arg) {
+    static uint64_t counter = 0;
+
+    assert(L);
+
+    if (!lua_isnoneornil(L, arg)) {
+        return (uint64_t) luaL_checkinteger(L, arg);
+    }
+
+    return splitmix64((uint64_t) time(NULL) ^ ((uint64_t) clock() << 32))
+           ^ splitmix64(__sync_add_and_fetch(&counter, 1));
+}
+
+/* the splitmix64 output function of x + GOLDEN_GAMMA; a bijection */
+static uint64_t splitmix64(uint64_t x) {
+    x += GOLDEN_GAMMA;
+    x = (x ^ (x >> 30)) * U64(0xbf58476d, 0x1ce4e5b9);
+    x = (x ^ (x >> 27)) * U64(0x94d049bb, 0x133111eb);
+
+    return x ^ (x >> 31);
+}
+
+static void seed_chunk(Xoshiro *gen, uint64_t seed, uint64_t chunk) {
+    const uint64_t base = splitmix64(seed ^ splitmix64(chunk));
+    int word;
+    int lane;
+
+    assert(gen);
+
+    for (word = 0; word < 4; ++word) {
+        for (lane = 0; lane < RANDOM_LANES; ++lane) {
+            gen->s[word][lane] =
+                splitmix64(base + (uint64_t) (lane * 4 + word + 1) * GOLDEN_GAMMA);
+        }
+    }
+}
+
+/* one xoshiro256+ step in every lane */
+static void next_batch(Xoshiro *gen, uint64_t out[RANDOM_LANES]) {
+    uint64_t *const s0 = gen->s[0];
+    uint64_t *const s1 = gen->s[1];
+    uint64_t *const s2 = gen->s[2];
+    uint64_t *const s3 = gen->s[3];
+    int j;
+
+    assert(gen);
+    assert(out);
+
+    for (j = 0; j < RANDOM_LANES; ++j) {
+        const uint64_t t = s1[j] << 17;
+
+        out[j] = s0[j] + s3[j];
+        s2[j] ^= s0[j];
+        s3[j] ^= s1[j];
+        s1[j] ^= s2[j];
+        s0[j] ^= s3[j];
+        s2[j] ^= t;
+        s3[j] = (s3[j] << 45) | (s3[j] >> 19);
+    }
+}
+
+static void stream_init(Stream *stream, uint64_t seed) {
+    assert(stream);
+
+    seed_chunk(&stream->gen, seed, 0);
+    stream->next = RANDOM_LANES;
+}
+
+static uint64_t stream_next(Stream *stream) {
+    assert(stream);
+
+    if (stream->next == RANDOM_LANES) {
+        next_batch(&stream->gen, stream->batch);
+        stream->next = 0;
+    }
+
+    return stream->batch[stream->next++];
+}
+
+/* @returns A uniformly distributed integer in [0, n); n must be positive */
+static size_t stream_below(Stream *stream, size_t n) {
+    unsigned shift;
+    uint64_t x;
+
+    assert(stream);
+    assert(n > 0);
+
+    if (n == 1) {
+        return 0;
+    }
+
+    shift = leading_zeros((uint64_t) (n - 1));
+
+    do {
+        x = stream_next(stream) >> shift;
+    } while (x >= (uint64_t) n);
+
+    return (size_t) x;
+}
+
+/* x must be nonzero */
+static unsigned leading_zeros(uint64_t x) {
+    unsigned n = 0;
+
+    assert(x != 0);
+
+    while (!(x & U64(0x80000000, 0))) {
+        x <<= 1;
+        ++n;
+    }
+
+    return n;
+}
+
+/* a + (b - a) * u for u uniform in [0, 1) with 53 random bits */
+static void fill_uniform(lua_Number *data, size_t len, uint64_t seed, lua_Number a, lua_Number b) {
+    const double scale = 1.0 / 9007199254740992.0;
+    const lua_Number width = b - a;
+    uint64_t batch[RANDOM_LANES];
+    Xoshiro gen;
+    size_t chunk;
+    size_t i;
+    int j;
+
+    assert(data || len == 0);
+
+    for (chunk = 0; chunk * RANDOM_CHUNK < len; ++chunk) {
+        const size_t start = chunk * RANDOM_CHUNK;
+        const size_t stop = (len - start < RANDOM_CHUNK) ? len : start + RANDOM_CHUNK;
+
+        seed_chunk(&gen, seed, (uint64_t) chunk);
+
+        for (i = start; i + RANDOM_LANES <= stop; i += RANDOM_LANES) {
+            next_batch(&gen, batch);
+
+            for (j = 0; j < RANDOM_LANES; ++j) {
+                data[i + j] = a + width * (lua_Number) ((double) (batch[j] >> 11) * scale);
+            }
+        }
+
+        if (i < stop) {
+            next_batch(&gen, batch);
+
+            for (j = 0; i < stop; ++i, ++j) {
+                data[i] = a + width * (lua_Number) ((double) (batch[j] >> 11) * scale);
+            }
+        }
+    }
+}
+
+/* Box-Muller, turning each batch into RANDOM_LANES / 2 pairs */
+static void fill_normal(lua_Number *data, size_t len, uint64_t seed, lua_Number mean,
+                        lua_Number sd) {
+    const double scale = 1.0 / 9007199254740992.0;
+    const double two_pi = 6.283185307179586476925286766559;
+    uint64_t batch[RANDOM_LANES];
+    double pairs[RANDOM_LANES];
+    Xoshiro gen;
+    size_t chunk;
+    size_t i;
+    int j;
+
+    assert(data || len == 0);
+
+    for (chunk = 0; chunk * RANDOM_CHUNK < len; ++chunk) {
+        const size_t start = chunk * RANDOM_CHUNK;
+        const size_t stop = (len - start < RANDOM_CHUNK) ? len : start + RANDOM_CHUNK;
+
+        seed_chunk(&gen, seed, (uint64_t) chunk);
+
+        for (i = start; i < stop; ) {
+            next_batch(&gen, batch);
+
+            for (j = 0; j < RANDOM_LANES; j += 2) {
+                /* 1 - u is in (0, 1], so the log is finite */
+                const double r = sqrt(-2.0 * log(1.0 - (double) (batch[j] >> 11) * scale));
+                const double theta = two_pi * (double) (batch[j + 1] >> 11) * scale;
+
+                pairs[j] = r * cos(theta);
+                pairs[j + 1] = r * sin(theta);
+            }
+
+            for (j = 0; j < RANDOM_LANES && i < stop; ++j, ++i) {
+                data[i] = mean + sd * (lua_Number) pairs[j];
+            }
+        }
+    }
+}
+
+/* integers in [a, b], which may be stored in a Vec<number> */
+static void fill_range(TypeVec *tv, uint64_t seed, lua_Integer a, lua_Integer b) {
+    const uint64_t span = (uint64_t) b - (uint64_t) a; /* the range's size minus 1 */
+    const unsigned shift = (span == 0) ? 64 : leading_zeros(span);
+    const size_t len = Vec_len(&tv->vec);
+    const int is_int = tv->typeinfo.type == TP_INT;
+    uint64_t batch[RANDOM_LANES];
+    Xoshiro gen;
+    size_t chunk;
+    size_t i;
+    int j;
+
+    assert(tv);
+
+    for (chunk = 0; chunk * RANDOM_CHUNK < len; ++chunk) {
+        const size_t start = chunk * RANDOM_CHUNK;
+        const size_t stop = (len - start < RANDOM_CHUNK) ? len : start + RANDOM_CHUNK;
+
+        seed_chunk(&gen, seed, (uint64_t) chunk);
+
+        for (i = start; i < stop; ) {
+            next_batch(&gen, batch);
+
+            for (j = 0; j < RANDOM_LANES && i < stop; ++j) {
+                const uint64_t x = (shift == 64) ? 0 : batch[j] >> shift;
+
+                if (x <= span) {
+                    /* wraps around like Lua's integer arithmetic */
+                    const lua_Integer value = (lua_Integer) ((uint64_t) a + x);
+
+                    if (is_int) {
+                        ((lua_Integer*) Vec_as_mut_ptr(&tv->vec))[i++] = value;
+                    } else {
+                        ((lua_Number*) Vec_as_mut_ptr(&tv->vec))[i++] = (lua_Number) value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void swap_elements(char *data, size_t size, size_t i, size_t j) {
+    assert(data);
+
+    if (size == sizeof(uint64_t)) {
+        uint64_t *const x = (uint64_t*) data;
+        const uint64_t tmp = x[i];
+
+        x[i] = x[j];
+        x[j] = tmp;
+    } else {
+        char *const x = data + i * size;
+        char *const y = data + j * size;
+        size_t b;
+
+        for (b = 0; b < size; ++b) {
+            const char tmp = x[b];
+
+            x[b] = y[b];
+            y[b] = tmp;
+        }
+    }
+}
+
+/*
+ *  Draws indices until k distinct ones are found, remembering them in an
+ *  open-addressing hash set. Only used while k is much smaller than the
+ *  Vec, so there are few repeats and no O(n) copy.
+ */
+static void sample_sparse(lua_State *L, const TypeVec *tv, TypeVec *dst, size_t k,
+                          Stream *stream) {
+    const size_t size = tv->vec.element_size;
+    const size_t n = Vec_len(&tv->vec);
+    const char *const src = (const char*) Vec_as_ptr(&tv->vec);
+    char *const data = (char*) Vec_as_mut_ptr(&dst->vec);
+    size_t *set; /* index + 1, or 0 for an empty slot */
+    size_t mask;
+    unsigned bits;
+
+    assert(L);
+    assert(tv);
+    assert(dst);
+    assert(stream);
+
+    for (bits = 1; ((size_t) 1 << bits) < 2 * k; ++bits) { }
+
+    mask = ((size_t) 1 << bits) - 1;
+    set = (size_t*) calloc(mask + 1, sizeof(size_t));
+
+    if (!set) {
+        luaL_error(L, "out of memory");
+    }
+
+    while (Vec_len(&dst->vec) < k) {
+        const size_t index = stream_below(stream, n);
+        size_t slot = (size_t) (((uint64_t) index * GOLDEN_GAMMA) >> (64 - bits)) & mask;
+
+        while (set[slot] != 0 && set[slot] != index + 1) {
+            slot = (slot + 1) & mask;
+        }
+
+        if (set[slot] == 0) {
+            set[slot] = index + 1;
+            memcpy(data + Vec_len(&dst->vec) * size, src + index * size, size);
+            ++dst->vec.len;
+        }
+    }
+
+    free(set);
+}
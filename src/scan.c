@@ -0,0 +1,218 @@
+#include <larr/larr.h>
+
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Prefix scans and lagged differences over number and integer Vecs.
+ *  Each method writes into an optional out Vec of the same type, which
+ *  may be the source itself for an in-place scan, or into a new Vec.
+ *  Integer arithmetic wraps around like Lua's does.
+ */
+
+typedef enum ScanOp {
+    SCAN_SUM,
+    SCAN_PROD,
+    SCAN_MIN,
+    SCAN_MAX,
+    SCAN_EXCLUSIVE_SUM
+} ScanOp;
+
+#define INT_ADD(lhs, rhs) ((lua_Integer) ((lua_Unsigned) (lhs) + (lua_Unsigned) (rhs)))
+#define INT_SUB(lhs, rhs) ((lua_Integer) ((lua_Unsigned) (lhs) - (lua_Unsigned) (rhs)))
+#define INT_MUL(lhs, rhs) ((lua_Integer) ((lua_Unsigned) (lhs) * (lua_Unsigned) (rhs)))
+#define NUM_ADD(lhs, rhs) ((lhs) + (rhs))
+#define NUM_SUB(lhs, rhs) ((lhs) - (rhs))
+#define NUM_MUL(lhs, rhs) ((lhs) * (rhs))
+
+/*
+ *  The running value is carried in a register and every element is read
+ *  before its slot is written, so dst may equal src.
+ */
+#define DEFINE_SCAN(nickname, T, ADD, SUB, MUL) \
+    static void nickname ## _scan(const T *src, T *dst, size_t len, int op) { \
+        size_t i; \
+        T acc; \
+        \
+        if (len == 0) { \
+            return; \
+        } \
+        \
+        switch (op) { \
+        case SCAN_SUM: \
+            for (acc = 0, i = 0; i < len; ++i) { \
+                acc = ADD(acc, src[i]); \
+                dst[i] = acc; \
+            } \
+            break; \
+        case SCAN_PROD: \
+            for (acc = 1, i = 0; i < len; ++i) { \
+                acc = MUL(acc, src[i]); \
+                dst[i] = acc; \
+            } \
+            break; \
+        case SCAN_MIN: \
+            for (acc = src[0], i = 0; i < len; ++i) { \
+                acc = (src[i] < acc) ? src[i] : acc; \
+                dst[i] = acc; \
+            } \
+            break; \
+        case SCAN_MAX: \
+            for (acc = src[0], i = 0; i < len; ++i) { \
+                acc = (src[i] > acc) ? src[i] : acc; \
+                dst[i] = acc; \
+            } \
+            break; \
+        case SCAN_EXCLUSIVE_SUM: \
+            for (acc = 0, i = 0; i < len; ++i) { \
+                const T elem = src[i]; \
+                dst[i] = acc; \
+                acc = ADD(acc, elem); \
+            } \
+            break; \
+        default: \
+            assert(0 && "invalid scan"); \
+        } \
+    } \
+    \
+    static void nickname ## _diff(const T *src, T *dst, size_t len, size_t lag) { \
+        size_t i; \
+        \
+        for (i = 0; i + lag < len; ++i) { \
+            dst[i] = SUB(src[i + lag], src[i]); \
+        } \
+    }
+
+DEFINE_SCAN(num, lua_Number, NUM_ADD, NUM_SUB, NUM_MUL)
+DEFINE_SCAN(int, lua_Integer, INT_ADD, INT_SUB, INT_MUL)
+
+static const TypeVec* check_scannable(lua_State *L, int arg);
+
+static TypeVec* prepare_out(lua_State *L, const TypeVec *tv, int arg, size_t len);
+
+static int scan(lua_State *L, int op);
+
+int l_Vec_cumsum(lua_State *L) {
+    return scan(L, SCAN_SUM);
+}
+
+int l_Vec_cumprod(lua_State *L) {
+    return scan(L, SCAN_PROD);
+}
+
+int l_Vec_cummin(lua_State *L) {
+    return scan(L, SCAN_MIN);
+}
+
+int l_Vec_cummax(lua_State *L) {
+    return scan(L, SCAN_MAX);
+}
+
+int l_Vec_exclusive_cumsum(lua_State *L) {
+    return scan(L, SCAN_EXCLUSIVE_SUM);
+}
+
+int l_Vec_diff(lua_State *L) {
+    const TypeVec *tv;
+    TypeVec *out;
+    size_t src_len;
+    lua_Integer lag;
+
+    assert(L);
+
+    tv = check_scannable(L, 1);
+    lag = luaL_optinteger(L, 2, 1);
+    luaL_argcheck(L, lag >= 1, 2, "lag must be positive");
+
+    /* out may be tv, and preparing it shortens it */
+    src_len = Vec_len(&tv->vec);
+
+    lua_settop(L, 3);
+    out = prepare_out(L, tv, 3, (src_len > (size_t) lag) ? src_len - (size_t) lag : 0);
+
+    if (tv->typeinfo.type == TP_NUM) {
+        num_diff((const lua_Number*) Vec_as_ptr(&tv->vec), (lua_Number*) Vec_as_mut_ptr(&out->vec),
+                 src_len, (size_t) lag);
+    } else {
+        int_diff((const lua_Integer*) Vec_as_ptr(&tv->vec), (lua_Integer*) Vec_as_mut_ptr(&out->vec),
+                 src_len, (size_t) lag);
+    }
+
+    return 1;
+}
+
+static int scan(lua_State *L, int op) {
+    const TypeVec *tv;
+    TypeVec *out;
+
+    assert(L);
+
+    tv = check_scannable(L, 1);
+    lua_settop(L, 2);
+    out = prepare_out(L, tv, 2, Vec_len(&tv->vec));
+
+    /* read the source pointer last; preparing out may have moved it */
+    if (tv->typeinfo.type == TP_NUM) {
+        num_scan((const lua_Number*) Vec_as_ptr(&tv->vec), (lua_Number*) Vec_as_mut_ptr(&out->vec),
+                 Vec_len(&tv->vec), op);
+    } else {
+        int_scan((const lua_Integer*) Vec_as_ptr(&tv->vec), (lua_Integer*) Vec_as_mut_ptr(&out->vec),
+                 Vec_len(&tv->vec), op);
+    }
+
+    return 1;
+}
+
+static const TypeVec* check_scannable(lua_State *L, int arg) {
+    const TypeVec *tv;
+
+    assert(L);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == TP_NUM || tv->typeinfo.type == TP_INT, arg,
+                  "expected larr.Vec<number> or larr.Vec<integer>");
+
+    return tv;
+}
+
+/*
+ *  Pushes the Vec to write len elements into: the Vec at arg, resized to
+ *  len, if there is one, or else a new Vec of length len.
+ */
+static TypeVec* prepare_out(lua_State *L, const TypeVec *tv, int arg, size_t len) {
+    TypeVec *out;
+
+    assert(L);
+    assert(tv);
+
+    if (lua_isnoneornil(L, arg)) {
+        out = new_tv(L, tv->typeinfo, len);
+    } else {
+        out = check_tv_mut(L, arg);
+        luaL_argcheck(L, out->typeinfo.type == tv->typeinfo.type, arg,
+                      "out must have the same element type");
+        lua_pushvalue(L, arg);
+    }
+
+    if (Vec_len(&out->vec) < len) {
+        if (Vec_reserve(&out->vec, len - Vec_len(&out->vec)) != LARR_OK) {
+            luaL_error(L, "out of memory");
+        }
+    }
+
+    out->vec.len = len;
+
+    return out;
+}
@@ -0,0 +1,348 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <larr/larr.h>
+
+#include "storage.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Vecs in POSIX shared memory. One process creates a segment with
+ *  Vec.shared and fills the returned Vec in place; its capacity is fixed
+ *  at creation. v:publish() stores the current length in the segment's
+ *  header and bumps the generation counter. Other processes map the
+ *  segment read-only with Vec.attach, which wraps the published
+ *  elements in a Vec without copying them. An attached Vec is a view,
+ *  not a snapshot: the creator writes in place, so published elements
+ *  it overwrites change in every attached Vec too. Writing to an
+ *  attached Vec first copies it into private memory, like any
+ *  copy-on-write clone. The segment's name lasts until Vec.unlink or
+ *  the next Vec.shared with it.
+ *
+ *  The mapping is reference counted through the Vec's Storage and
+ *  unmapped when the last Vec using it is collected. Cloning the
+ *  creator's Vec copies its elements, since a clone sharing the mapping
+ *  would see the creator's later writes; the same goes for everything
+ *  built on clones, such as save_async.
+ */
+
+#define SHARED_MAGIC "LARRSHM"
+
+#define SHARED_VERSION 1
+
+/* the elements start here, keeping them aligned for any element type */
+#define SHARED_HEADER_SIZE 64
+
+typedef struct SharedHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    char type_name[16];
+    uint64_t capacity;
+    volatile uint64_t len;
+    volatile uint64_t generation;
+} SharedHeader;
+
+typedef struct SharedStorage {
+    Storage storage; /* first, so a Storage* is also a SharedStorage* */
+    void *addr;
+    size_t size;
+} SharedStorage;
+
+static void release_shared(Storage *storage);
+
+static SharedHeader* shared_header(const TypeVec *tv);
+
+static const char* validate_header(const SharedHeader *header, size_t size, int *type);
+
+int l_Vec_shared(lua_State *L) {
+    const char *name;
+    Typeinfo typeinfo;
+    size_t capacity;
+    size_t size;
+    TypeVec *tv;
+    SharedStorage *storage;
+    SharedHeader *header;
+    void *addr;
+    int fd;
+
+    assert(L);
+
+    name = luaL_checkstring(L, 1);
+    typeinfo = check_typeinfo(L, 2);
+    luaL_argcheck(L, typeinfo.type == TP_NUM || typeinfo.type == TP_INT
+                     || typeinfo.type == TP_BOOL, 2,
+                  "expected 'number', 'integer' or 'boolean'");
+    capacity = check_size_t(L, 3);
+    luaL_argcheck(L, capacity <= ((size_t) -1 - SHARED_HEADER_SIZE)
+                                  / sizeof_type_repr(typeinfo.type), 3,
+                  "capacity is too large");
+    size = SHARED_HEADER_SIZE + capacity * sizeof_type_repr(typeinfo.type);
+
+    lua_settop(L, 3);
+    tv = new_tv(L, typeinfo_of(typeinfo.type), 0);
+    storage = (SharedStorage*) malloc(sizeof(SharedStorage));
+
+    if (!storage) {
+        return luaL_error(L, "out of memory");
+    }
+
+    /* the creator owns the name, so a stale segment is replaced */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) {
+        free(storage);
+
+        return luaL_error(L, "couldn't create shared Vec '%s': %s", name, strerror(errno));
+    } else if (ftruncate(fd, (off_t) size) != 0) {
+        const int error_no = errno;
+
+        close(fd);
+        shm_unlink(name);
+        free(storage);
+
+        return luaL_error(L, "couldn't size shared Vec '%s': %s", name, strerror(error_no));
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        const int error_no = errno;
+
+        shm_unlink(name);
+        free(storage);
+
+        return luaL_error(L, "couldn't map shared Vec '%s': %s", name, strerror(error_no));
+    }
+
+    header = (SharedHeader*) addr;
+    memcpy(header->magic, SHARED_MAGIC, sizeof(header->magic));
+    header->version = SHARED_VERSION;
+    header->element_size = (uint32_t) sizeof_type_repr(typeinfo.type);
+    memset(header->type_name, 0, sizeof(header->type_name));
+    strncpy(header->type_name, typeinfo.name.str, sizeof(header->type_name) - 1);
+    header->capacity = capacity;
+    header->len = 0;
+    header->generation = 0;
+
+    storage->storage.refcount = 1;
+    storage->storage.release = release_shared;
+    storage->storage.writable = 1;
+    storage->addr = addr;
+    storage->size = size;
+
+    Vec_delete(&tv->vec);
+    tv->vec.data = (char*) addr + SHARED_HEADER_SIZE;
+    tv->vec.capacity = capacity;
+    tv->vec.external = 1;
+    tv->storage = &storage->storage;
+
+    return 1;
+}
+
+int l_Vec_attach(lua_State *L) {
+    const char *name;
+    const char *error;
+    const SharedHeader *header;
+    TypeVec *tv;
+    SharedStorage *storage;
+    struct stat st;
+    uint64_t generation;
+    uint64_t len;
+    void *addr;
+    int type;
+    int fd;
+
+    assert(L);
+
+    name = luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+
+    fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        return luaL_error(L, "couldn't open shared Vec '%s': %s", name, strerror(errno));
+    } else if (fstat(fd, &st) != 0) {
+        const int error_no = errno;
+
+        close(fd);
+
+        return luaL_error(L, "couldn't open shared Vec '%s': %s", name, strerror(error_no));
+    } else if ((size_t) st.st_size < SHARED_HEADER_SIZE) {
+        close(fd);
+
+        return luaL_error(L, "'%s' is not a shared Vec", name);
+    }
+
+    addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return luaL_error(L, "couldn't map shared Vec '%s': %s", name, strerror(errno));
+    }
+
+    header = (const SharedHeader*) addr;
+    error = validate_header(header, (size_t) st.st_size, &type);
+    storage = error ? NULL : (SharedStorage*) malloc(sizeof(SharedStorage));
+
+    if (error || !storage) {
+        munmap(addr, (size_t) st.st_size);
+
+        return error ? luaL_error(L, "'%s' %s", name, error) : luaL_error(L, "out of memory");
+    }
+
+    /* the length is read after the generation, so it is at least that new */
+    generation = header->generation;
+    __sync_synchronize();
+    len = header->len;
+
+    if (len > header->capacity) {
+        len = header->capacity;
+    }
+
+    storage->storage.refcount = 1;
+    storage->storage.release = release_shared;
+    storage->storage.writable = 0;
+    storage->addr = addr;
+    storage->size = (size_t) st.st_size;
+
+    tv = new_tv(L, typeinfo_of(type), 0);
+    Vec_delete(&tv->vec);
+    tv->vec.data = (char*) addr + SHARED_HEADER_SIZE;
+    tv->vec.len = (size_t) len;
+    tv->vec.capacity = (size_t) len;
+    tv->vec.external = 1;
+    tv->storage = &storage->storage;
+
+    lua_pushinteger(L, (lua_Integer) generation);
+
+    return 2;
+}
+
+/* mapped segments stay valid; only the name goes away */
+int l_Vec_unlink(lua_State *L) {
+    const char *name;
+
+    assert(L);
+
+    name = luaL_checkstring(L, 1);
+
+    if (shm_unlink(name) != 0 && errno != ENOENT) {
+        return luaL_error(L, "couldn't unlink shared Vec '%s': %s", name, strerror(errno));
+    }
+
+    return 0;
+}
+
+int l_Vec_publish(lua_State *L) {
+    const TypeVec *tv;
+    SharedHeader *header;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    header = shared_header(tv);
+    luaL_argcheck(L, header && tv->storage->writable, 1, "expected a Vec from larr.Vec.shared");
+
+    /* the elements must be visible before the length that covers them */
+    __sync_synchronize();
+    header->len = Vec_len(&tv->vec);
+    lua_pushinteger(L, (lua_Integer) (__sync_add_and_fetch(&header->generation, 1)));
+
+    return 1;
+}
+
+int l_Vec_generation(lua_State *L) {
+    const TypeVec *tv;
+    const SharedHeader *header;
+
+    assert(L);
+
+    tv = check_tv(L, 1);
+    header = shared_header(tv);
+
+    if (!header) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, (lua_Integer) header->generation);
+    }
+
+    return 1;
+}
+
+static void release_shared(Storage *storage) {
+    SharedStorage *const shared = (SharedStorage*) storage;
+
+    assert(storage);
+
+    munmap(shared->addr, shared->size);
+    free(shared);
+}
+
+/* @returns NULL if tv isn't backed by a shared memory segment */
+static SharedHeader* shared_header(const TypeVec *tv) {
+    assert(tv);
+
+    if (!tv->storage || tv->storage->release != release_shared) {
+        return NULL;
+    }
+
+    return (SharedHeader*) ((SharedStorage*) tv->storage)->addr;
+}
+
+/*
+ *  @returns NULL if header describes a segment of size bytes, with the
+ *           element type in *type, otherwise what is wrong with it
+ */
+static const char* validate_header(const SharedHeader *header, size_t size, int *type) {
+    static const int types[] = { TP_NUM, TP_INT, TP_BOOL };
+    size_t i;
+
+    assert(header);
+    assert(type);
+
+    if (memcmp(header->magic, SHARED_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SHARED_VERSION) {
+        return "is not a shared Vec";
+    }
+
+    *type = -1;
+
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        if (strncmp(header->type_name, typeinfo_of(types[i]).name.str,
+                    sizeof(header->type_name)) == 0) {
+            *type = types[i];
+        }
+    }
+
+    if (*type < 0 || header->element_size != sizeof_type_repr(*type)) {
+        return "has an unsupported element type";
+    } else if (header->capacity > (size - SHARED_HEADER_SIZE) / header->element_size) {
+        return "is smaller than its header says";
+    }
+
+    return NULL;
+}
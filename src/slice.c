@@ -0,0 +1,87 @@
+#include <larr/larr.h>
+
+#include "slice.h"
+#include "util.h"
+
+#include <assert.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  The quantum is kept in the registry, so each Lua state has its own;
+ *  it starts at 0, which leaves every operation running to completion
+ *  as it did before slicing existed. The cancel sentinel is a light
+ *  userdata, so it compares equal across states and cannot be forged
+ *  from Lua.
+ */
+
+#define QUANTUM_KEY "larr.quantum"
+
+static const char cancel_sentinel = 0;
+
+int l_quantum(lua_State *L) {
+    lua_Integer previous;
+
+    assert(L);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, QUANTUM_KEY);
+    previous = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    if (!lua_isnoneornil(L, 1)) {
+        check_size_t(L, 1);
+        lua_pushvalue(L, 1);
+        lua_setfield(L, LUA_REGISTRYINDEX, QUANTUM_KEY);
+    }
+
+    lua_pushinteger(L, previous);
+
+    return 1;
+}
+
+size_t slice_quantum(lua_State *L) {
+    lua_Integer quantum;
+
+    assert(L);
+
+    if (!lua_isyieldable(L)) {
+        return 0;
+    }
+
+    lua_getfield(L, LUA_REGISTRYINDEX, QUANTUM_KEY);
+    quantum = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    return (size_t) quantum;
+}
+
+int slice_cancelled(lua_State *L, int base) {
+    int cancelled = 0;
+    int i;
+
+    assert(L);
+
+    for (i = base + 1; i <= lua_gettop(L); ++i) {
+        if (lua_touserdata(L, i) == (void*) &cancel_sentinel && lua_islightuserdata(L, i)) {
+            cancelled = 1;
+        }
+    }
+
+    lua_settop(L, base);
+
+    return cancelled;
+}
+
+void push_cancel(lua_State *L) {
+    assert(L);
+
+    lua_pushlightuserdata(L, (void*) &cancel_sentinel);
+}
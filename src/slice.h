@@ -0,0 +1,47 @@
+#ifndef SLICE_H
+#define SLICE_H
+
+#include <stddef.h>
+
+#include <lua.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Cooperative slicing for long-running operations. When a quantum is
+ *  set with larr.quantum and an operation runs in a coroutine that can
+ *  yield, the operation yields with no values after every quantum
+ *  elements and continues where it left off when the coroutine is
+ *  resumed. Resuming it with larr.cancel instead undoes whatever the
+ *  operation had done so far and raises "operation cancelled". The
+ *  operation's Vecs may be changed by other code between slices, so
+ *  each slice checks them again.
+ */
+
+/**
+ *  @param L Must not be NULL.
+ *  @returns The number of elements to process before yielding, or 0 if
+ *           the operation must run to completion because slicing is
+ *           off or L cannot yield.
+ */
+size_t slice_quantum(lua_State *L);
+
+/**
+ *  Called on entry to a continuation after a slice yielded. Removes the
+ *  values passed to coroutine.resume, which were pushed above base.
+ *
+ *  @param L Must not be NULL.
+ *  @returns Nonzero if one of those values was larr.cancel.
+ */
+int slice_cancelled(lua_State *L, int base);
+
+/** Pushes the larr.cancel sentinel. */
+void push_cancel(lua_State *L);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
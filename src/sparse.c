@@ -0,0 +1,533 @@
+#include <larr/larr.h>
+
+#include "storage.h"
+#include "util.h"
+#include "vec.h"
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  A larr.SparseVec is a vector of fixed dimension that only stores its
+ *  nonzero elements, as a Vec<integer> of strictly increasing 1-based
+ *  indices and a parallel Vec of values. Both live in the userdata's
+ *  uservalue table under "indices" and "values". Setting an element to
+ *  zero removes it, so every stored value is nonzero.
+ */
+
+typedef struct SparseVec {
+    size_t dim;
+    int type; /* TP_NUM or TP_INT */
+} SparseVec;
+
+#define INT_ADD(lhs, rhs) ((lua_Integer) ((lua_Unsigned) (lhs) + (lua_Unsigned) (rhs)))
+#define INT_MUL(lhs, rhs) ((lua_Integer) ((lua_Unsigned) (lhs) * (lua_Unsigned) (rhs)))
+#define NUM_ADD(lhs, rhs) ((lhs) + (rhs))
+#define NUM_MUL(lhs, rhs) ((lhs) * (rhs))
+
+/* all kernels run in O(nnz), or O(nnz(a) + nnz(b)) for the merge */
+#define DEFINE_SPARSE(nickname, T, ADD, MUL) \
+    static T nickname ## _dot_dense(const lua_Integer *idx, const T *val, size_t nnz, \
+                                    const T *dense) { \
+        T acc = 0; \
+        size_t k; \
+        \
+        for (k = 0; k < nnz; ++k) { \
+            acc = ADD(acc, MUL(val[k], dense[idx[k] - 1])); \
+        } \
+        \
+        return acc; \
+    } \
+    \
+    static T nickname ## _dot_sparse(const lua_Integer *idx_a, const T *val_a, size_t nnz_a, \
+                                     const lua_Integer *idx_b, const T *val_b, size_t nnz_b) { \
+        T acc = 0; \
+        size_t i = 0; \
+        size_t j = 0; \
+        \
+        while (i < nnz_a && j < nnz_b) { \
+            if (idx_a[i] < idx_b[j]) { \
+                ++i; \
+            } else if (idx_b[j] < idx_a[i]) { \
+                ++j; \
+            } else { \
+                acc = ADD(acc, MUL(val_a[i], val_b[j])); \
+                ++i; \
+                ++j; \
+            } \
+        } \
+        \
+        return acc; \
+    } \
+    \
+    static void nickname ## _axpy(const lua_Integer *idx, const T *val, size_t nnz, T alpha, \
+                                  T *y) { \
+        size_t k; \
+        \
+        for (k = 0; k < nnz; ++k) { \
+            y[idx[k] - 1] = ADD(y[idx[k] - 1], MUL(alpha, val[k])); \
+        } \
+    } \
+    \
+    static void nickname ## _scatter(const lua_Integer *idx, const T *val, size_t nnz, \
+                                     T *dense) { \
+        size_t k; \
+        \
+        for (k = 0; k < nnz; ++k) { \
+            dense[idx[k] - 1] = val[k]; \
+        } \
+    } \
+    \
+    static size_t nickname ## _count_nonzero(const T *dense, size_t len) { \
+        size_t count = 0; \
+        size_t i; \
+        \
+        for (i = 0; i < len; ++i) { \
+            count += (dense[i] != 0); \
+        } \
+        \
+        return count; \
+    } \
+    \
+    static void nickname ## _gather(const T *dense, size_t len, lua_Integer *idx, T *val) { \
+        size_t i; \
+        \
+        for (i = 0; i < len; ++i) { \
+            if (dense[i] != 0) { \
+                *idx++ = (lua_Integer) i + 1; \
+                *val++ = dense[i]; \
+            } \
+        } \
+    }
+
+DEFINE_SPARSE(num, lua_Number, NUM_ADD, NUM_MUL)
+DEFINE_SPARSE(int, lua_Integer, INT_ADD, INT_MUL)
+
+static const SparseVec* check_sparse(lua_State *L, int arg);
+
+static void get_parts(lua_State *L, int arg, TypeVec **indices, TypeVec **values);
+
+static void make_parts_unique(lua_State *L, TypeVec *indices, TypeVec *values);
+
+static size_t check_index(lua_State *L, int arg, const SparseVec *self);
+
+static size_t lower_bound(const TypeVec *indices, size_t index);
+
+static const TypeVec* check_dense(lua_State *L, int arg, const SparseVec *self);
+
+int l_SparseVec_new(lua_State *L) {
+    SparseVec *self;
+    Typeinfo typeinfo;
+    size_t dim;
+
+    assert(L);
+
+    typeinfo = check_typeinfo(L, 1);
+    luaL_argcheck(L, typeinfo.type == TP_NUM || typeinfo.type == TP_INT, 1,
+                  "expected 'number' or 'integer'");
+    dim = check_size_t(L, 2);
+    lua_settop(L, 2);
+
+    self = (SparseVec*) lua_newuserdata(L, sizeof(SparseVec));
+    self->dim = dim;
+    self->type = typeinfo.type;
+    luaL_setmetatable(L, "larr.SparseVec");
+
+    lua_createtable(L, 0, 2);
+    new_tv(L, typeinfo_of(TP_INT), 0);
+    lua_setfield(L, -2, "indices");
+    new_tv(L, typeinfo_of(typeinfo.type), 0);
+    lua_setfield(L, -2, "values");
+    lua_setuservalue(L, -2);
+
+    return 1;
+}
+
+int l_SparseVec_meta_len(lua_State *L) {
+    assert(L);
+
+    push_size_t(L, check_sparse(L, 1)->dim);
+
+    return 1;
+}
+
+int l_SparseVec_nnz(lua_State *L) {
+    TypeVec *indices;
+    TypeVec *values;
+
+    assert(L);
+
+    check_sparse(L, 1);
+    get_parts(L, 1, &indices, &values);
+    push_size_t(L, Vec_len(&indices->vec));
+
+    return 1;
+}
+
+int l_SparseVec_get(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+    size_t index;
+    size_t pos;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    index = check_index(L, 2, self);
+    get_parts(L, 1, &indices, &values);
+    pos = lower_bound(indices, index);
+
+    if (pos < Vec_len(&indices->vec)
+        && *(const lua_Integer*) Vec_get(&indices->vec, pos) == (lua_Integer) index) {
+        values->vtbl->push_elem(values, pos, L);
+    } else if (self->type == TP_NUM) {
+        lua_pushnumber(L, 0);
+    } else {
+        lua_pushinteger(L, 0);
+    }
+
+    return 1;
+}
+
+int l_SparseVec_set(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+    size_t index;
+    size_t pos;
+    lua_Number num;
+    lua_Integer integer;
+    const void *value;
+    int is_zero;
+    int found;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    index = check_index(L, 2, self);
+
+    if (self->type == TP_NUM) {
+        num = luaL_checknumber(L, 3);
+        value = &num;
+        is_zero = (num == 0);
+    } else {
+        integer = luaL_checkinteger(L, 3);
+        value = &integer;
+        is_zero = (integer == 0);
+    }
+
+    get_parts(L, 1, &indices, &values);
+    make_parts_unique(L, indices, values);
+
+    pos = lower_bound(indices, index);
+    found = pos < Vec_len(&indices->vec)
+        && *(const lua_Integer*) Vec_get(&indices->vec, pos) == (lua_Integer) index;
+
+    if (found && is_zero) {
+        Vec_remove(&indices->vec, pos);
+        Vec_remove(&values->vec, pos);
+    } else if (found) {
+        memcpy(Vec_get_mut(&values->vec, pos), value, values->vec.element_size);
+    } else if (!is_zero) {
+        const lua_Integer stored_index = (lua_Integer) index;
+
+        if (Vec_insert(&indices->vec, pos, &stored_index) != LARR_OK) {
+            return luaL_error(L, "out of memory");
+        } else if (Vec_insert(&values->vec, pos, value) != LARR_OK) {
+            Vec_remove(&indices->vec, pos);
+
+            return luaL_error(L, "out of memory");
+        }
+    }
+
+    return 0;
+}
+
+/* returns a copy-on-write clone, so callers cannot break the sorted order */
+static int push_part(lua_State *L, const char *name);
+
+int l_SparseVec_indices(lua_State *L) {
+    return push_part(L, "indices");
+}
+
+int l_SparseVec_values(lua_State *L) {
+    return push_part(L, "values");
+}
+
+int l_SparseVec_to_dense(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+    TypeVec *dense;
+    const lua_Integer *idx;
+    size_t nnz;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    get_parts(L, 1, &indices, &values);
+
+    lua_settop(L, 1);
+    dense = new_tv(L, typeinfo_of(self->type), self->dim);
+    dense->vec.len = self->dim;
+
+    if (self->dim > 0) {
+        memset(Vec_as_mut_ptr(&dense->vec), 0, self->dim * dense->vec.element_size);
+    }
+
+    idx = (const lua_Integer*) Vec_as_ptr(&indices->vec);
+    nnz = Vec_len(&indices->vec);
+
+    if (self->type == TP_NUM) {
+        num_scatter(idx, (const lua_Number*) Vec_as_ptr(&values->vec), nnz,
+                    (lua_Number*) Vec_as_mut_ptr(&dense->vec));
+    } else {
+        int_scatter(idx, (const lua_Integer*) Vec_as_ptr(&values->vec), nnz,
+                    (lua_Integer*) Vec_as_mut_ptr(&dense->vec));
+    }
+
+    return 1;
+}
+
+int l_SparseVec_from_dense(lua_State *L) {
+    const SparseVec *self;
+    const TypeVec *dense;
+    TypeVec *indices;
+    TypeVec *values;
+    size_t nnz;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    dense = check_dense(L, 2, self);
+    get_parts(L, 1, &indices, &values);
+    make_parts_unique(L, indices, values);
+
+    nnz = (self->type == TP_NUM)
+        ? num_count_nonzero((const lua_Number*) Vec_as_ptr(&dense->vec), self->dim)
+        : int_count_nonzero((const lua_Integer*) Vec_as_ptr(&dense->vec), self->dim);
+
+    Vec_clear(&indices->vec);
+    Vec_clear(&values->vec);
+
+    if (Vec_reserve(&indices->vec, nnz) != LARR_OK
+        || Vec_reserve(&values->vec, nnz) != LARR_OK) {
+        return luaL_error(L, "out of memory");
+    }
+
+    if (self->type == TP_NUM) {
+        num_gather((const lua_Number*) Vec_as_ptr(&dense->vec), self->dim,
+                   (lua_Integer*) Vec_as_mut_ptr(&indices->vec),
+                   (lua_Number*) Vec_as_mut_ptr(&values->vec));
+    } else {
+        int_gather((const lua_Integer*) Vec_as_ptr(&dense->vec), self->dim,
+                   (lua_Integer*) Vec_as_mut_ptr(&indices->vec),
+                   (lua_Integer*) Vec_as_mut_ptr(&values->vec));
+    }
+
+    indices->vec.len = nnz;
+    values->vec.len = nnz;
+    lua_settop(L, 1);
+
+    return 1;
+}
+
+int l_SparseVec_dot(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+    const lua_Integer *idx;
+    const void *val;
+    size_t nnz;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    get_parts(L, 1, &indices, &values);
+    idx = (const lua_Integer*) Vec_as_ptr(&indices->vec);
+    val = Vec_as_ptr(&values->vec);
+    nnz = Vec_len(&indices->vec);
+
+    if (luaL_testudata(L, 2, "larr.SparseVec")) {
+        const SparseVec *const other = check_sparse(L, 2);
+        TypeVec *other_indices;
+        TypeVec *other_values;
+        const lua_Integer *other_idx;
+        const void *other_val;
+        size_t other_nnz;
+
+        luaL_argcheck(L, other->type == self->type && other->dim == self->dim, 2,
+                      "SparseVec must have the same type and dimension");
+        get_parts(L, 2, &other_indices, &other_values);
+        other_idx = (const lua_Integer*) Vec_as_ptr(&other_indices->vec);
+        other_val = Vec_as_ptr(&other_values->vec);
+        other_nnz = Vec_len(&other_indices->vec);
+
+        if (self->type == TP_NUM) {
+            lua_pushnumber(L, num_dot_sparse(idx, (const lua_Number*) val, nnz, other_idx,
+                                             (const lua_Number*) other_val, other_nnz));
+        } else {
+            lua_pushinteger(L, int_dot_sparse(idx, (const lua_Integer*) val, nnz, other_idx,
+                                              (const lua_Integer*) other_val, other_nnz));
+        }
+    } else {
+        const TypeVec *const dense = check_dense(L, 2, self);
+
+        if (self->type == TP_NUM) {
+            lua_pushnumber(L, num_dot_dense(idx, (const lua_Number*) val, nnz,
+                                            (const lua_Number*) Vec_as_ptr(&dense->vec)));
+        } else {
+            lua_pushinteger(L, int_dot_dense(idx, (const lua_Integer*) val, nnz,
+                                             (const lua_Integer*) Vec_as_ptr(&dense->vec)));
+        }
+    }
+
+    return 1;
+}
+
+int l_SparseVec_axpy(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+    TypeVec *y;
+    const lua_Integer *idx;
+    size_t nnz;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    check_dense(L, 3, self);
+    y = check_tv_mut(L, 3);
+    get_parts(L, 1, &indices, &values);
+    idx = (const lua_Integer*) Vec_as_ptr(&indices->vec);
+    nnz = Vec_len(&indices->vec);
+
+    if (self->type == TP_NUM) {
+        num_axpy(idx, (const lua_Number*) Vec_as_ptr(&values->vec), nnz, luaL_checknumber(L, 2),
+                 (lua_Number*) Vec_as_mut_ptr(&y->vec));
+    } else {
+        int_axpy(idx, (const lua_Integer*) Vec_as_ptr(&values->vec), nnz, luaL_checkinteger(L, 2),
+                 (lua_Integer*) Vec_as_mut_ptr(&y->vec));
+    }
+
+    lua_settop(L, 3);
+
+    return 1;
+}
+
+int l_SparseVec_meta_tostring(lua_State *L) {
+    const SparseVec *self;
+    TypeVec *indices;
+    TypeVec *values;
+
+    assert(L);
+
+    self = check_sparse(L, 1);
+    get_parts(L, 1, &indices, &values);
+    lua_pushfstring(L, "larr.SparseVec<%s>(dim %I, nnz %I)", values->typeinfo.name.str,
+                    (lua_Integer) self->dim, (lua_Integer) Vec_len(&indices->vec));
+
+    return 1;
+}
+
+static const SparseVec* check_sparse(lua_State *L, int arg) {
+    assert(L);
+
+    return (const SparseVec*) luaL_checkudata(L, arg, "larr.SparseVec");
+}
+
+/* the uservalue keeps both Vecs alive, so nothing is left on the stack */
+static void get_parts(lua_State *L, int arg, TypeVec **indices, TypeVec **values) {
+    assert(L);
+    assert(indices);
+    assert(values);
+
+    lua_getuservalue(L, arg);
+    lua_getfield(L, -1, "indices");
+    *indices = (TypeVec*) lua_touserdata(L, -1);
+    lua_getfield(L, -2, "values");
+    *values = (TypeVec*) lua_touserdata(L, -1);
+    lua_pop(L, 3);
+}
+
+static void make_parts_unique(lua_State *L, TypeVec *indices, TypeVec *values) {
+    assert(L);
+    assert(indices);
+    assert(values);
+
+    if (Storage_make_unique(&indices->vec, &indices->storage) != LARR_OK
+        || Storage_make_unique(&values->vec, &values->storage) != LARR_OK) {
+        luaL_error(L, "out of memory");
+    }
+}
+
+static size_t check_index(lua_State *L, int arg, const SparseVec *self) {
+    size_t index;
+
+    assert(L);
+    assert(self);
+
+    index = check_size_t(L, arg);
+    luaL_argcheck(L, index >= 1 && index <= self->dim, arg, "index out of range");
+
+    return index;
+}
+
+/* the position of the first stored index that is >= index */
+static size_t lower_bound(const TypeVec *indices, size_t index) {
+    const lua_Integer *const idx = (const lua_Integer*) Vec_as_ptr(&indices->vec);
+    size_t lo = 0;
+    size_t hi = Vec_len(&indices->vec);
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (idx[mid] < (lua_Integer) index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static const TypeVec* check_dense(lua_State *L, int arg, const SparseVec *self) {
+    const TypeVec *tv;
+
+    assert(L);
+    assert(self);
+
+    tv = check_tv(L, arg);
+    luaL_argcheck(L, tv->typeinfo.type == self->type, arg, "Vec must have the same element type");
+    luaL_argcheck(L, Vec_len(&tv->vec) == self->dim, arg, "Vec length must equal the dimension");
+
+    return tv;
+}
+
+static int push_part(lua_State *L, const char *name) {
+    assert(L);
+    assert(name);
+
+    check_sparse(L, 1);
+    lua_settop(L, 1);
+
+    lua_pushcfunction(L, l_Vec_clone);
+    lua_getuservalue(L, 1);
+    lua_getfield(L, -1, name);
+    lua_remove(L, -2);
+    lua_call(L, 1, 1);
+
+    return 1;
+}
@@ -0,0 +1,130 @@
+#include "storage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ *  Initializes clone to share self's buffer, creating self's Storage if
+ *  self owned its buffer outright. Nothing is copied, unless self's
+ *  buffer is writable in place; then clone gets a private copy, since
+ *  sharing it would let writes through self show up in the clone.
+ *
+ *  @returns LARR_NO_MEMORY if malloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Storage_clone(Vec *self, Storage **self_storage, Vec *clone, Storage **clone_storage) {
+    assert(self);
+    assert(self_storage);
+    assert(clone);
+    assert(clone_storage);
+
+    if (*self_storage && (*self_storage)->writable) {
+        void *const data = malloc(self->len * self->element_size);
+
+        if (!data && self->len > 0) {
+            return LARR_NO_MEMORY;
+        }
+
+        if (self->len > 0) {
+            memcpy(data, self->data, self->len * self->element_size);
+        }
+
+        *clone = *self;
+        clone->data = data;
+        clone->capacity = self->len;
+        clone->external = 0;
+        *clone_storage = NULL;
+
+        return LARR_OK;
+    } else if (!*self_storage) {
+        Storage *const storage = (Storage*) malloc(sizeof(Storage));
+
+        if (!storage) {
+            return LARR_NO_MEMORY;
+        }
+
+        storage->refcount = 1;
+        storage->release = NULL;
+        storage->writable = 0;
+        *self_storage = storage;
+    }
+
+    __sync_add_and_fetch(&(*self_storage)->refcount, 1);
+
+    *clone = *self;
+    *clone_storage = *self_storage;
+
+    return LARR_OK;
+}
+
+/**
+ *  Ensures that self is the only owner of its buffer, copying the
+ *  buffer if it is shared or external. Afterwards *storage is NULL,
+ *  unless the buffer is external and writable, which is left in place.
+ *
+ *  @returns LARR_NO_MEMORY if malloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Storage_make_unique(Vec *self, Storage **storage) {
+    void *data;
+
+    assert(self);
+    assert(storage);
+
+    if (!*storage || (*storage)->writable) {
+        return LARR_OK;
+    } else if (__sync_fetch_and_add(&(*storage)->refcount, 0) == 1 && !(*storage)->release) {
+        free(*storage);
+        *storage = NULL;
+
+        return LARR_OK;
+    }
+
+    data = malloc(self->capacity * self->element_size);
+
+    if (!data && self->capacity > 0) {
+        return LARR_NO_MEMORY;
+    }
+
+    if (self->len > 0) {
+        memcpy(data, self->data, self->len * self->element_size);
+    }
+
+    if (__sync_sub_and_fetch(&(*storage)->refcount, 1) == 0) {
+        /* another thread dropped its reference while this one copied */
+        if ((*storage)->release) {
+            (*storage)->release(*storage);
+        } else {
+            free(self->data);
+            free(*storage);
+        }
+    }
+
+    *storage = NULL;
+    self->data = data;
+    self->external = 0;
+
+    return LARR_OK;
+}
+
+/**
+ *  Drops self's reference to its buffer, freeing the buffer if no other
+ *  Vec shares it, and leaves self with length and capacity 0.
+ */
+void Storage_release(Vec *self, Storage **storage) {
+    assert(self);
+    assert(storage);
+
+    if (*storage && __sync_sub_and_fetch(&(*storage)->refcount, 1) > 0) {
+        Vec_new(self, self->element_size);
+    } else if (*storage && (*storage)->release) {
+        (*storage)->release(*storage);
+        Vec_new(self, self->element_size);
+    } else {
+        free(*storage);
+        Vec_delete(self);
+    }
+
+    *storage = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "vec.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  A reference count for a Vec buffer that is shared between several
+ *  Vecs. A Vec with no Storage owns its buffer outright; a Vec with a
+ *  Storage must call Storage_make_unique before writing to its buffer
+ *  or changing its capacity.
+ *
+ *  An external buffer, such as a memory mapping, has a Storage with a
+ *  release function, which frees the buffer and the Storage once the
+ *  last reference is dropped. Such a buffer is copied before it is
+ *  written to, even by its only owner, unless it is writable; a
+ *  writable one is written in place and every sharer sees the change.
+ *
+ *  The reference count is updated atomically, so Vecs in lua_States on
+ *  different threads may share a Storage (see Vec:share).
+ */
+typedef struct Storage {
+    size_t refcount;
+    void (*release)(struct Storage *self); /* NULL for malloc()ed buffers */
+    int writable;
+} Storage;
+
+/**
+ *  Initializes clone to share self's buffer, creating self's Storage if
+ *  self owned its buffer outright. Nothing is copied, unless self's
+ *  buffer is external and writable; then clone gets a private copy of
+ *  its elements, so that it stays a snapshot.
+ *
+ *  @param self Must not be NULL.
+ *  @param self_storage Must not be NULL. Points to self's Storage,
+ *                      which may be NULL.
+ *  @param clone Must not be NULL. Is overwritten.
+ *  @param clone_storage Must not be NULL. Receives clone's Storage.
+ *  @returns LARR_NO_MEMORY if malloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Storage_clone(Vec *self, Storage **self_storage, Vec *clone, Storage **clone_storage);
+
+/**
+ *  Ensures that self is the only owner of its buffer, copying the
+ *  buffer if it is shared or external. Afterwards *storage is NULL,
+ *  unless the buffer is external and writable, which is left in place.
+ *
+ *  @param self Must not be NULL.
+ *  @param storage Must not be NULL. Points to self's Storage, which
+ *                 may be NULL.
+ *  @returns LARR_NO_MEMORY if malloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Storage_make_unique(Vec *self, Storage **storage);
+
+/**
+ *  Drops self's reference to its buffer, freeing the buffer if no other
+ *  Vec shares it, and leaves self with length and capacity 0.
+ *
+ *  @param self Must not be NULL.
+ *  @param storage Must not be NULL. Points to self's Storage, which
+ *                 may be NULL. Afterwards *storage is NULL.
+ */
+void Storage_release(Vec *self, Storage **storage);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -113,26 +113,13 @@ Typeinfo check_typeinfo(lua_State *L, int arg) {
     return typeinfo;
 }
 
-const TypeVec* check_tv(lua_State *L, int arg) {
-    assert(L);
-
-    return (const TypeVec*) luaL_checkudata(L, arg, "larr.Vec");
-}
-
-TypeVec* check_tv_mut(lua_State *L, int arg) {
-    assert(L);
-
-    return (TypeVec*) luaL_checkudata(L, arg, "larr.Vec");
-}
-
-TypeVec* test_tv_mut(lua_State *L, int arg) {
-    assert(L);
+Typeinfo typeinfo_of(int type) {
+    #define X(tag, repr, nickname, string) \
+        case tag: typeinfo.name.str = string; typeinfo.name.len = sizeof(string) - 1; break;
 
-    return (TypeVec*) luaL_testudata(L, arg, "larr.Vec");
-}
+    Typeinfo typeinfo;
 
-const Vtbl* get_vtbl(int type) {
-    #define X(name, type, nickname, string) case name: return nickname ## _vtbl();
+    typeinfo.type = type;
 
     switch ((Type) type) {
         TYPES
@@ -141,104 +128,363 @@ const Vtbl* get_vtbl(int type) {
 
     #undef X
 
-    return NULL;
+    return typeinfo;
 }
 
-static void noop_clear(TypeVec *tv, lua_State*);
-
-static void unref_clear(TypeVec *tv, lua_State *L);
+const TypeVec* check_tv(lua_State *L, int arg) {
+    assert(L);
 
-static void simple_truncate(TypeVec *tv, size_t len, lua_State *L);
+    return (const TypeVec*) luaL_checkudata(L, arg, "larr.Vec");
+}
 
-static void unref_truncate(TypeVec *tv, size_t len, lua_State *L);
+static void make_unique(TypeVec *tv, lua_State *L);
 
-static void num_push(TypeVec *tv, lua_State *L);
+TypeVec* check_tv_mut(lua_State *L, int arg) {
+    TypeVec *tv;
 
-static int num_try_push(TypeVec *tv, lua_State *L);
+    assert(L);
 
-static void num_insert(TypeVec *tv, size_t index, lua_State *L);
+    tv = (TypeVec*) luaL_checkudata(L, arg, "larr.Vec");
+    make_unique(tv, L);
 
-static void num_set_elem(TypeVec *tv, size_t index, lua_State *L);
+    return tv;
+}
 
-static void num_first(const TypeVec *tv, lua_State *L);
+TypeVec* test_tv_mut(lua_State *L, int arg) {
+    TypeVec *tv;
 
-static void num_last(const TypeVec *tv, lua_State *L);
+    assert(L);
 
-static void num_push_elem(const TypeVec *tv, size_t index, lua_State *L);
+    tv = (TypeVec*) luaL_testudata(L, arg, "larr.Vec");
 
-const Vtbl* num_vtbl(void) {
-    static const Vtbl vtbl = {
-        num_push,
-        num_try_push,
-        num_insert,
-        noop_clear,
-        num_set_elem,
-        num_first,
-        num_last,
-        num_push_elem,
-        simple_truncate
-    };
+    if (tv) {
+        make_unique(tv, L);
+    }
 
-    return &vtbl;
+    return tv;
 }
 
-static void int_push(TypeVec *tv, lua_State *L);
+TypeVec* new_tv(lua_State *L, Typeinfo typeinfo, size_t capacity) {
+    const Vtbl *vtbl;
+    TypeVec *tv;
 
-static int int_try_push(TypeVec *tv, lua_State *L);
+    assert(L);
 
-static void int_insert(TypeVec *tv, size_t index, lua_State *L);
+    vtbl = get_vtbl(typeinfo.type);
 
-static void int_set_elem(TypeVec *tv, size_t index, lua_State *L);
+    if (!vtbl) {
+        luaL_error(L, "larr.Vec<%s> is not supported", typeinfo.name.str);
+    }
 
-static void int_first(const TypeVec *tv, lua_State *L);
+    tv = (TypeVec*) lua_newuserdata(L, sizeof(TypeVec));
 
-static void int_last(const TypeVec *tv, lua_State *L);
+    if (Vec_with_capacity(&tv->vec, sizeof_type_repr(typeinfo.type), capacity) != LARR_OK) {
+        luaL_error(L, "couldn't allocate space for %I elements", (lua_Integer) capacity);
+    }
 
-static void int_push_elem(const TypeVec *tv, size_t index, lua_State *L);
+    tv->typeinfo = typeinfo;
+    tv->vtbl = vtbl;
+    tv->storage = NULL;
 
-const Vtbl* int_vtbl(void) {
-    static const Vtbl vtbl = {
-        int_push,
-        int_try_push,
-        int_insert,
-        noop_clear,
-        int_set_elem,
-        int_first,
-        int_last,
-        int_push_elem,
-        simple_truncate
-    };
+    luaL_setmetatable(L, "larr.Vec");
 
-    return &vtbl;
+    return tv;
 }
 
-const Vtbl* bool_vtbl(void) {
-    return NULL;
-}
+const Vtbl* get_vtbl(int type) {
+    #define X(name, type, nickname, string) case name: return nickname ## _vtbl();
 
-const Vtbl* str_vtbl(void) {
-    return NULL;
-}
+    switch ((Type) type) {
+        TYPES
+        default: assert(0 && "invalid argument passed");
+    }
 
-const Vtbl* tbl_vtbl(void) {
-    return NULL;
-}
+    #undef X
 
-const Vtbl* fn_vtbl(void) {
     return NULL;
 }
 
-const Vtbl* userdata_vtbl(void) {
-    return NULL;
-}
+static void make_unique(TypeVec *tv, lua_State *L) {
+    assert(tv);
+    assert(L);
 
-const Vtbl* thread_vtbl(void) {
-    return NULL;
+    if (Storage_make_unique(&tv->vec, &tv->storage) != LARR_OK) {
+        luaL_error(L, "out of memory");
+    }
 }
 
-const Vtbl* light_userdata_vtbl(void) {
-    return NULL;
-}
+static void noop_clear(TypeVec *tv, lua_State*);
+
+static void unref_clear(TypeVec *tv, lua_State *L);
+
+static void simple_truncate(TypeVec *tv, size_t len, lua_State *L);
+
+static void unref_truncate(TypeVec *tv, size_t len, lua_State *L);
+
+static uint8_t test_boolean(lua_State *L, int arg, int *is_boolean);
+
+static uint8_t check_boolean(lua_State *L, int arg);
+
+static void* test_light_userdata(lua_State *L, int arg, int *is_light_userdata);
+
+static void* check_light_userdata(lua_State *L, int arg);
+
+/*
+ *  Per-type traits for the value types, whose elements are stored
+ *  inline and need no registry references. TEST converts the value at
+ *  an index and reports whether it had the right type, CHECK raises an
+ *  argument error instead, and PUSH pushes an element.
+ */
+#define num_TEST(L, i, ok) lua_tonumberx(L, i, ok)
+#define num_CHECK(L, i) luaL_checknumber(L, i)
+#define num_PUSH(L, x) lua_pushnumber(L, x)
+
+#define int_TEST(L, i, ok) lua_tointegerx(L, i, ok)
+#define int_CHECK(L, i) luaL_checkinteger(L, i)
+#define int_PUSH(L, x) lua_pushinteger(L, x)
+
+#define bool_TEST(L, i, ok) test_boolean(L, i, ok)
+#define bool_CHECK(L, i) check_boolean(L, i)
+#define bool_PUSH(L, x) lua_pushboolean(L, (int) (x))
+
+#define light_userdata_TEST(L, i, ok) test_light_userdata(L, i, ok)
+#define light_userdata_CHECK(L, i) check_light_userdata(L, i)
+#define light_userdata_PUSH(L, x) lua_pushlightuserdata(L, x)
+
+/*
+ *  Each entry of TYPES expands to nickname_IMPL, which either defines a
+ *  full vtbl from the traits above or, for types whose elements would
+ *  need registry references, a vtbl getter that returns NULL.
+ */
+#define VALUE_VTBL(T, nickname, string) \
+    /* a typedef, so that const applies to the element for pointer types */ \
+    typedef T nickname ## _elem; \
+    \
+    static int nickname ## _try_push(TypeVec *tv, lua_State *L) { \
+        nickname ## _elem elem; \
+        int ok; \
+        \
+        assert(tv); \
+        assert(L); \
+        \
+        elem = (nickname ## _elem) nickname ## _TEST(L, -1, &ok); \
+        \
+        if (!ok) { \
+            return PE_INVALID_TYPE; \
+        } else if (Vec_push(&tv->vec, &elem) != LARR_OK) { \
+            return PE_NO_MEMORY; \
+        } \
+        \
+        return PE_OK; \
+    } \
+    \
+    static void nickname ## _push(TypeVec *tv, lua_State *L) { \
+        int res; \
+        \
+        assert(tv); \
+        assert(L); \
+        \
+        res = nickname ## _try_push(tv, L); \
+        \
+        if (res == PE_NO_MEMORY) { \
+            luaL_error(L, "out of memory"); \
+        } else if (res == PE_INVALID_TYPE) { \
+            const char *const type = luaL_typename(L, 2); \
+            \
+            luaL_error(L, "bad argument #2 to 'l_Vec_push' (expected " string ", got %s)", \
+                       type); \
+        } \
+    } \
+    \
+    static void nickname ## _insert(TypeVec *tv, size_t index, lua_State *L) { \
+        nickname ## _elem elem; \
+        int ret; \
+        \
+        assert(tv); \
+        assert(L); \
+        \
+        elem = (nickname ## _elem) nickname ## _CHECK(L, -1); \
+        ret = Vec_insert(&tv->vec, index, &elem); \
+        \
+        if (ret == LARR_NO_MEMORY) { \
+            luaL_error(L, "out of memory"); \
+        } else if (ret == LARR_OUT_OF_RANGE) { \
+            luaL_error(L, "index %I out of range", (lua_Integer) index); \
+        } \
+    } \
+    \
+    static void nickname ## _set_elem(TypeVec *tv, size_t index, lua_State *L) { \
+        nickname ## _elem elem; \
+        nickname ## _elem *elem_ptr; \
+        \
+        assert(tv); \
+        assert(L); \
+        \
+        elem = (nickname ## _elem) nickname ## _CHECK(L, -1); \
+        elem_ptr = (nickname ## _elem*) Vec_get_mut(&tv->vec, index); \
+        \
+        if (elem_ptr) { \
+            *elem_ptr = elem; \
+        } else { \
+            luaL_error(L, "index %I out of range", (lua_Integer) index); \
+        } \
+    } \
+    \
+    static void nickname ## _push_elem(const TypeVec *tv, size_t index, lua_State *L) { \
+        const nickname ## _elem *elem_ptr; \
+        \
+        assert(tv); \
+        assert(L); \
+        \
+        elem_ptr = (const nickname ## _elem*) Vec_get(&tv->vec, index); \
+        \
+        if (elem_ptr) { \
+            nickname ## _PUSH(L, *elem_ptr); \
+        } else { \
+            lua_pushnil(L); \
+        } \
+    } \
+    \
+    static void nickname ## _first(const TypeVec *tv, lua_State *L) { \
+        nickname ## _push_elem(tv, 0, L); \
+    } \
+    \
+    static void nickname ## _last(const TypeVec *tv, lua_State *L) { \
+        assert(tv); \
+        \
+        nickname ## _push_elem(tv, Vec_len(&tv->vec) - 1, L); \
+    } \
+    \
+    static int nickname ## _push_many_from_table(TypeVec *tv, int arg, lua_Integer first, \
+                                                 size_t max, lua_Integer *next, lua_State *L) { \
+        lua_Integer i; \
+        size_t pushed; \
+        nickname ## _elem *data; \
+        \
+        assert(tv); \
+        assert(next); \
+        assert(L); \
+        \
+        /* the border is only a hint, since the loop stops at the first nil */ \
+        if (first == 1 && Vec_reserve(&tv->vec, (size_t) lua_rawlen(L, arg)) != LARR_OK) { \
+            *next = first; \
+            \
+            return PE_NO_MEMORY; \
+        } \
+        \
+        data = (nickname ## _elem*) Vec_as_mut_ptr(&tv->vec); \
+        \
+        for (i = first, pushed = 0; pushed < max && lua_rawgeti(L, arg, i) != LUA_TNIL; \
+             ++i, ++pushed) { \
+            int ok; \
+            const nickname ## _elem elem = (nickname ## _elem) nickname ## _TEST(L, -1, &ok); \
+            \
+            lua_pop(L, 1); \
+            \
+            if (!ok) { \
+                *next = i; \
+                \
+                return PE_INVALID_TYPE; \
+            } else if (Vec_len(&tv->vec) == Vec_capacity(&tv->vec)) { \
+                if (Vec_reserve(&tv->vec, 1) != LARR_OK) { \
+                    *next = i; \
+                    \
+                    return PE_NO_MEMORY; \
+                } \
+                \
+                data = (nickname ## _elem*) Vec_as_mut_ptr(&tv->vec); \
+            } \
+            \
+            data[tv->vec.len++] = elem; \
+        } \
+        \
+        if (pushed < max) { \
+            lua_pop(L, 1); \
+        } \
+        \
+        *next = i; \
+        \
+        return PE_OK; \
+    } \
+    \
+    static void nickname ## _push_range_to_stack(const TypeVec *tv, size_t start, size_t count, \
+                                                 lua_State *L) { \
+        const nickname ## _elem *data; \
+        size_t i; \
+        \
+        assert(tv); \
+        assert(start + count <= Vec_len(&tv->vec)); \
+        assert(L); \
+        \
+        data = (const nickname ## _elem*) Vec_as_ptr(&tv->vec) + start; \
+        \
+        for (i = 0; i < count; ++i) { \
+            nickname ## _PUSH(L, data[i]); \
+        } \
+    } \
+    \
+    static int nickname ## _fill(TypeVec *tv, size_t start, size_t stop, int arg, lua_State *L) { \
+        nickname ## _elem *data; \
+        nickname ## _elem elem; \
+        size_t i; \
+        int ok; \
+        \
+        assert(tv); \
+        assert(stop <= Vec_len(&tv->vec)); \
+        assert(L); \
+        \
+        elem = (nickname ## _elem) nickname ## _TEST(L, arg, &ok); \
+        \
+        if (!ok) { \
+            return PE_INVALID_TYPE; \
+        } \
+        \
+        data = (nickname ## _elem*) Vec_as_mut_ptr(&tv->vec); \
+        \
+        for (i = start; i < stop; ++i) { \
+            data[i] = elem; \
+        } \
+        \
+        return PE_OK; \
+    } \
+    \
+    const Vtbl* nickname ## _vtbl(void) { \
+        static const Vtbl vtbl = { \
+            nickname ## _push, \
+            nickname ## _try_push, \
+            nickname ## _insert, \
+            noop_clear, \
+            nickname ## _set_elem, \
+            nickname ## _first, \
+            nickname ## _last, \
+            nickname ## _push_elem, \
+            simple_truncate, \
+            nickname ## _push_many_from_table, \
+            nickname ## _push_range_to_stack, \
+            nickname ## _fill \
+        }; \
+        \
+        return &vtbl; \
+    }
+
+#define NULL_VTBL(T, nickname, string) \
+    const Vtbl* nickname ## _vtbl(void) { \
+        return NULL; \
+    }
+
+#define num_IMPL VALUE_VTBL
+#define int_IMPL VALUE_VTBL
+#define bool_IMPL VALUE_VTBL
+#define str_IMPL NULL_VTBL
+#define tbl_IMPL NULL_VTBL
+#define fn_IMPL NULL_VTBL
+#define userdata_IMPL NULL_VTBL
+#define thread_IMPL NULL_VTBL
+#define light_userdata_IMPL VALUE_VTBL
+
+#define X(tag, repr, nickname, string) nickname ## _IMPL(repr, nickname, string)
+TYPES
+#undef X
 
 static void noop_clear(TypeVec *tv, lua_State *L) { }
 
@@ -288,237 +534,38 @@ static void unref_truncate(TypeVec *tv, size_t len, lua_State *L) {
     }
 }
 
-static void num_push(TypeVec *tv, lua_State *L) {
-    int res;
-
-    assert(tv);
+static uint8_t test_boolean(lua_State *L, int arg, int *is_boolean) {
     assert(L);
+    assert(is_boolean);
 
-    res = num_try_push(tv, L);
-
-    if (res == PE_NO_MEMORY) {
-        luaL_error(L, "out of memory");
-    } else if (res == PE_INVALID_TYPE) {
-        const char *const type = luaL_typename(L, 2);
+    *is_boolean = lua_isboolean(L, arg);
 
-        luaL_error(L, "bad argument #2 to 'l_Vec_push' (expected number, got %s)", type);
-    }
+    return (uint8_t) lua_toboolean(L, arg);
 }
 
-static int num_try_push(TypeVec *tv, lua_State *L) {
-    lua_Number num;
-    int is_number;
-
-    assert(tv);
+static uint8_t check_boolean(lua_State *L, int arg) {
     assert(L);
 
-    num = lua_tonumberx(L, -1, &is_number);
+    luaL_checktype(L, arg, LUA_TBOOLEAN);
 
-    if (!is_number) {
-        return PE_INVALID_TYPE;
-    }
-
-    if (Vec_push(&tv->vec, &num) != LARR_OK) {
-        return PE_NO_MEMORY;
-    }
-
-    return PE_OK;
+    return (uint8_t) lua_toboolean(L, arg);
 }
 
-static void num_insert(TypeVec *tv, size_t index, lua_State *L) {
-    lua_Number num;
-    int ret;
-
-    assert(tv);
+static void* test_light_userdata(lua_State *L, int arg, int *is_light_userdata) {
     assert(L);
+    assert(is_light_userdata);
 
-    num = luaL_checknumber(L, 3);
-    ret = Vec_insert(&tv->vec, index, &num);
+    *is_light_userdata = lua_islightuserdata(L, arg);
 
-    if (ret == LARR_NO_MEMORY) {
-        luaL_error(L, "out of memory");
-    } else if (ret == LARR_OUT_OF_RANGE) {
-        luaL_error(L, "index %lu out of range", (unsigned long) index);
-    }
+    return lua_touserdata(L, arg);
 }
 
-static void num_set_elem(TypeVec *tv, size_t index, lua_State *L) {
-    lua_Number num;
-    lua_Number *num_ptr;
-
-    assert(tv);
+static void* check_light_userdata(lua_State *L, int arg) {
     assert(L);
 
-    num = luaL_checkinteger(L, -1);
-    num_ptr = (lua_Number*) Vec_get_mut(&tv->vec, index);
-
-    if (num_ptr) {
-        *num_ptr = num;
-    } else {
-        luaL_error(L, "index %lu out of range", (unsigned long) index);
-    }
-}
+    luaL_checktype(L, arg, LUA_TLIGHTUSERDATA);
 
-static void num_first(const TypeVec *tv, lua_State *L) {
-    const lua_Number *first_ptr;
-
-    assert(tv);
-    assert(L);
-
-    first_ptr = Vec_first(&tv->vec);
-
-    if (first_ptr) {
-        lua_pushnumber(L, *first_ptr);
-    } else {
-        lua_pushnil(L);
-    }
-}
-
-static void num_last(const TypeVec *tv, lua_State *L) {
-    const lua_Number *last_ptr;
-
-    assert(tv);
-    assert(L);
-
-    last_ptr = Vec_last(&tv->vec);
-
-    if (last_ptr) {
-        lua_pushnumber(L, *last_ptr);
-    } else {
-        lua_pushnil(L);
-    }
-}
-
-static void num_push_elem(const TypeVec *tv, size_t index, lua_State *L) {
-    const lua_Number *num_ptr;
-
-    assert(tv);
-    assert(L);
-
-    num_ptr = Vec_get(&tv->vec, index);
-
-    if (num_ptr) {
-        lua_pushnumber(L, *num_ptr);
-    } else {
-        lua_pushnil(L);
-    }
-}
-
-static void int_push(TypeVec *tv, lua_State *L) {
-    int res;
-
-    assert(tv);
-    assert(L);
-
-    res = int_try_push(tv, L);
-
-    if (res == PE_NO_MEMORY) {
-        luaL_error(L, "out of memory");
-    } else if (res == PE_INVALID_TYPE) {
-        const char *const type = luaL_typename(L, 2);
-
-        luaL_error(L, "bad argument #2 to 'l_Vec_push' (expected integer, got %s)", type);
-    }
-}
-
-static int int_try_push(TypeVec *tv, lua_State *L) {
-    lua_Integer integer;
-    int is_integer;
-
-    assert(tv);
-    assert(L);
-
-    integer = lua_tointegerx(L, -1, &is_integer);
-
-    if (!is_integer) {
-        return PE_INVALID_TYPE;
-    }
-
-    if (Vec_push(&tv->vec, &integer) != LARR_OK) {
-        return PE_NO_MEMORY;
-    }
-
-    return PE_OK;
-}
-
-static void int_insert(TypeVec *tv, size_t index, lua_State *L) {
-    lua_Integer integer;
-    int ret;
-
-    assert(tv);
-    assert(L);
-
-    integer = luaL_checkinteger(L, -1);
-    ret = Vec_insert(&tv->vec, index, &integer);
-
-    if (ret == LARR_NO_MEMORY) {
-        luaL_error(L, "out of memory");
-    } else if (ret == LARR_OUT_OF_RANGE) {
-        luaL_error(L, "index %lu out of range", (unsigned long) index);
-    }
-}
-
-static void int_set_elem(TypeVec *tv, size_t index, lua_State *L) {
-    lua_Integer integer;
-    lua_Integer *int_ptr;
-
-    assert(tv);
-    assert(L);
-
-    index = check_size_t(L, -2);
-    integer = luaL_checkinteger(L, -1);
-    int_ptr = (lua_Integer*) Vec_get_mut(&tv->vec, index);
-
-    if (int_ptr) {
-        *int_ptr = integer;
-    } else {
-        luaL_error(L, "index %lu out of range", (unsigned long) index);
-    }
-}
-
-static void int_first(const TypeVec *tv, lua_State *L) {
-    const lua_Integer *first_ptr;
-
-    assert(tv);
-    assert(L);
-
-    first_ptr = Vec_first(&tv->vec);
-
-    if (first_ptr) {
-        lua_pushinteger(L, *first_ptr);
-    } else {
-        lua_pushnil(L);
-    }
-}
-
-static void int_last(const TypeVec *tv, lua_State *L) {
-    const lua_Integer *last_ptr;
-
-    assert(tv);
-    assert(L);
-
-    last_ptr = Vec_last(&tv->vec);
-
-    if (last_ptr) {
-        lua_pushinteger(L, *last_ptr);
-    } else {
-        lua_pushnil(L);
-    }
-}
-
-static void int_push_elem(const TypeVec *tv, size_t index, lua_State *L) {
-    const lua_Integer *int_ptr;
-
-    assert(tv);
-    assert(L);
-
-    int_ptr = Vec_get(&tv->vec, index);
-
-    if (int_ptr) {
-        lua_pushinteger(L, *int_ptr);
-    } else {
-        lua_pushnil(L);
-    }
+    return lua_touserdata(L, arg);
 }
 
 static int can_cast_to_size_t(lua_Integer x) {
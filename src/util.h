@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "storage.h"
 #include "vec.h"
 
 #include <stddef.h>
@@ -59,12 +60,27 @@ typedef struct Vtbl {
     void (*last)(const TypeVec*, lua_State*);
     void (*push_elem)(const TypeVec*, size_t, lua_State*);
     void (*truncate)(TypeVec*, size_t, lua_State*);
+
+    /*
+     *  Bulk entries, one tight loop per type. push_many_from_table
+     *  pushes t[first], t[first + 1], ... from the table at arg, stopping
+     *  at the first nil or after max elements; *next is the key after the
+     *  last one pushed or, on failure, the offending key, and the
+     *  elements before it stay pushed. push_range_to_stack pushes count
+     *  elements from start; the caller checks the stack space. fill sets
+     *  [start, stop) to the value at arg.
+     */
+    int (*push_many_from_table)(TypeVec*, int arg, lua_Integer first, size_t max,
+                                lua_Integer *next, lua_State*);
+    void (*push_range_to_stack)(const TypeVec*, size_t start, size_t count, lua_State*);
+    int (*fill)(TypeVec*, size_t start, size_t stop, int arg, lua_State*);
 } Vtbl;
 
 struct TypeVec {
     Vec vec;
     Typeinfo typeinfo;
     const Vtbl *vtbl;
+    Storage *storage; /* non-NULL if vec's buffer may be shared with a clone */
 };
 
 size_t sizeof_type_repr(int type);
@@ -79,12 +95,29 @@ int String_cmp(const String *lhs, const String *rhs);
 
 Typeinfo check_typeinfo(lua_State *L, int arg);
 
+/** @returns The Typeinfo for type, naming it with a static string. */
+Typeinfo typeinfo_of(int type);
+
 const TypeVec* check_tv(lua_State *L, int arg);
 
+/**
+ *  Checks that arg is a larr.Vec that is about to be modified. If its
+ *  buffer is shared with a clone, the buffer is copied first.
+ */
 TypeVec* check_tv_mut(lua_State *L, int arg);
 
+/** Like check_tv_mut, but returns NULL if arg is not a larr.Vec. */
 TypeVec* test_tv_mut(lua_State *L, int arg);
 
+/**
+ *  Pushes a new, empty larr.Vec onto the stack with space for at least
+ *  capacity elements. Raises a Lua error if typeinfo names a type with
+ *  no vtbl or if the allocation fails.
+ *
+ *  @returns The TypeVec that was pushed.
+ */
+TypeVec* new_tv(lua_State *L, Typeinfo typeinfo, size_t capacity);
+
 const Vtbl* get_vtbl(int type);
 
 const Vtbl* num_vtbl(void);
@@ -17,6 +17,7 @@ void Vec_new(Vec *self, size_t element_size) {
     self->element_size = element_size;
     self->len = 0;
     self->capacity = 0;
+    self->external = 0;
 }
 
 /**
@@ -39,6 +40,35 @@ int Vec_with_capacity(Vec *self, size_t element_size, size_t capacity) {
     return LARR_OK;
 }
 
+/**
+ *  Initializes a Vec of len elements whose bytes are all zero, using
+ *  calloc() so that large buffers may be mapped lazily.
+ *
+ *  @param self Must not be NULL.
+ *  @returns LARR_NO_MEMORY if calloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Vec_zeroed(Vec *self, size_t element_size, size_t len) {
+    assert(self);
+
+    Vec_new(self, element_size);
+
+    if (len == 0 || element_size == 0) {
+        return LARR_OK;
+    }
+
+    self->data = calloc(len, element_size);
+
+    if (!self->data) {
+        return LARR_NO_MEMORY;
+    }
+
+    self->len = len;
+    self->capacity = len;
+
+    return LARR_OK;
+}
+
 /**
  *  Deallocates any memory owned by this Vec and sets its length
  *  and capacity to 0.
@@ -48,7 +78,10 @@ int Vec_with_capacity(Vec *self, size_t element_size, size_t capacity) {
 void Vec_delete(Vec *self) {
     assert(self);
 
-    free(self->data);
+    if (!self->external) {
+        free(self->data);
+    }
+
     self->data = NULL;
     self->len = 0;
     self->capacity = 0;
@@ -234,7 +267,7 @@ int Vec_insert(Vec *self, size_t index, const void *element) {
     }
 
     shift_right((char*) self->data + self->element_size * index,
-                self->element_size, self->len - index);
+                self->element_size, self->len - index + 1);
     memcpy((char*) self->data + self->element_size * index, element, self->element_size);
     ++self->len;
 
@@ -264,7 +297,7 @@ int Vec_remove(Vec *self, size_t index) {
         return LARR_OUT_OF_RANGE;
     }
 
-    shift_left((char*) self->data + self->element_size + index,
+    shift_left((char*) self->data + self->element_size * index,
                self->element_size, self->len - index);
     --self->len;
 
@@ -291,8 +324,8 @@ static size_t round_up_to_next_highest_power_of_2(size_t x);
  *  @param self Must not be NULL.
  *  @param additional The minimum number of extra elements that this
  *                    Vec should be able to push without reallocating.
- *  @returns LARR_NO_MEMORY if realloc() returns NULL, LARR_OK
- *           otherwise.
+ *  @returns LARR_NO_MEMORY if realloc() returns NULL or an external
+ *           buffer is too small, LARR_OK otherwise.
  */
 int Vec_reserve(Vec *self, size_t additional) {
     size_t requested_capacity;
@@ -303,6 +336,9 @@ int Vec_reserve(Vec *self, size_t additional) {
 
     if (self->capacity >= requested_capacity) {
         return LARR_OK;
+    } else if (self->external) {
+        /* an external buffer can't be moved, so its capacity is fixed */
+        return LARR_NO_MEMORY;
     } else {
         const size_t new_capacity = round_up_to_next_highest_power_of_2(requested_capacity);
         void *const new_data = (void*) realloc(self->data, self->element_size * new_capacity);
@@ -366,8 +402,8 @@ int Vec_append(Vec *self, const void *other, size_t len) {
 }
 
 /**
- *  Shortens this Vec to len elements. If len > the current length,
- *  equivalent to Vec_clear. Performs no reallocation.
+ *  Shortens this Vec to len elements. If len >= the current length,
+ *  has no effect. Performs no reallocation.
  *
  *  @param self Must not be NULL.
  *  @param len The number of elements to keep.
@@ -375,10 +411,8 @@ int Vec_append(Vec *self, const void *other, size_t len) {
 void Vec_truncate(Vec *self, size_t len) {
     assert(self);
 
-    if (len >= self->len) {
-        Vec_clear(self);
-    } else {
-        self->len -= len;
+    if (len < self->len) {
+        self->len = len;
     }
 }
 
@@ -12,6 +12,7 @@ typedef struct Vec {
     size_t element_size;
     size_t len;
     size_t capacity;
+    int external; /* data is owned elsewhere: never realloc()ed or free()d */
 } Vec;
 
 typedef enum VecErr {
@@ -41,6 +42,19 @@ void Vec_new(Vec *self, size_t element_size);
  */
 int Vec_with_capacity(Vec *self, size_t element_size, size_t capacity);
 
+/**
+ *  Initializes a Vec of len elements whose bytes are all zero. The
+ *  buffer comes from calloc(), so the operating system may map large
+ *  buffers lazily instead of touching every page up front.
+ *
+ *  @param self Must not be NULL.
+ *  @param element_size The stride, in bytes, between elements. Usually sizeof(T).
+ *  @param len The number of zeroed elements.
+ *  @returns LARR_NO_MEMORY if calloc() returns NULL, otherwise
+ *           LARR_OK.
+ */
+int Vec_zeroed(Vec *self, size_t element_size, size_t len);
+
 /**
  *  Deallocates any memory owned by this Vec and sets its length
  *  and capacity to 0.
@@ -176,8 +190,8 @@ void Vec_clear(Vec *self);
  *	@param self Must not be NULL.
  *	@param additional The minimum number of extra elements that this
  *					  Vec should be able to push without reallocating.
- *	@returns LARR_NO_MEMORY if realloc() returns NULL, LARR_OK
- *			 otherwise.
+ *	@returns LARR_NO_MEMORY if realloc() returns NULL or an external
+ *			 buffer is too small, LARR_OK otherwise.
  */
 int Vec_reserve(Vec *self, size_t additional);
 
@@ -204,8 +218,8 @@ void* Vec_as_mut_ptr(Vec *self);
 int Vec_append(Vec *self, const void *other, size_t len);
 
 /**
- *	Shortens this Vec to len elements. If len > the current length,
- *	equivalent to Vec_clear. Performs no reallocation.
+ *	Shortens this Vec to len elements. If len >= the current length,
+ *	has no effect. Performs no reallocation.
  *
  *	@param self Must not be NULL.
  *	@param len The number of elements to keep.
@@ -1,4 +1,663 @@
 local larr = require "liblarr"
+local Vec = larr.Vec
+
+local function vec(elem_type, t)
+	local v = Vec.new(elem_type)
+	v:append(t)
+
+	return v
+end
+
+local function same(v, t)
+	if #v ~= #t then
+		return false
+	end
+
+	for i = 1, #t do
+		if v[i] ~= t[i] then
+			return false
+		end
+	end
+
+	return true
+end
+
+-- calls f and checks that it raises an error whose message contains msg
+local function raises(msg, f, ...)
+	local ok, err = pcall(f, ...)
+
+	assert(not ok, "expected an error containing '" .. msg .. "'")
+	assert(tostring(err):find(msg, 1, true), err)
+end
+
+local function tmpname()
+	local path = os.tmpname()
+	os.remove(path)
+
+	return path
+end
+
+-- map, filter, reduce, foreach
+do
+	local v = vec('integer', {1, 2, 3, 4, 5})
+	assert(same(v:map(function(x) return x * 2 end), {2, 4, 6, 8, 10}))
+	assert(same(v:map(function(x) return x / 2 end, 'number'), {0.5, 1, 1.5, 2, 2.5}))
+	assert(same(v:filter(function(x) return x % 2 == 1 end), {1, 3, 5}))
+	assert(v:reduce(function(a, x) return a + x end) == 15)
+	assert(v:reduce(function(a, x) return a + x end, 100) == 115)
+
+	local s = 0
+	v:foreach(function(x, i) s = s + x * i end)
+	assert(s == 55)
+
+	raises("reduce of empty Vec", Vec.reduce, Vec.new('integer'), function(a, x) return a + x end)
+	raises("bad return value from map function", v.map, v, function() return 'a' end)
+end
+
+-- expressions
+do
+	local a = vec('number', {1, 2, 3})
+	local b = vec('integer', {4, 5, 6})
+	assert(same(((larr.expr(a) * b + 1) / 2):eval(), {2.5, 5.5, 9.5}))
+	assert(same((-larr.expr(a)):eval(), {-1, -2, -3}))
+	assert(same((larr.expr(a) * 2):eval(a), {2, 4, 6}) and a[3] == 6)
+	raises("mismatched lengths", function() return (larr.expr(a) + Vec.new('number')):eval() end)
+
+	local deep = larr.expr(a)
+	for _ = 1, 100 do
+		deep = deep + 1
+	end
+	raises("too many terms", deep.eval, deep)
+end
+
+-- Columns
+do
+	local c = larr.Columns{ts = 'integer', price = 'number'}
+	c:push{ts = 1, price = 2.5}
+	c:push(3.5, 2)
+	assert(#c == 2 and c:row(1).ts == 1 and c:row(2).price == 3.5 and c:get(2, 'ts') == 2)
+	assert(same(c:fields(), {'price', 'ts'}))
+	c:set(1, 'price', 9.5)
+	assert(same(c.price, {9.5, 3.5}) and same(c:column('price'), {9.5, 3.5}))
+
+	-- columns are clones, so pushing to one leaves the batch alone
+	local ts = c.ts
+	ts:push(100)
+	assert(#ts == 3 and #c == 2 and #c.ts == 2)
+
+	raises("bad value for field 'ts'", c.push, c, {ts = 1.5, price = 1})
+	assert(#c == 2 and #c.price == 2)
+
+	-- a row's __index may read the columns, or push to them, before its own values go in
+	local seen
+	c:push(setmetatable({price = 4.5}, {__index = function()
+		seen = c.ts
+		return 3
+	end}))
+	assert(#c == 3 and c:get(3, 'ts') == 3 and same(seen, {1, 2}))
+	raises("bad value for field 'ts'", c.push, c, setmetatable({price = 1}, {__index = function()
+		c:push{ts = 5, price = 5.5}
+		return 'x'
+	end}))
+	assert(#c == 4 and same(c.ts, {1, 2, 3, 5}) and same(c.price, {9.5, 3.5, 4.5, 5.5}))
+
+	raises("no such field 'volume'", c.column, c, 'volume')
+	raises("row index out of range", c.get, c, 5, 'ts')
+	raises("schema has no fields", larr.Columns, {})
+end
+
+-- NDArray
+do
+	local v = Vec.range('number', 1, 12)
+	local a = larr.NDArray(v, {3, 4})
+	assert(a:ndim() == 2 and #a == 12 and a:get(2, 3) == 7)
+	local t = a:transpose()
+	assert(t:get(3, 2) == 7 and same(t:to_vec(), {1, 5, 9, 2, 6, 10, 3, 7, 11, 4, 8, 12}))
+	assert(same(a:slice(2, 2, 4, 2):to_vec(), {2, 4, 6, 8, 10, 12}))
+	assert(a:reshape(2, 6):get(2, 1) == 7)
+	local row = larr.NDArray(Vec.range('number', 1, 3), 1, 3)
+	assert(same(row:broadcast_to(2, 3):to_vec(), {1, 2, 3, 1, 2, 3}))
+	a:set(1, 1, 100.5)
+	assert(v[1] == 100.5)
+	assert(not pcall(t.reshape, t, 12))
+	assert(not pcall(a.get, a, 4, 1))
+end
+
+-- gemm and gemv
+do
+	local A = vec('number', {1, 2, 3, 4, 5, 6})
+	local B = vec('number', {1, 0, 0, 1, 1, 1})
+	local C = Vec.zeros('number', 4)
+	larr.gemm(A, B, C, 2, 2, 3)
+	assert(same(C, {4, 5, 10, 11}))
+	larr.gemm(A, B, C, 2, 2, 3, 2, 1)
+	assert(same(C, {12, 15, 30, 33}))
+
+	local y = Vec.new('number')
+	larr.gemv(A, vec('number', {1, 2, 3}), y, 2, 3)
+	assert(same(y, {14, 32}))
+
+	-- an aliased output is rejected before it is grown
+	raises("C must not alias A or B", larr.gemm, A, B, A, 3, 3, 2)
+	assert(#A == 6)
+	raises("y must not alias A or x", larr.gemv, y, y, y, 5, 0)
+	assert(#y == 2)
+
+	raises("m * k is too large", larr.gemm, Vec.new('number'), Vec.new('number'),
+	       Vec.new('number'), 4, 4, 1 << 62)
+	raises("m * n is too large", larr.gemv, Vec.new('number'), Vec.new('number'),
+	       Vec.new('number'), 1 << 62, 4)
+end
+
+-- the SIMD kernels
+do
+	local isa = larr.simd()
+	assert(isa == 'scalar' or isa == 'sse2' or isa == 'avx2' or isa == 'avx512')
+
+	for _, n in ipairs{0, 1, 7, 8, 17, 1001} do
+		local x = Vec.range('number', 1, n)
+		assert(x:sum() == n * (n + 1) / 2 and x:dot(Vec.filled('number', n, 2)) == n * (n + 1))
+	end
+	assert(Vec.range('integer', 1, 100):sum() == 5050)
+end
+
+-- clone
+do
+	local v = vec('integer', {1, 2, 3})
+	local c = v:clone()
+	local d = c:clone()
+	c:push(4)
+	v[1] = 100
+	d:remove(2)
+	assert(same(v, {100, 2, 3}) and same(c, {1, 2, 3, 4}) and same(d, {1, 3}))
+end
+
+-- scans and differences
+do
+	local v = vec('integer', {3, 1, 4, 1, 5})
+	assert(same(v:cumsum(), {3, 4, 8, 9, 14}))
+	assert(same(v:cumprod(), {3, 3, 12, 12, 60}))
+	assert(same(v:cummin(), {3, 1, 1, 1, 1}))
+	assert(same(v:cummax(), {3, 3, 4, 4, 5}))
+	assert(same(v:exclusive_cumsum(), {0, 3, 4, 8, 9}))
+	assert(same(v:diff(), {-2, 3, -3, 4}) and same(v:diff(3), {-2, 4}) and #v:diff(10) == 0)
+
+	local c = v:clone()
+	c:cumsum(c)
+	assert(same(c, {3, 4, 8, 9, 14}) and v[2] == 1)
+	assert(not pcall(v.cumsum, v, Vec.new('number')))
+end
+
+-- bincount, histogram, unique, value_counts
+do
+	local v = vec('integer', {3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5})
+	assert(same(v:bincount(), {0, 2, 1, 2, 1, 3, 1, 0, 0, 1}))
+	assert(#v:bincount(10) == 11)
+	raises("out of range", v.bincount, v, 4)
+	assert(same(v:histogram(vec('number', {0, 2.5, 5, 7.5, 10})), {3, 3, 4, 1}))
+
+	local values, counts = v:value_counts()
+	assert(same(values, {1, 2, 3, 4, 5, 6, 9}) and same(counts, {2, 1, 2, 1, 3, 1, 1}))
+	assert(same(v:unique(), {1, 2, 3, 4, 5, 6, 9}))
+
+	-- values too far apart for the dense table
+	local w = vec('integer', {1000000000, -5, 7, 1000000000, -5})
+	values, counts = w:value_counts()
+	assert(same(values, {-5, 7, 1000000000}) and same(counts, {2, 1, 2}))
+
+	local n = vec('number', {0.5, 2, 0.5, -1})
+	assert(same(n:unique(), {-1, 0.5, 2}))
+end
+
+-- PackedVec
+do
+	local v = vec('integer', {math.mininteger, math.maxinteger, 0, -1, 5, 5})
+
+	for _, codec in ipairs{'delta', 'for'} do
+		local p = v:compress(codec)
+		assert(#p == 6 and p:codec() == codec and p[2] == math.maxinteger and p:get(6) == 5)
+		assert(p:min() == math.mininteger and p:max() == math.maxinteger)
+		assert(same(p:decompress(), {math.mininteger, math.maxinteger, 0, -1, 5, 5}))
+	end
+
+	local r = Vec.range('integer', 1, 1000)
+	assert(r:compress('for'):sum() == 500500 and r:compress():nbytes() < 8 * 1000)
+	raises("zstd", v.compress, v, 'zstd')
+
+	local p = v:compress()
+	assert(p.nosuch == nil and p[true] == nil and p[{}] == nil and p[7] == nil and p[1.5] == nil)
+end
+
+-- SparseVec
+do
+	local s = larr.SparseVec('number', 10)
+	s:set(5, 2.5)
+	s:set(1, 1)
+	s:set(10, -3)
+	s:set(5, 4)
+	s:set(7, 0)
+	assert(#s == 10 and s:nnz() == 3 and s:get(5) == 4 and s:get(2) == 0)
+	assert(same(s:indices(), {1, 5, 10}) and same(s:values(), {1, 4, -3}))
+
+	local d = Vec.range('number', 1, 10)
+	assert(s:dot(d) == 1 + 20 - 30)
+	assert(same(s:axpy(2, Vec.zeros('number', 10)), {2, 0, 0, 0, 8, 0, 0, 0, 0, -6}))
+	assert(larr.SparseVec('number', 10):from_dense(d):nnz() == 10)
+	assert(not pcall(s.get, s, 11))
+	raises("same type and dimension", s.dot, s, larr.SparseVec('integer', 10))
+
+	local z = Vec.filled('number', 3, 1)
+	larr.axpy(3, vec('number', {1, 2, 3}), z)
+	assert(same(z, {4, 7, 10}))
+end
+
+-- take, put, select, where
+do
+	local v = vec('number', {10, 20, 30, 40, 50})
+	assert(same(v:take(vec('integer', {5, 1, 3, 3})), {50, 10, 30, 30}))
+	raises("out of range", v.take, v, vec('integer', {1, 6}))
+
+	local mask = vec('integer', {1, 0, 0, 1, 1})
+	assert(same(v:select(mask), {10, 40, 50}))
+	assert(same(v:where(mask, -1), {10, -1, -1, 40, 50}))
+
+	local w = v:clone()
+	w:put(vec('integer', {2, 4}), vec('number', {-2, -4}))
+	assert(same(w, {10, -2, 30, -4, 50}) and v[2] == 20)
+end
+
+-- constructors
+do
+	assert(same(Vec.zeros('number', 3), {0, 0, 0}) and #Vec.zeros('integer', 0) == 0)
+	assert(same(Vec.filled('integer', 3, 7), {7, 7, 7}))
+	assert(not pcall(Vec.filled, 'integer', 2, 1.5))
+	assert(same(Vec.range('integer', 1, 10, 3), {1, 4, 7, 10}))
+	assert(same(Vec.range('integer', 10, 1, -4), {10, 6, 2}))
+	assert(#Vec.range('integer', 1, 0) == 0)
+	assert(same(Vec.range('number', 0, 1, 0.25), {0, 0.25, 0.5, 0.75, 1}))
+	assert(not pcall(Vec.range, 'integer', math.mininteger, math.maxinteger))
+	assert(same(Vec.linspace(0, 1, 5), {0, 0.25, 0.5, 0.75, 1}))
+	assert(same(Vec.from_string('integer', ' 1, 2,3\n 0x10 '), {1, 2, 3, 16}))
+	assert(same(Vec.from_string('number', '1e3 .5,-2'), {1000, 0.5, -2}))
+	assert(not pcall(Vec.from_string, 'integer', '1 2.5'))
+
+	local v = vec('number', {1, 2})
+	v:resize(4, 9)
+	assert(same(v, {1, 2, 9, 9}))
+	v:resize(1)
+	assert(same(v, {1}))
+end
+
+-- Heap
+do
+	for _, order in ipairs{'min', 'max'} do
+		local h = larr.Heap('integer', order)
+		local ref = {}
+
+		for i = 1, 500 do
+			local k = (i * 7919) % 101
+			h:push(k)
+			ref[#ref + 1] = k
+		end
+
+		table.sort(ref, function(a, b) if order == 'min' then return a < b else return a > b end end)
+
+		for i = 1, 500 do
+			assert(h:pop() == ref[i])
+		end
+
+		assert(h:is_empty() and h:pop() == nil)
+	end
+
+	local h = larr.Heap('number', 'min', true)
+	h:push(3, 30)
+	h:push(1, 10)
+	h:push(2, 20)
+	local key, payload = h:top()
+	assert(key == 1 and payload == 10)
+	key, payload = h:replace(5, 50)
+	assert(key == 1 and payload == 10)
+	key, payload = h:pop()
+	assert(key == 2 and payload == 20 and #h == 2)
+end
+
+-- bulk vtbl entries for every value type
+do
+	local b = vec('boolean', {true, false, true})
+	b:push(false)
+	assert(tostring(b) == "{true, false, true, false}" and b[1] == true and b[2] == false)
+	assert(not pcall(b.push, b, 1))
+
+	local w = Vec.new('integer')
+	assert(not pcall(w.append, w, {1, 2, 'x'}) and #w == 0)
+	assert(not pcall(w.append, w, {1, 2.5}) and #w == 0)
+	assert(tostring(Vec.new('number')) == "{}")
+end
+
+-- appending from iterators and coroutines
+do
+	local t = {1, 2, 3}
+	local v = Vec.new('integer')
+	v:append(ipairs(t))
+	v:append(pairs(t))
+	v:append(next, t)
+	assert(same(v, {1, 2, 3, 1, 2, 3, 1, 2, 3}))
+
+	v = Vec.new('integer')
+	assert(not pcall(v.append, v, ipairs({1, 'a'})) and #v == 0)
+
+	local co = coroutine.create(function()
+		for i = 1, 10 do
+			coroutine.yield(i, i + 100)
+		end
+
+		return 7
+	end)
+
+	v = Vec.new('integer')
+	assert(v:extend_from_coroutine(co, 3) == 4 and same(v, {1, 101, 2, 102}))
+	assert(v:extend_from_coroutine(co) == 17 and v[21] == 7 and coroutine.status(co) == 'dead')
+	assert(v:extend_from_coroutine(co) == 0)
+	raises("cannot resume non-suspended coroutine", v.extend_from_coroutine, v,
+	       (coroutine.running()))
+
+	local bad = coroutine.create(function() coroutine.yield(1, 'x') end)
+	raises("bad coroutine value", v.extend_from_coroutine, v, bad)
+	assert(#v == 21)
+
+	-- the coroutine may clone or shrink the Vec it's appending to
+	local snap
+	v = vec('number', {1, 2})
+	co = coroutine.create(function()
+		coroutine.yield(3)
+		snap = v:clone()
+		coroutine.yield(4, 5, 6, 7, 8)
+		v:clear()
+		coroutine.yield(9)
+	end)
+	assert(v:extend_from_coroutine(co) == 1 and same(v, {9}))
+	assert(same(snap, {1, 2, 3}))
+
+	-- shrinking it below where this call started, then failing, must not underflow
+	v = vec('number', {1, 2, 3})
+	co = coroutine.create(function()
+		v:clear()
+		v:push(1)
+		coroutine.yield(4)
+		coroutine.yield('x')
+	end)
+	raises("bad coroutine value", v.extend_from_coroutine, v, co)
+	assert(same(v, {1}))
+end
+
+-- yielding long operations
+do
+	local big = {}
+	for i = 1, 1000 do
+		big[i] = i
+	end
+
+	local function resumes(f)
+		local co = coroutine.create(f)
+		local n = 0
+
+		while true do
+			local ok, result = coroutine.resume(co)
+			assert(ok, result)
+
+			if coroutine.status(co) == 'dead' then
+				return n, result
+			end
+
+			n = n + 1
+		end
+	end
+
+	local old = larr.quantum(10)
+	local v = Vec.new('integer')
+	local n, len = resumes(function() v:append(big) return #v end)
+	assert(n > 0 and len == 1000)
+	n, len = resumes(function() return v:sum() end)
+	assert(n > 0 and len == 500500)
+
+	local w = vec('integer', {99})
+	local co = coroutine.create(function() w:append(big) end)
+	assert(coroutine.resume(co))
+	assert(not coroutine.resume(co, larr.cancel) and same(w, {99}))
+
+	assert(v:sum() == 500500)
+	larr.quantum(old)
+end
+
+-- save_async and load_async
+do
+	local path = tmpname()
+	local v = Vec.range('number', 1, 100000)
+	local h = v:save_async(path)
+	v[1] = -5
+	v = nil
+	collectgarbage()
+	assert(h:wait() == true and h:ready() == true)
+
+	local l = larr.load_async(path, 'number')
+	local w = l:wait()
+	assert(#w == 100000 and w[1] == 1 and w[100000] == 100000 and l:poll() == w)
+
+	raises("different element type", function() return larr.load_async(path, 'integer'):wait() end)
+
+	local f = io.open(path, "rb")
+	local head = f:read(100)
+	f:close()
+	f = io.open(path, "wb")
+	f:write(head)
+	f:close()
+	raises("truncated", function() return larr.load_async(path, 'number'):wait() end)
+	os.remove(path)
+
+	raises("couldn't open the file", function() return larr.load_async(path, 'number'):wait() end)
+	raises("couldn't open the file", function()
+		return Vec.new('number'):save_async(tmpname() .. "/x"):wait()
+	end)
+
+	vec('boolean', {true, false}):save_async(path):wait()
+	assert(same(larr.load_async(path, 'boolean'):wait(), {true, false}))
+	os.remove(path)
+end
+
+-- shared-memory Vecs
+do
+	local name = "/larr_test_" .. tostring(os.time())
+	local ok, w = pcall(Vec.shared, name, 'number', 5)
+
+	-- some sandboxes have no /dev/shm
+	if ok then
+		w:append({1, 2, 3})
+		local gen = w:publish()
+		local r, seen = Vec.attach(name)
+		assert(same(r, {1, 2, 3}) and seen == gen)
+		w:push(4)
+		w:push(5)
+		assert(not pcall(w.push, w, 6))
+
+		local r2 = Vec.attach(name)
+		r2[1] = 99
+		assert(r2[1] == 99 and w[1] == 1)
+		assert(not pcall(Vec.publish, r))
+
+		-- the creator writes in place, so its clones must be copies
+		local snap = w:clone()
+		local same_type = w:cast('number')
+		w[1] = 99
+		assert(snap[1] == 1 and same_type[1] == 1 and w[1] == 99)
+		snap:push(6)
+		assert(#snap == 6 and #w == 5)
+		Vec.unlink(name)
+		assert(not pcall(Vec.attach, name))
+	end
+end
+
+-- handing Vecs between lua_States
+do
+	local v = Vec.range('integer', 1, 1000)
+	local token = v:share()
+	local w = Vec.from_shared(token)
+	assert(#w == 1000 and w:sum() == 500500)
+	w[1] = 42
+	assert(v[1] == 1)
+	raises("unredeemed token", Vec.from_shared, token)
+	raises("unredeemed token", Vec.discard_shared, token)
+
+	local x = Vec.from_shared(w:share('write'))
+	assert(#w == 0 and x[1] == 42 and #x == 1000)
+
+	token = v:share()
+	Vec.discard_shared(token)
+	raises("unredeemed token", Vec.from_shared, token)
+	assert(not pcall(Vec.share, v, 'bogus'))
+	assert(not pcall(Vec.share, Vec.new('light_userdata')))
+	assert(Vec.from_shared(vec('boolean', {true}):share())[1] == true)
+end
+
+-- AppendBuffer
+do
+	local b = larr.AppendBuffer(4)
+	for i = 1, 100 do
+		b:push(i)
+	end
+
+	local v = Vec.new('number')
+	assert(b:drain_into(v) == 100 and v:sum() == 5050)
+	assert(b:drain_into(v) == 0)
+	raises("expected larr.Vec<number>", b.drain_into, b, Vec.new('integer'))
+
+	b:push(1.5)
+	assert(not b:is_sealed())
+	local rest = b:seal()
+	assert(same(rest, {1.5}) and b:is_sealed() and b:dropped() == 0)
+	raises("sealed", b.push, b, 1)
+	assert(#b:seal() == 0 and b:drain_into(v) == 0)
+	raises("segment length", larr.AppendBuffer, 0)
+end
+
+-- VecLog
+do
+	local path = tmpname()
+	local log, dropped = Vec.open_log(path, 'integer', {batch = 100})
+	assert(dropped == 0 and #log == 0)
+
+	for i = 1, 1050 do
+		log:push(i)
+	end
+
+	log:append({1, 2, 3})
+	log:append(Vec.range('integer', 1, 10))
+	assert(not pcall(log.append, log, {1, 2, 'x'}))
+	assert(#log == 1063 and log:vec()[1063] == 10)
+	log:close()
+	raises("larr.VecLog is closed", log.push, log, 1)
+
+	local again
+	again, dropped = Vec.open_log(path, 'integer')
+	assert(dropped == 0 and #again == 1063)
+	assert(again:vec():sum() == 1050 * 1051 // 2 + 6 + 55)
+
+	-- a torn tail is dropped and the log reopens at the last whole batch
+	again:push(99)
+	again:close()
+	local f = io.open(path, "rb")
+	local data = f:read("a")
+	f:close()
+	f = io.open(path, "wb")
+	f:write(data:sub(1, #data - 3))
+	f:close()
+
+	local torn
+	torn, dropped = Vec.open_log(path, 'integer')
+	assert(#torn == 1063 and dropped > 0)
+	torn:push(7)
+	torn:close()
+	assert(#Vec.open_log(path, 'integer') == 1064)
+
+	raises("holds a different element type", Vec.open_log, path, 'number')
+	os.remove(path)
+
+	local b = Vec.open_log(path, 'boolean', {sync_every = 1})
+	b:push(true)
+	b:sync()
+	b:close()
+	assert(Vec.open_log(path, 'boolean'):vec()[1] == true)
+	os.remove(path)
+end
+
+-- fill_random, shuffle and sample
+do
+	local v = Vec.zeros('number', 10000)
+	v:fill_random('uniform', 42)
+	local w = Vec.zeros('number', 100)
+	w:fill_random('uniform', 42)
+
+	for i = 1, 100 do
+		assert(w[i] == v[i] and v[i] >= 0 and v[i] < 1)
+	end
+
+	local dice = Vec.zeros('integer', 1000)
+	dice:fill_random('integer', 3, 1, 6)
+	for i = 1, #dice do
+		assert(dice[i] >= 1 and dice[i] <= 6)
+	end
+
+	assert(not pcall(dice.fill_random, dice, 'normal', 1))
+	assert(not pcall(dice.fill_random, dice, 'integer', 1, 5, 4))
+
+	local r = Vec.range('integer', 1, 100)
+	local s = r:clone():shuffle(9)
+	local seen = {}
+	for i = 1, 100 do
+		assert(not seen[s[i]])
+		seen[s[i]] = true
+	end
+	assert(same(r:clone():shuffle(9), s) and r[1] == 1)
+
+	local picked = r:sample(10, false, 5)
+	seen = {}
+	for i = 1, 10 do
+		assert(not seen[picked[i]])
+		seen[picked[i]] = true
+	end
+	assert(#r:sample(500, true) == 500)
+	assert(not pcall(r.sample, r, 101))
+	assert(not pcall(Vec.sample, Vec.new('integer'), 1, true))
+end
+
+-- cast and cast_inplace
+do
+	local n = vec('number', {1, -2, 3.5, 2.5})
+	raises("can't cast element 3 (3.5) of larr.Vec<number> to integer in 'exact' mode",
+	       n.cast, n, 'integer')
+	assert(same(n:cast('integer', 'trunc'), {1, -2, 3, 2}))
+	assert(same(n:cast('integer', 'round'), {1, -2, 4, 2}))
+	assert(same(n:cast('boolean'), {true, true, true, true}))
+	assert(same(vec('integer', {0, 7}):cast('number'), {0, 7}))
+	assert(same(vec('boolean', {true, false}):cast('integer'), {1, 0}))
+
+	local big = vec('number', {1e300, -1e300, 0 / 0})
+	raises("in 'trunc' mode", big.cast, big, 'integer', 'trunc')
+	assert(same(big:cast('integer', 'saturate'), {math.maxinteger, math.mininteger, 0}))
+	raises("can't cast larr.Vec<number> to larr.Vec<light_userdata>", n.cast, n, 'light_userdata')
+
+	-- a failed cast_inplace leaves the Vec as it was
+	raises("in 'exact' mode", n.cast_inplace, n, 'integer')
+	assert(same(n, {1, -2, 3.5, 2.5}))
+	n:cast_inplace('integer', 'trunc')
+	assert(math.type(n[1]) == 'integer' and same(n, {1, -2, 3, 2}))
+	raises("use cast", n.cast_inplace, n, 'boolean')
+
+	-- the new type's name mustn't point into the collected argument string
+	n:cast_inplace(('number'):sub(1))
+	n[1] = 1.5
+	collectgarbage()
+	raises("of larr.Vec<number> to integer", n.cast, n, 'integer')
+end
 
 local num_elements = 1 << 20
 local array = larr.Vec.with_capacity('integer', num_elements)
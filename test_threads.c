@@ -0,0 +1,544 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <larr/larr.h>
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+/*
+ *  Multi-threaded stress tests for the parts of larr that cross
+ *  threads: larr.AppendBuffer with native producers, Vec:share and
+ *  Vec.from_shared between lua_States on different threads, and
+ *  save_async/load_async from several lua_States at once. Each test
+ *  checks that every element arrives exactly once and in order; run it
+ *  under a thread sanitizer or valgrind to catch races and leaks too.
+ */
+
+#define NUM_PRODUCERS 8
+
+#define PER_PRODUCER 100000
+
+/* producer values are id * ID_STRIDE + sequence number, exact in a double */
+#define ID_STRIDE 1e9
+
+#define NUM_SHARERS 4
+
+#define NUM_REDEEMERS 4
+
+#define SHARES_PER_SHARER 2000
+
+#define NUM_IO_THREADS 4
+
+#define QUEUE_LEN 64
+
+typedef struct Producer {
+    pthread_t thread;
+    LarrAppendBuffer *buf;
+    long id;
+    long pushed; /* values that were accepted */
+    int until_sealed; /* keep pushing until the buffer is sealed */
+} Producer;
+
+typedef struct TokenQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    void *tokens[QUEUE_LEN];
+    size_t head;
+    size_t len;
+    int sharers_left;
+} TokenQueue;
+
+typedef struct Worker {
+    pthread_t thread;
+    TokenQueue *queue;
+    long id;
+    long count;
+} Worker;
+
+static void fail(const char *what, const char *detail);
+
+static lua_State* new_state(void);
+
+static void run(lua_State *L, const char *chunk);
+
+static void* produce(void *arg);
+
+static void check_drained(lua_State *L, const long *pushed);
+
+static void test_append_buffer(void);
+
+static void test_append_buffer_seal(void);
+
+static void queue_put(TokenQueue *queue, void *token);
+
+static void* queue_take(TokenQueue *queue);
+
+static void* share(void *arg);
+
+static void* redeem(void *arg);
+
+static void test_handoff(void);
+
+static void* save_and_load(void *arg);
+
+static void test_io(void);
+
+int main(void) {
+    test_append_buffer();
+    test_append_buffer_seal();
+    test_handoff();
+    test_io();
+
+    return EXIT_SUCCESS;
+}
+
+static void fail(const char *what, const char *detail) {
+    fprintf(stderr, "test_threads: %s: %s\n", what, detail ? detail : "failed");
+
+    exit(EXIT_FAILURE);
+}
+
+static lua_State* new_state(void) {
+    lua_State *L;
+
+    L = luaL_newstate();
+
+    if (!L) {
+        fail("luaL_newstate", "out of memory");
+    }
+
+    luaL_openlibs(L);
+    luaL_requiref(L, "larr", luaopen_liblarr, 1);
+    lua_pop(L, 1);
+
+    return L;
+}
+
+static void run(lua_State *L, const char *chunk) {
+    assert(L);
+    assert(chunk);
+
+    if (luaL_dostring(L, chunk) != LUA_OK) {
+        fail(chunk, lua_tostring(L, -1));
+    }
+}
+
+/* pushes one value at a time and in runs of up to 7, as hosts would */
+static void* produce(void *arg) {
+    Producer *const producer = (Producer*) arg;
+    lua_Number values[7];
+    long seq = 0;
+
+    assert(producer);
+
+    while ((producer->until_sealed && seq + 7 < ID_STRIDE) || seq < PER_PRODUCER) {
+        const long run_len = (seq % 3 == 0 && (producer->until_sealed || seq + 7 <= PER_PRODUCER))
+                             ? 7 : 1;
+        long i;
+
+        for (i = 0; i < run_len; ++i) {
+            values[i] = (lua_Number) producer->id * ID_STRIDE + (lua_Number) (seq + i);
+        }
+
+        if (!larr_append_buffer_push_n(producer->buf, values, (size_t) run_len)) {
+            break;
+        }
+
+        seq += run_len;
+    }
+
+    producer->pushed = seq;
+    larr_append_buffer_release(producer->buf);
+
+    return NULL;
+}
+
+/* checks that the Vec in global got holds exactly what each producer pushed, in order */
+static void check_drained(lua_State *L, const long *pushed) {
+    const lua_Number *data;
+    size_t len;
+    size_t i;
+    long next[NUM_PRODUCERS];
+    long total = 0;
+
+    assert(L);
+    assert(pushed);
+
+    memset(next, 0, sizeof(next));
+    lua_getglobal(L, "got");
+    larr_check_vec(L, -1, (const void**) &data, &len, NULL);
+    lua_pop(L, 1);
+
+    for (i = 0; i < len; ++i) {
+        const long id = (long) (data[i] / ID_STRIDE);
+
+        if (id < 0 || id >= NUM_PRODUCERS
+            || data[i] - (lua_Number) id * ID_STRIDE != (lua_Number) next[id]) {
+            fail("AppendBuffer", "a value arrived twice or out of order");
+        }
+
+        ++next[id];
+    }
+
+    for (i = 0; i < NUM_PRODUCERS; ++i) {
+        if (next[i] != pushed[i]) {
+            fail("AppendBuffer", "an accepted value was lost");
+        }
+
+        total += pushed[i];
+    }
+
+    if ((long) len != total) {
+        fail("AppendBuffer", "drained a different number of values than were pushed");
+    }
+}
+
+static void test_append_buffer(void) {
+    Producer producers[NUM_PRODUCERS];
+    long pushed[NUM_PRODUCERS];
+    LarrAppendBuffer *buf;
+    lua_State *L;
+    long i;
+
+    L = new_state();
+
+    /* small segments, so that producers race to install most of them */
+    run(L, "buf = larr.AppendBuffer(64) got = larr.Vec.new('number')");
+    lua_getglobal(L, "buf");
+    buf = larr_check_append_buffer(L, -1);
+    lua_pop(L, 1);
+
+    for (i = 0; i < NUM_PRODUCERS; ++i) {
+        producers[i].buf = buf;
+        producers[i].id = i;
+        producers[i].until_sealed = 0;
+        larr_append_buffer_retain(buf);
+
+        if (pthread_create(&producers[i].thread, NULL, produce, &producers[i]) != 0) {
+            fail("pthread_create", NULL);
+        }
+    }
+
+    /* drains race with the producers */
+    for (i = 0; i < 200; ++i) {
+        run(L, "buf:drain_into(got)");
+    }
+
+    for (i = 0; i < NUM_PRODUCERS; ++i) {
+        pthread_join(producers[i].thread, NULL);
+        pushed[i] = producers[i].pushed;
+
+        if (pushed[i] != PER_PRODUCER) {
+            fail("AppendBuffer", "a push failed before the buffer was sealed");
+        }
+    }
+
+    run(L, "got:append(buf:seal()) assert(buf:dropped() == 0 and buf:is_sealed())");
+    check_drained(L, pushed);
+
+    lua_close(L);
+    printf("AppendBuffer: %d producers x %d values ok\n", NUM_PRODUCERS, PER_PRODUCER);
+}
+
+/* sealing while producers push: whatever was accepted must come out */
+static void test_append_buffer_seal(void) {
+    Producer producers[NUM_PRODUCERS];
+    long pushed[NUM_PRODUCERS];
+    LarrAppendBuffer *buf;
+    lua_State *L;
+    long i;
+
+    L = new_state();
+
+    run(L, "buf = larr.AppendBuffer(16) got = larr.Vec.new('number')");
+    lua_getglobal(L, "buf");
+    buf = larr_check_append_buffer(L, -1);
+    lua_pop(L, 1);
+
+    for (i = 0; i < NUM_PRODUCERS; ++i) {
+        producers[i].buf = buf;
+        producers[i].id = i;
+        producers[i].until_sealed = 1;
+        larr_append_buffer_retain(buf);
+
+        if (pthread_create(&producers[i].thread, NULL, produce, &producers[i]) != 0) {
+            fail("pthread_create", NULL);
+        }
+    }
+
+    run(L, "repeat buf:drain_into(got) until #got >= 100000");
+    run(L, "got:append(buf:seal())");
+
+    for (i = 0; i < NUM_PRODUCERS; ++i) {
+        pthread_join(producers[i].thread, NULL);
+        pushed[i] = producers[i].pushed;
+    }
+
+    run(L, "assert(buf:dropped() == 0 and buf:drain_into(got) == 0)");
+    check_drained(L, pushed);
+
+    lua_close(L);
+    printf("AppendBuffer: seal under %d producers ok\n", NUM_PRODUCERS);
+}
+
+static void queue_put(TokenQueue *queue, void *token) {
+    assert(queue);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->len == QUEUE_LEN) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    queue->tokens[(queue->head + queue->len) % QUEUE_LEN] = token;
+    ++queue->len;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/* @returns NULL once every sharer is done and the queue is empty */
+static void* queue_take(TokenQueue *queue) {
+    void *token = NULL;
+
+    assert(queue);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->len == 0 && queue->sharers_left > 0) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    if (queue->len > 0) {
+        token = queue->tokens[queue->head];
+        queue->head = (queue->head + 1) % QUEUE_LEN;
+        --queue->len;
+        pthread_cond_broadcast(&queue->cond);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return token;
+}
+
+/*
+ *  Shares Vecs of 1..n, alternating between "read" mode, after which
+ *  the sharer writes to its own copy, and "write" mode. Every tenth
+ *  token is discarded rather than sent.
+ */
+static void* share(void *arg) {
+    Worker *const worker = (Worker*) arg;
+    lua_State *L;
+    long i;
+
+    assert(worker);
+
+    L = new_state();
+
+    for (i = 0; i < SHARES_PER_SHARER; ++i) {
+        lua_pushinteger(L, (lua_Integer) (i % 500 + 1));
+        lua_setglobal(L, "n");
+        run(L, (i % 2 == 0)
+            ? "v = larr.Vec.range('integer', 1, n) token = v:share('read') v[1] = -1 v:push(0)"
+            : "v = larr.Vec.range('integer', 1, n) token = v:share('write') assert(#v == 0)");
+
+        if (i % 10 == 9) {
+            run(L, "larr.Vec.discard_shared(token)");
+            ++worker->count;
+        } else {
+            lua_getglobal(L, "token");
+            queue_put(worker->queue, lua_touserdata(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+
+    /* redeemers may still share these Vecs' buffers as they are freed */
+    lua_close(L);
+
+    pthread_mutex_lock(&worker->queue->mutex);
+    --worker->queue->sharers_left;
+    pthread_cond_broadcast(&worker->queue->cond);
+    pthread_mutex_unlock(&worker->queue->mutex);
+
+    return NULL;
+}
+
+static void* redeem(void *arg) {
+    Worker *const worker = (Worker*) arg;
+    lua_State *L;
+    void *token;
+
+    assert(worker);
+
+    L = new_state();
+
+    while ((token = queue_take(worker->queue)) != NULL) {
+        const lua_Integer *data;
+        size_t len;
+        int type;
+
+        lua_pushlightuserdata(L, token);
+        lua_setglobal(L, "token");
+        run(L, "w = larr.Vec.from_shared(token)"
+               " assert(not pcall(larr.Vec.from_shared, token))"
+               " assert(w:sum() == #w * (#w + 1) // 2 and w[1] == 1)");
+
+        lua_getglobal(L, "w");
+
+        if (!larr_test_vec(L, -1, (const void**) &data, &len, &type)
+            || type != LARR_TYPE_INTEGER || len == 0 || data[len - 1] != (lua_Integer) len) {
+            fail("Vec.from_shared", "the redeemed Vec is wrong");
+        }
+
+        lua_pop(L, 1);
+
+        /* writing copies a buffer that the sharer may still be reading */
+        run(L, "w[1] = 7 w:push(1) w = nil");
+        ++worker->count;
+
+        if (worker->count % 100 == 0) {
+            lua_gc(L, LUA_GCCOLLECT, 0);
+        }
+    }
+
+    lua_close(L);
+
+    return NULL;
+}
+
+static void test_handoff(void) {
+    Worker sharers[NUM_SHARERS];
+    Worker redeemers[NUM_REDEEMERS];
+    TokenQueue queue;
+    long discarded = 0;
+    long redeemed = 0;
+    long i;
+
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    queue.head = 0;
+    queue.len = 0;
+    queue.sharers_left = NUM_SHARERS;
+
+    for (i = 0; i < NUM_REDEEMERS; ++i) {
+        redeemers[i].queue = &queue;
+        redeemers[i].id = i;
+        redeemers[i].count = 0;
+
+        if (pthread_create(&redeemers[i].thread, NULL, redeem, &redeemers[i]) != 0) {
+            fail("pthread_create", NULL);
+        }
+    }
+
+    for (i = 0; i < NUM_SHARERS; ++i) {
+        sharers[i].queue = &queue;
+        sharers[i].id = i;
+        sharers[i].count = 0;
+
+        if (pthread_create(&sharers[i].thread, NULL, share, &sharers[i]) != 0) {
+            fail("pthread_create", NULL);
+        }
+    }
+
+    for (i = 0; i < NUM_SHARERS; ++i) {
+        pthread_join(sharers[i].thread, NULL);
+        discarded += sharers[i].count;
+    }
+
+    for (i = 0; i < NUM_REDEEMERS; ++i) {
+        pthread_join(redeemers[i].thread, NULL);
+        redeemed += redeemers[i].count;
+    }
+
+    if (redeemed + discarded != (long) NUM_SHARERS * SHARES_PER_SHARER) {
+        fail("Vec:share", "a token was lost");
+    }
+
+    pthread_cond_destroy(&queue.cond);
+    pthread_mutex_destroy(&queue.mutex);
+    printf("Vec:share: %ld redeemed, %ld discarded across %d threads ok\n", redeemed, discarded,
+           NUM_SHARERS + NUM_REDEEMERS);
+}
+
+/* round trips through files of its own, and drops Vecs and handles mid-flight */
+static void* save_and_load(void *arg) {
+    Worker *const worker = (Worker*) arg;
+    char prefix[64];
+    lua_State *L;
+
+    assert(worker);
+
+    L = new_state();
+    sprintf(prefix, "/tmp/larr_test_threads_%ld_%ld_", (long) getpid(), worker->id);
+    lua_pushstring(L, prefix);
+    lua_setglobal(L, "prefix");
+
+    /* each of these is run 20 times with growing n */
+    run(L,
+        "function save_all(n)\n"
+        "    local handles = {}\n"
+        "    for k = 1, 4 do\n"
+        "        local v = larr.Vec.range('number', 1, n + k)\n"
+        "        handles[k] = v:save_async(prefix .. k)\n"
+        "        v[1] = -1\n"
+        "    end\n"
+        "    collectgarbage()\n"
+        "    for k = 1, 4 do assert(handles[k]:wait()) end\n"
+        "end\n");
+    run(L,
+        "function load_all(n)\n"
+        "    larr.load_async(prefix .. 1, 'number')\n"
+        "    for k = 1, 4 do\n"
+        "        local w = larr.load_async(prefix .. k, 'number'):wait()\n"
+        "        assert(#w == n + k and w[1] == 1 and w:sum() == (n + k) * (n + k + 1) / 2)\n"
+        "    end\n"
+        "    larr.Vec.range('integer', 1, n):save_async(prefix .. 'dropped')\n"
+        "    collectgarbage()\n"
+        "end\n");
+    run(L, "for round = 1, 20 do save_all(1000 * round) load_all(1000 * round) end");
+    run(L, "collectgarbage() for k = 1, 4 do os.remove(prefix .. k) end");
+
+    /* lua_close waits for the dropped jobs through their handles' finalizers */
+    lua_close(L);
+
+    strcat(prefix, "dropped");
+    remove(prefix);
+
+    return NULL;
+}
+
+static void test_io(void) {
+    Worker workers[NUM_IO_THREADS];
+    long i;
+
+    for (i = 0; i < NUM_IO_THREADS; ++i) {
+        workers[i].queue = NULL;
+        workers[i].id = i;
+        workers[i].count = 0;
+
+        if (pthread_create(&workers[i].thread, NULL, save_and_load, &workers[i]) != 0) {
+            fail("pthread_create", NULL);
+        }
+    }
+
+    for (i = 0; i < NUM_IO_THREADS; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    printf("save_async/load_async: %d threads ok\n", NUM_IO_THREADS);
+}